@@ -6,7 +6,7 @@ import protocol AppKit.NSApplicationDelegate
 
 class AppDelegate: NSObject, NSApplicationDelegate, LayerDelegate {
 	private var display: Render.Display!
-	private var link: DisplayLink!
+	private var scheduler: Renderer.Scheduler!
 	private var renderer: Renderer!
     
     func applicationDidFinishLaunching(_ aNotification: Notification) {
@@ -90,8 +90,9 @@ class AppDelegate: NSObject, NSApplicationDelegate, LayerDelegate {
 		self.renderer = Renderer(self.display.device)
         self.renderer.layer = root
 		
-		// Create a display link to drive render updates.
-		self.link = DisplayLink {
+		// Schedule render updates from the display's refresh, only drawing a
+		// frame when the layer tree changes, so that an idle screen uses no CPU.
+		self.scheduler = Renderer.Scheduler(self.renderer) { renderer, time in
 			
 			// Create a display-sized render surface once and update bounds if needed.
 			if self.display.currentDrawable == nil {
@@ -102,16 +103,16 @@ class AppDelegate: NSObject, NSApplicationDelegate, LayerDelegate {
 			}
 			let drawable = self.display.currentDrawable!
 
-			// Renders a frame into the `currentDrawable` at the current media time.
-			self.renderer.renderTarget = drawable
-			self.renderer.beginFrame(atTime: CurrentMediaTime())
-			self.renderer.render {
+			// Renders a frame into the `currentDrawable` for its presentation time.
+			renderer.renderTarget = drawable
+			renderer.beginFrame(atTime: time)
+			renderer.render {
 				self.display.render(drawable)
 				// TODO: release and re-obtain a drawable here?
 			}
-			self.renderer.endFrame()
+			renderer.endFrame()
 		}
-		self.link.add(to: .current, forMode: .common)
+		self.scheduler.start()
     }
     
     /*
@@ -22,6 +22,28 @@ static inline kern_return_t __bootstrap_register(const char *name, mach_port_t p
     return bootstrap_register(bootstrap_port, name, port);
 }
 
+// Swift has no atomics; these back the single-writer buffers that are read
+// from other threads without locking (see `Trace`).
+#include <stdatomic.h>
+static inline uint64_t __load_acquire(const uint64_t *p) {
+    return atomic_load_explicit((const _Atomic uint64_t *)p, memory_order_acquire);
+}
+static inline uint64_t __load_relaxed(const uint64_t *p) {
+    return atomic_load_explicit((const _Atomic uint64_t *)p, memory_order_relaxed);
+}
+static inline void __store_release(uint64_t *p, uint64_t value) {
+    atomic_store_explicit((_Atomic uint64_t *)p, value, memory_order_release);
+}
+static inline void __store_relaxed(uint64_t *p, uint64_t value) {
+    atomic_store_explicit((_Atomic uint64_t *)p, value, memory_order_relaxed);
+}
+static inline void __fence_acquire(void) {
+    atomic_thread_fence(memory_order_acquire);
+}
+static inline void __fence_release(void) {
+    atomic_thread_fence(memory_order_release);
+}
+
 // TODO:
 #import <QuartzCore/QuartzCore.h>
 extern void CATransform3DInterpolate(CATransform3D *, CATransform3D *, CATransform3D *, double);
@@ -14,12 +14,25 @@ public protocol Animatable {
     ///
     @inline(__always)
     static func multiply(_ lhs: Animatable, _ rhs: Float) -> Self
+    
+    /// Whether `lhs` and `rhs` may be interpolated; if not, an animation between
+    /// them snaps to its target value. By default, both must be of the same type.
+    @inline(__always)
+    static func canInterpolate(_ lhs: Animatable, _ rhs: Animatable) -> Bool
+}
+
+extension Animatable {
+    @inline(__always)
+    public static func canInterpolate(_ lhs: Animatable, _ rhs: Animatable) -> Bool {
+        return lhs is Self && rhs is Self
+    }
 }
 
 ///
 @inline(__always)
 public func mix(from: Animatable, to: Animatable, _ fraction: Float) -> Animatable {
     let x = type(of: from)
+    guard x.canInterpolate(from, to) else { return to }
     return x.add(x.multiply(from, 1.0 - fraction), x.multiply(to, fraction))
 }
 
@@ -27,6 +40,7 @@ public func mix(from: Animatable, to: Animatable, _ fraction: Float) -> Animatab
 @inline(__always)
 public func mix(from: Animatable, by: Animatable, _ fraction: Float) -> Animatable {
     let x = type(of: from)
+    guard x.canInterpolate(from, by) else { return from }
     return x.add(from, x.multiply(by, fraction))
 }
 
@@ -34,6 +48,7 @@ public func mix(from: Animatable, by: Animatable, _ fraction: Float) -> Animatab
 @inline(__always)
 public func mix(by: Animatable, to: Animatable, _ fraction: Float) -> Animatable {
     let x = type(of: to)
+    guard x.canInterpolate(by, to) else { return to }
     return x.subtract(to, x.multiply(by, fraction))
 }
 
@@ -333,7 +348,14 @@ extension ColorMatrix: Animatable {
         return lhs * rhs
     }
 }
+/// Arrays (such as `GradientLayer.colors` or `locations`) are interpolated
+/// element-wise, and only if both have the same number of elements.
 extension Array: Animatable where Element: Animatable {
+    @inline(__always)
+    public static func canInterpolate(_ lhs: Animatable, _ rhs: Animatable) -> Bool {
+        guard let lhs = lhs as? Array, let rhs = rhs as? Array else { return false }
+        return lhs.count == rhs.count
+    }
     @inline(__always)
     public static func add(_ lhs: Animatable, _ rhs: Animatable) -> Array<Element> {
         let lhs = lhs as! Array, rhs = rhs as! Array
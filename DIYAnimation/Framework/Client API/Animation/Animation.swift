@@ -115,8 +115,15 @@ public class Animation: MediaTiming, Action, CustomStringConvertible {
     /// Default values of an `Animation`'s keyPaths.
     public class func defaultValue(forKey keyPath: String) -> Any? {
         switch keyPath {
+        case "beginTime": return 0.0 as TimeInterval
+        case "duration": return 0.0 as TimeInterval
         case "speed": return 1.0 as TimeInterval
+        case "timeOffset": return 0.0 as TimeInterval
+        case "repeatCount": return 0
+        case "repeatDuration": return 0.0 as TimeInterval
+        case "autoreverses": return false
         case "fillMode": return FillMode.removed
+        case "frameInterval": return 0.0 as TimeInterval
         case "timingFunction": return TimingFunction.default
         case "removedOnCompletion": return true
         case "isEnabled": return true
@@ -209,10 +216,11 @@ public class BasicAnimation: PropertyAnimation {
     
     /// Apply the receiver to the provided `Layer`.
     internal override func apply(to layer: Layer, at time: TimeInterval) {
-        let value = Float((0.1 * time).truncatingRemainder(dividingBy: 1.0))
+        let local = Render.Timing(self).map(time: time)
+        guard !local.isNaN else { return } // removed
+        let value = Float(local / self.duration)
         
         // value = value via solved timingfunction!!
-        // consider mediatiming mapped time
         
         switch (self.fromValue as? Animatable,
                 self.byValue as? Animatable,
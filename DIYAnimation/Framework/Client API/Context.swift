@@ -76,6 +76,13 @@ public final class Context: Hashable {
     ///
     public private(set) var isValid: Bool = true
     
+    /// Incremented by every committed transaction that modified the layer tree;
+    /// a renderer that last drew the tree at an older seed must draw it again.
+    internal private(set) var seed: UInt64 = 0
+    
+    /// Invoked on the committing thread after the `seed` is incremented.
+    internal var commitHandler: (() -> ())? = nil
+    
     ///
     public var colorSpace = CGColorSpaceCreateDeviceRGB() {
         didSet {
@@ -103,6 +110,7 @@ public final class Context: Hashable {
                 if let old = oldValue {
                     old.context = nil
                     Transaction.ensure().add(.removeLayer(old))
+                    self.seed += 1
                 }
                 
                 // Attach and link the new layer, if any:
@@ -218,6 +226,24 @@ public final class Context: Hashable {
         //let contexts = Context.allContexts.compactMap { $0.value }
         // do stuff
         // call transaction handlers too
+        
+        // Advance the seed of each context whose tree was modified, once:
+        var modified = [Context]()
+        for command in commands {
+            switch command {
+            case .addRoot(let l), .setLayer(let l):
+                var root = l
+                while let s = root.superlayer { root = s }
+                if let c = root.context, !modified.contains(c) {
+                    modified.append(c)
+                }
+            default: break
+            }
+        }
+        for c in modified {
+            c.lock.whileLocked { c.seed += 1 }
+            c.commitHandler?()
+        }
     }
     
     // synchronize: check current seed vs server's seed
@@ -4,7 +4,9 @@ import Metal
 // create BackingStore (IFF < 1024bytes!)
 // share BackingStore vm page with renderer
 
-///
+/// A double-buffered drawable whose buffers are `IOSurface`s shared with the
+/// renderer. Only the invalidated region of the receiver is redrawn during an
+/// `update(...)`; the remainder is copied forward from the front buffer.
 internal final class BackingStore: Drawable, RenderConvertible, Hashable {
     
     ///
@@ -22,16 +24,16 @@ internal final class BackingStore: Drawable, RenderConvertible, Hashable {
         }
         
         ///
-        internal static let opaque = Flags(0)
+        internal static let opaque = Flags(1 << 0)
         
         ///
-        internal static let cleared = Flags(1)
+        internal static let cleared = Flags(1 << 1)
         
         ///
-        internal static let mipmap = Flags(2)
+        internal static let mipmap = Flags(1 << 2)
         
         ///
-        internal static let autoMipmap = Flags(3)
+        internal static let autoMipmap = Flags(1 << 3)
     }
     
     //
@@ -47,8 +49,9 @@ internal final class BackingStore: Drawable, RenderConvertible, Hashable {
     ///
     private static var pendingCollect: Bool = false
     
-    /// Marks the front buffer of the receiver as `volatile`, and the system is
-    /// able to reclaim the memory used by only this buffer.
+    /// Marks the buffers of the receiver as `volatile` whenever they are not
+    /// being drawn into, and the system is able to reclaim their memory; the
+    /// contents are redrawn entirely if the front buffer is reclaimed.
     internal var isVolatile: Bool = false {
         didSet {
             self.mark(volatile: self.isVolatile)
@@ -61,33 +64,44 @@ internal final class BackingStore: Drawable, RenderConvertible, Hashable {
     /// The region to be updated by the receiver during an `update(...)`.
     internal private(set) var updateShape: Shape = .empty
     
-    ///
+    /// The buffer most recently drawn into; this is the buffer rendered.
     private var frontBuffer: IOSurface? = nil
     
-    ///
+    /// The buffer drawn into during the next `update(...)`.
     private var backBuffer: IOSurface? = nil
     
+    /// The region of the front buffer that was redrawn during the last update,
+    /// and is therefore stale in the back buffer.
+    private var frontDamage: CGRect = .null
+    
     /// Create a new `BackingStore`.
     internal init() {
-        BackingStore.allStores.append(Weak(self))
+        BackingStore.lock.whileLocked {
+            BackingStore.allStores.append(Weak(self))
+        }
         self.invalidate()
     }
     
     deinit {
-        BackingStore.allStores.removeAll { $0.value == self }
+        BackingStore.lock.whileLocked {
+            BackingStore.allStores.removeAll { $0.value == nil || $0.value === self }
+        }
+        Pool.shared.recycle(self.frontBuffer)
+        Pool.shared.recycle(self.backBuffer)
     }
     
     /// Begins collection of the receiver at the given `time`. See `collectBlocking()`.
     internal static func collect(_ time: TimeInterval) {
+        for x in BackingStore.lock.whileLocked({ BackingStore.allStores }) {
+            x.value?.mark(volatile: true)
+        }
         BackingStore.lock.whileLocked {
-            for x in BackingStore.allStores {
-                x.value?.mark(volatile: true)
-            }
             if !BackingStore.pendingCollect {
                 Callback(at: time) {
-                    BackingStore.pendingCollect = false
-                    
-                    // wait until all resources are collected...
+                    BackingStore.lock.whileLocked {
+                        BackingStore.pendingCollect = false
+                    }
+                    Pool.shared.drain()
                 }
                 BackingStore.pendingCollect = true
             }
@@ -96,46 +110,89 @@ internal final class BackingStore: Drawable, RenderConvertible, Hashable {
     
     /// Begins collection of the receiver immediately.
     internal static func collectBlocking() {
-        // TODO: ... ehh....
-        BackingStore.lock.whileLocked {
-            for x in BackingStore.allStores {
-                x.value?.mark(volatile: true)
-            }
+        for x in BackingStore.lock.whileLocked({ BackingStore.allStores }) {
+            x.value?.mark(volatile: true)
         }
+        Pool.shared.drain()
     }
     
-    /// Updates the currently selected buffer of the reciever, invoking `handler`.
-    internal func update(size: CGSize, _ flags: Flags, _ handler: (CGContext) -> ()) {
+    /// Updates the back buffer of the receiver, invoking `handler` with a context
+    /// clipped to the invalid region, and then swaps it to the front.
+    ///
+    /// If nothing was invalidated since the last update, `handler` is not invoked.
+    internal func update(size: CGSize, format: Layer.ContentsFormat = .RGBA8Uint,
+                         _ flags: Flags, _ handler: (CGContext) -> ()) {
         assert(size.width > 0 && size.height > 0, "BackingStore size must be non-zero!")
+        let width = Int(size.width.rounded(.up)), height = Int(size.height.rounded(.up))
+        let pixelFormat = PixelFormat(format)
+        let bounds = CGRect(x: 0, y: 0, width: width, height: height)
         
-        // TODO: Use layer's contentsFormat and Flags!!
-        if self.frontBuffer == nil ||
-            (self.frontBuffer!.width != Int(size.width) ||
-                self.frontBuffer!.height != Int(size.height)) {
+        // The buffers are selected and swapped under the lock, and the back buffer
+        // is detached from the receiver while it is drawn into, so that a
+        // concurrent `collect(_:)` can't mark it volatile mid-draw.
+        let selected = BackingStore.lock.whileLocked { () -> (IOSurface, CGRect)? in
             
-            self.frontBuffer = IOSurface(properties: [
-                .width: Int(size.width),
-                .height: Int(size.height),
-                .pixelFormat: 0x42475241,//"ARGB",
-                .bytesPerElement: 4,
-            ])!
+            // If the front buffer no longer matches, or was purged while volatile,
+            // its contents can't be reused and everything must be redrawn.
+            var frontValid = false
+            if let front = self.frontBuffer, self.matches(front, width, height, pixelFormat) {
+                var old: IOSurfacePurgeabilityState = .nonVolatile
+                front.setPurgeable(.nonVolatile, oldState: &old)
+                frontValid = old != .empty
+            }
+            let invalid = self.updateShape.components.reduce(CGRect.null) { $0.union($1) }
+            let damage = frontValid ? invalid.intersection(bounds).integral : bounds
+            self.updateShape = .empty
+            guard !damage.isEmpty else { return nil }
+            
+            // The back buffer can't be drawn into while the renderer is sampling it.
+            var freshBack = true
+            if let back = self.backBuffer, self.matches(back, width, height, pixelFormat),
+                !back.isInUse
+            {
+                var old: IOSurfacePurgeabilityState = .nonVolatile
+                back.setPurgeable(.nonVolatile, oldState: &old)
+                freshBack = old == .empty
+            } else {
+                Pool.shared.recycle(self.backBuffer)
+                self.backBuffer = Pool.shared.dequeue(width, height, pixelFormat)
+            }
+            let back = self.backBuffer!
+            self.backBuffer = nil
+            
+            // Copy forward whatever the back buffer is missing outside of `damage`.
+            if frontValid && damage != bounds, let front = self.frontBuffer {
+                let stale = freshBack ? bounds : self.frontDamage
+                BackingStore.copy(stale, from: front, to: back, pixelFormat)
+            }
+            return (back, damage)
         }
+        guard let (back, damage) = selected else { return }
         
-        //var pixels = [UInt8](repeating: 0, count: Int(height * width * 4))
-        //let crtx = CGContext(data: &pixels, width: Int(size.width), height: Int(size.height), bitsPerComponent: 8, bytesPerRow: Int(size.width) * 4, space: self.colorSpace, bitmapInfo: bmp, releaseCallback: nil, releaseInfo: nil)
-        
-        //self.surface.lock(options: [], seed: nil)
-        let bmp = CGImageAlphaInfo.premultipliedFirst.rawValue |
-                  CGBitmapInfo.byteOrder32Little.rawValue
-		let ctx = CGIOSurfaceContextCreate(unsafeBitCast(self.frontBuffer!, to: IOSurfaceRef.self),
-										   Int(size.width), Int(size.height), 8, 32,
-                                           self.colorSpace, bmp)!
+        let ctx = CGIOSurfaceContextCreate(unsafeBitCast(back, to: IOSurfaceRef.self),
+                                           width, height,
+                                           pixelFormat.bitsPerComponent,
+                                           pixelFormat.bytesPerElement * 8,
+                                           pixelFormat.colorSpace(self.colorSpace),
+                                           pixelFormat.bitmapInfo(opaque: flags.contains(.opaque)))!
+        ctx.clip(to: damage)
+        if !flags.contains(.opaque) || flags.contains(.cleared) {
+            ctx.clear(damage)
+        }
+        ctx.saveGState()
         handler(ctx)
-        //ctx.flush() // might defeat purpose of CGIOSurfaceContext...
-        //self.surface.unlock(options: [], seed: nil)
+        ctx.restoreGState()
+        ctx.flush()
         
-        // TODO: manage the back buffer!
-        self.swap()
+        BackingStore.lock.whileLocked {
+            self.backBuffer = self.frontBuffer
+            self.frontBuffer = back
+            self.frontDamage = damage
+            if self.isVolatile {
+                self.frontBuffer?.setPurgeable(.volatile, oldState: nil)
+                self.backBuffer?.setPurgeable(.volatile, oldState: nil)
+            }
+        }
     }
     
     /// Swaps the front and back buffers of the receiver.
@@ -153,21 +210,193 @@ internal final class BackingStore: Drawable, RenderConvertible, Hashable {
         self.updateShape.components.append(rect)
     }
     
-    /// Purges both buffers used by the receiver. The contents will be completely
-    /// redrawn upon reuse.
+    /// Releases the back buffer used by the receiver to the pool. The contents
+    /// will be completely redrawn upon reuse.
     internal func purge() {
-        self.frontBuffer = nil
-        self.swap()
+        BackingStore.lock.whileLocked {
+            Pool.shared.recycle(self.backBuffer)
+            self.backBuffer = nil
+            self.frontDamage = .null
+        }
+        self.invalidate()
     }
     
+    /// Marks the buffers of the receiver as `volatile`, allowing the system to
+    /// reclaim them under memory pressure, or `nonVolatile` to protect them.
+    ///
+    /// Note: the front buffer will be redrawn entirely if it is reclaimed.
     internal func mark(volatile: Bool) {
-        // TODO: mark both front + back buffers as volatile
+        let state: IOSurfacePurgeabilityState = volatile ? .volatile : .nonVolatile
+        BackingStore.lock.whileLocked {
+            self.frontBuffer?.setPurgeable(state, oldState: nil)
+            self.backBuffer?.setPurgeable(state, oldState: nil)
+        }
+    }
+    
+    /// Whether `surface` can be drawn into with the given dimensions and format.
+    private func matches(_ surface: IOSurface, _ width: Int, _ height: Int,
+                         _ format: PixelFormat) -> Bool {
+        return surface.width == width && surface.height == height &&
+               surface.pixelFormat == format.ioSurfaceFormat
+    }
+    
+    /// Copies the pixels within `rect` (in bottom-left origin coordinates) from
+    /// `source` to `destination`, which must share the same dimensions and format.
+    private static func copy(_ rect: CGRect, from source: IOSurface,
+                             to destination: IOSurface, _ format: PixelFormat) {
+        let height = source.height
+        let r = rect.integral.intersection(CGRect(x: 0, y: 0, width: source.width,
+                                                  height: height))
+        guard !r.isEmpty else { return }
+        
+        source.lock(options: .readOnly, seed: nil)
+        destination.lock(options: [], seed: nil)
+        defer {
+            destination.unlock(options: [], seed: nil)
+            source.unlock(options: .readOnly, seed: nil)
+        }
+        
+        // Surface memory is laid out top-down, so flip the row range.
+        let firstRow = height - Int(r.maxY), lastRow = height - Int(r.minY)
+        let offset = Int(r.minX) * format.bytesPerElement
+        let length = Int(r.width) * format.bytesPerElement
+        let src = source.baseAddress, dst = destination.baseAddress
+        let srcStride = source.bytesPerRow, dstStride = destination.bytesPerRow
+        for row in firstRow..<lastRow {
+            memcpy(dst + (row * dstStride + offset),
+                   src + (row * srcStride + offset), length)
+        }
+    }
+}
+
+internal extension BackingStore {
+    
+    /// A process-wide cache of idle `IOSurface`s available to any `BackingStore`.
+    ///
+    /// Surfaces are keyed by their exact dimensions and format, since both the
+    /// `CGContext` and `MTLTexture` wrapping a surface must match its size. Idle
+    /// surfaces are marked `volatile` so the system may reclaim them at will,
+    /// and the pool is drained entirely under critical memory pressure.
+    final class Pool {
+        
+        ///
+        private struct Key: Hashable {
+            let width: Int
+            let height: Int
+            let format: PixelFormat
+        }
+        
+        ///
+        internal static let shared = Pool()
+        
+        /// The maximum number of bytes of idle surfaces retained by the pool.
+        internal var byteLimit: Int = 64 * 1024 * 1024 {
+            didSet {
+                self.lock.whileLocked { self.evict(to: self.byteLimit) }
+            }
+        }
+        
+        /// The number of bytes currently retained by idle surfaces in the pool.
+        internal private(set) var bytes: Int = 0
+        
+        ///
+        private var surfaces: [Key: [IOSurface]] = [:]
+        
+        /// Idle surfaces in least-recently-recycled order, for eviction.
+        private var order: [IOSurface] = []
+        
+        ///
+        private let lock = Lock()
+        
+        ///
+        private var pressureSource: DispatchSourceMemoryPressure? = nil
+        
+        ///
+        private init() {
+            let source = DispatchSource.makeMemoryPressureSource(eventMask: [.warning, .critical],
+                                                                 queue: .global(qos: .utility))
+            source.setEventHandler { [unowned self] in
+                if source.data.contains(.critical) {
+                    BackingStore.collectBlocking()
+                } else {
+                    self.lock.whileLocked { self.evict(to: self.byteLimit / 2) }
+                }
+            }
+            source.resume()
+            self.pressureSource = source
+        }
+        
+        /// Vends a surface of the given dimensions and format, reusing an idle
+        /// surface if one was not reclaimed by the system.
+        internal func dequeue(_ width: Int, _ height: Int, _ format: PixelFormat) -> IOSurface {
+            let key = Key(width: width, height: height, format: format)
+            let reused = self.lock.whileLocked { () -> IOSurface? in
+                while let surface = self.surfaces[key]?.popLast() {
+                    self.remove(surface)
+                    var old: IOSurfacePurgeabilityState = .nonVolatile
+                    surface.setPurgeable(.nonVolatile, oldState: &old)
+                    if old != .empty && !surface.isInUse {
+                        return surface
+                    }
+                }
+                return nil
+            }
+            if let surface = reused {
+                return surface
+            }
+            return IOSurface(properties: [
+                .width: width,
+                .height: height,
+                .pixelFormat: format.ioSurfaceFormat,
+                .bytesPerElement: format.bytesPerElement,
+            ])!
+        }
+        
+        /// Returns an idle surface to the pool, marking it `volatile`.
+        internal func recycle(_ surface: IOSurface?) {
+            guard let surface = surface else { return }
+            let format = PixelFormat(ioSurface: surface.pixelFormat)
+            guard format != .none else { return }
+            let key = Key(width: surface.width, height: surface.height, format: format)
+            surface.setPurgeable(.volatile, oldState: nil)
+            self.lock.whileLocked {
+                self.surfaces[key, default: []].append(surface)
+                self.order.append(surface)
+                self.bytes += surface.allocationSize
+                self.evict(to: self.byteLimit)
+            }
+        }
+        
+        /// Releases all idle surfaces retained by the pool.
+        internal func drain() {
+            self.lock.whileLocked {
+                self.evict(to: 0)
+            }
+        }
+        
+        /// Note: the pool's lock must be held.
+        private func evict(to limit: Int) {
+            while self.bytes > limit, !self.order.isEmpty {
+                let surface = self.order.removeFirst()
+                let key = Key(width: surface.width, height: surface.height,
+                              format: PixelFormat(ioSurface: surface.pixelFormat))
+                self.surfaces[key]?.removeAll { $0 === surface }
+                self.bytes -= surface.allocationSize
+            }
+        }
+        
+        /// Note: the pool's lock must be held.
+        private func remove(_ surface: IOSurface) {
+            self.order.removeAll { $0 === surface }
+            self.bytes -= surface.allocationSize
+        }
     }
 }
 
 internal extension BackingStore {
     var renderValue: Any {
-        return (self.frontBuffer ?? self.backBuffer)!.renderValue
+        let buffer = BackingStore.lock.whileLocked { self.frontBuffer ?? self.backBuffer }
+        return buffer!.renderValue
     }
     /*
     func texture(_ device: MTLDevice) -> MTLTexture {
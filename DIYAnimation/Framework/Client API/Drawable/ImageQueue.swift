@@ -121,24 +121,50 @@ internal final class ImageQueue: Drawable {
         public let hostRate: Float
     }
     
-    /// Change the size of images added to the queue.
+    /// The statistics of images sampled by the renderer.
+    public struct Statistics {
+        
+        /// The number of images removed without ever being displayed, as a
+        /// later image was due first.
+        public let dropped: UInt64
+        
+        /// The number of images first displayed after the refresh they were
+        /// due at, as they were inserted too late for it.
+        public let late: UInt64
+    }
+    
+    /// The kind of each `Image` identifier, as stored in the queue's slots.
+    internal enum Kind: UInt64 {
+        case surface, buffer, ioSurface
+    }
+    
+    /// Change the size of images added to the queue. Images that were waiting
+    /// to be reused at the previous size are deleted.
 	public var size: Size = (width: 0, height: 0) {
 		didSet {
-			// TODO
+			guard oldValue != self.size else { return }
+			for image in self.reusable {
+				self.delete(buffer: image)
+			}
+			self.reusable = []
 		}
 	}
     
     ///
     public private(set) var capacity: UInt = 0
     
-    ///
+    /// Holds the `SlotRing` shared with the render server.
     private let sharedMemory: SharedMemory
     
+    /// The images in the queue, written by the receiver and sampled by the
+    /// render server without locking.
+    private let ring: SlotRing
+    
     /// Set or get the flags associated with the receiver.
     public var flags: Flags = Flags(0) {
         didSet {
-			// TODO: incomplete implementation here
 			if (oldValue != self.flags) {
+				self.ring.options = UInt64(self.flags.rawValue)
 				self.ping()
 			}
         }
@@ -152,21 +178,23 @@ internal final class ImageQueue: Drawable {
     /// this property is Infinity. Flushing the queue resets it to the
     /// default value. (Note that if layer time is currently playing backwards
     /// the meaning of any comparisons against this value are inverted.)
-    public var latestCanonicalTime: TimeInterval = 0
+    public var latestCanonicalTime: TimeInterval = .infinity
     
     /// Returns the sample time of the latest image in the queue.
     public var latestTime: TimeInterval {
-        return 0
+        let head = self.ring.head
+        return head > self.ring.flushed ? self.ring.slot(head - 1).time : 0
     }
     
-    ///
+    /// Returns the media time of the frame at which the renderer last sampled
+    /// the queue.
     public var lastUpdateHostTime: TimeInterval {
-        return 0
+        return max(self.ring.sampleFrameTime, 0)
     }
     
     /// Returns the sample time of the latest displayed image in the queue.
     public var displayTime: TimeInterval {
-        return 0
+        return self.ring.displayed > 0 ? self.ring.displayTime : 0
     }
     
     /// Returns the display mask associated with the receiver.
@@ -179,38 +207,48 @@ internal final class ImageQueue: Drawable {
     /// nonzero, the minimum and maximum time of those images is placed in
     /// 'minTime' and 'maxTime' respectively.
     public var unconsumedImageCount: (count: Int, min: TimeInterval?, max: TimeInterval?) {
-        return (count: 0, min: nil, max: nil)
+        let head = self.ring.head
+        let first = max(self.ring.tail, self.ring.displayed, self.ring.flushed)
+        guard head > first else { return (count: 0, min: nil, max: nil) }
+        let times = (first..<head).map { self.ring.slot($0).time }
+        return (count: times.count, min: times.min(), max: times.max())
     }
-	
-	///
-	private var renderQueue: Render.ImageQueue // TODO: access needs locking
     
-    ///
-    private var buffers: [Image: RenderTexture] = [:] { // TODO: needs locking
-        didSet {
-			
-			// TODO: new_commit() -> commit_buffer() -> delete_commit()
-			
-            // retain contexts
-            // encode update message:
-            //      - buffer deletions
-            //      - buffer additions
-            //          - shmem additions
-            // send message
-            // CASPing
-        }
+    /// The number of dropped and late images since the queue was created.
+    public var statistics: Statistics {
+        return Statistics(dropped: self.ring.dropped, late: self.ring.late)
     }
 	
-	private var imageQueue: [Any] = []
+	/// The render server's view of the queue; it only accesses the ring.
+	private let renderQueue: Render.ImageQueue
+    
+    /// The surfaces of the registered images, by image.
+    ///
+    /// The producer methods of the receiver (registering, inserting, and
+    /// collecting images) must not be called concurrently; the render server
+    /// never touches these.
+    private var buffers: [Image: Render.Surface] = [:]
+    
+    /// The handlers to call as each inserted image is removed, by sequence number.
+    private var removeHandlers: [UInt64: (Image, Image.Info?) -> ()] = [:]
+    
+    /// The sequence number of the oldest image not yet collected.
+    private var collected: UInt64 = 0
+    
+    /// Registered images that were removed from the queue, and may be drawn
+    /// into and inserted again.
+    private var reusable: [Image] = []
     
     /// Create a new image queue. All images in the queue will have the specified
     /// `width` and `height`. The queue will be able to hold `capacity` images
     /// at once.
     public init(_ size: Size, _ capacity: UInt = 16) {
         self.size = size
-        self.capacity = capacity
-		self.sharedMemory = try! SharedMemory(UInt64((capacity * 0x8) + 0xb0)) // TODO: why this size?
-		self.renderQueue = Render.ImageQueue(self.sharedMemory) 
+        self.capacity = max(capacity, 2)
+		self.sharedMemory = try! SharedMemory(UInt64(SlotRing.size(capacity: Int(self.capacity))))
+		self.ring = SlotRing(initializing: self.sharedMemory.pointer.baseAddress!,
+							 capacity: Int(self.capacity))
+		self.renderQueue = Render.ImageQueue(self.sharedMemory)
     }
     
     deinit {
@@ -240,19 +278,15 @@ internal final class ImageQueue: Drawable {
                          _ flags: Image.Flags = Image.Flags(0)) -> Image
     {
         // create PixelBuffer with new Shmem and call register with it
-		
-		// self.buffers[image] = texture // TODO: LOCKING
 		return .buffer(0)
     }
     
-    /// Register an `IOSurface` buffer with the receiver.
+    /// Register an `IOSurface` buffer with the receiver. The surface is marked
+    /// in use until it is deleted.
 	public func register(ioSurface: IOSurface) -> Image {
-        // create Surface and call register with it
-        // remember to inc/dec surface use count!
-		//ioSurface.incrementUseCount()
-		
-		// self.buffers[image] = texture // TODO: LOCKING
-		return .ioSurface(IOSurfaceGetID(unsafeBitCast(ioSurface, to: IOSurfaceRef.self)))
+		let image = Image.ioSurface(IOSurfaceGetID(unsafeBitCast(ioSurface, to: IOSurfaceRef.self)))
+		self.buffers[image] = Render.Surface(ioSurface)
+		return image
     }
     
     /// Register a `CVImageBuffer` with the receiver.
@@ -260,7 +294,6 @@ internal final class ImageQueue: Drawable {
 		if let surfaceID = CVPixelBufferGetIOSurface(imageBuffer)?.takeUnretainedValue() {
 			return register(ioSurface: unsafeBitCast(surfaceID, to: IOSurface.self))
 		} else {
-			// self.buffers[image] = texture // TODO: LOCKING
 			var _ref = imageBuffer
 			return self.register(pixelBuffer: UnsafeRawPointer(&_ref),
 								 0, /* TODO: calculate this! */
@@ -273,56 +306,126 @@ internal final class ImageQueue: Drawable {
     /// Remove a previously registered image buffer.
     public func delete(buffer: Image) {
 		self.buffers[buffer] = nil
-        // remember to inc/dec surface use count!
+		self.reusable.removeAll { $0 == buffer }
+		if case .ioSurface(let id) = buffer {
+			self.renderQueue.evict(id)
+		}
+    }
+    
+    /// Returns a registered `IOSurface` image of the queue's `size` that has
+    /// been removed from the queue, to be drawn into and inserted again instead
+    /// of registering a new surface. Call `collect()` first to find such images.
+    public func dequeueReusableImage() -> (Image, IOSurface)? {
+        while let image = self.reusable.popLast() {
+            if let surface = self.buffers[image]?.surface,
+                surface.width == Int(self.size.width) && surface.height == Int(self.size.height)
+            {
+                return (image, surface)
+            }
+        }
+        return nil
     }
     
     /// Push one image into the queue for time `time`. The image is of kind
     /// `type` and has identifier `id` (meaning defined by `type`). This
     /// function returns true if successful, or false if the queue was
-    /// already full. If non-`nil`, `removeHandler` defines a function to be called
-    /// when the image is removed from the queue.
+    /// already full, once any images retired by the renderer are collected. If
+    /// non-`nil`, `removeHandler` defines a function to be called when the image
+    /// is removed from the queue.
+    @discardableResult
     public func insert(at time: TimeInterval, image: Image, flags: Image.Flags,
-					   _ removeHandler: ((Image, Image.Info?) -> ())? = nil)
+					   _ removeHandler: ((Image, Image.Info?) -> ())? = nil) -> Bool
     {
-		// guard that shmem exists
-		// add to queue (?) 
-        // increment useCount for IOSurface if needed?
+		if flags.contains(.flush) {
+			self.flush()
+		}
 		
-		self.imageQueue.append(image)
+		let (kind, id): (Kind, UInt64)
+		switch image {
+		case .surface(let x): (kind, id) = (.surface, x)
+		case .buffer(let x): (kind, id) = (.buffer, x)
+		case .ioSurface(let x): (kind, id) = (.ioSurface, UInt64(x))
+		}
+		let seq = self.ring.head
+		let slot = SlotRing.Slot(time: time, kind: kind.rawValue, id: id, flags: UInt64(flags.rawValue))
 		
+		// Slots retired by the render server, or flushed, are only reused once
+		// collected:
+		if !self.ring.push(slot, reclaimed: self.collected) {
+			self.collect(through: self.ring.reclaimable)
+			guard self.ring.push(slot, reclaimed: self.collected) else { return false }
+		}
+		self.removeHandlers[seq] = removeHandler
 		self.ping()
+		return true
     }
     
     /// Free all images in the queue. Any subsequent image queue operation
     /// will have undefined results.
     public func invalidate() {
-        
-        // TODO: maybe don't do this??
         self.flush()
+        
+        // The render server may no longer sample the queue, so every image is
+        // removed now rather than once it has been retired:
+        self.collect(through: self.ring.head)
+        self.buffers.removeAll()
+        self.reusable.removeAll()
+        self.renderQueue.flushCache()
     }
     
     /// Invalidate all images in the queue.
     public func flush() {
-        _ = self.collect() // do this for all things in the queue
+        self.ring.flush()
+        self.latestCanonicalTime = .infinity
     }
     
-    /// Removes all consumed images except the latest from the queue. Returns
-    /// the number of free slots.
+    /// Removes all consumed images except the latest from the queue, calling
+    /// their remove handlers and making them reusable. Returns the number of
+    /// free slots.
+    @discardableResult
     public func collect() -> Int {
-        return 1
+        let tail = self.ring.tail
+        self.collect(through: tail)
+        return Int(self.capacity) - Int(self.ring.head - tail)
+    }
+    
+    /// Removes the images with sequence numbers before `end`.
+    ///
+    /// A flushed image may be removed before the render server retires it, in
+    /// which case it is not reusable if it may still be on screen.
+    private func collect(through end: UInt64) {
+        let flushed = self.ring.flushed
+        let (tail, displayed) = (self.ring.tail, self.ring.displayed)
+        while self.collected < end {
+            let seq = self.collected
+            let slot = self.ring.slot(seq)
+            let display = self.ring.display(seq)
+            let image: Image
+            switch Kind(rawValue: slot.kind)! {
+            case .surface: image = .surface(slot.id)
+            case .buffer: image = .buffer(slot.id)
+            case .ioSurface: image = .ioSurface(IOSurfaceID(slot.id))
+            }
+            
+            if let handler = self.removeHandlers.removeValue(forKey: seq) {
+                let hostTime = display.count > 0 ? HostTimeWithTime(display.frameTime) : 0
+                handler(image, Image.Info(displayCount: UInt32(clamping: display.count),
+                                          localTime: display.time,
+                                          wasFlushed: seq < flushed && display.count == 0,
+                                          hostTime: hostTime))
+            }
+            let onScreen = seq >= tail && seq + 1 == displayed
+            if self.buffers[image] != nil && !onScreen && !self.reusable.contains(image) {
+                self.reusable.append(image)
+            }
+            self.collected += 1
+        }
     }
-	
-	
-	
-	
 	
 	//
 	//
 	//
 	
-	
-	
-	
 	///
 	internal func update() {
 		//
@@ -331,25 +434,43 @@ internal final class ImageQueue: Drawable {
     /// Query the next times at which the queue will be sampled. Up to
     /// 'count' times will be placed in 'buffer'. The actual number of time
     /// values stored in the buffer will be returned.
-    public func samplingTimes() -> [TimeInterval] {
-        return []
+    ///
+    /// The times are predicted from the two most recent samples by the
+    /// renderer, so none are returned until the queue has been sampled twice.
+    public func samplingTimes(_ count: Int = 4) -> [TimeInterval] {
+        let last = self.ring.sampleTime, period = self.ring.period
+        guard last.isFinite && period > 0 else { return [] }
+        return (1...max(count, 1)).map { last + Double($0) * period }
     }
     
-    ///
+    /// The display refreshes at which the queue will next be sampled; see
+    /// `samplingTimes(_:)`. Their host times are predicted from the frame times
+    /// recorded by the renderer alongside its two most recent samples.
     public func vblInfo() -> [VBLInfo] {
-        return []
+        let frame = self.ring.sampleFrameTime, period = self.ring.framePeriod
+        guard frame.isFinite && period > 0 else { return [] }
+        let rate = Float(self.ring.period / period)
+        return self.samplingTimes().enumerated().map {
+            VBLInfo(hostTime: HostTimeWithTime(frame + Double($0.offset + 1) * period),
+                    localTime: $0.element, hostRate: rate)
+        }
     }
     
     ///
     public func timestamp(for vbl: VBLInfo) -> CVTimeStamp {
-        return CVTimeStamp()
+        var ts = CVTimeStamp()
+        ts.hostTime = vbl.hostTime
+        ts.rateScalar = Double(vbl.hostRate)
+        ts.videoRefreshPeriod = Int64(HostTimeWithTime(max(self.ring.framePeriod, 0)))
+        ts.flags = CVTimeStampFlags([.hostTimeValid, .rateScalarValid]).rawValue
+        return ts
     }
     
-    ///
+    /// Asks the renderer to sample the receiver, if it is asynchronous; others
+    /// are only sampled when their layers are committed.
     private func ping() {
-        // retain context
-        // local: will commit + did commit
-        // -> OR remote: CASUpdateClient
+        guard self.flags.contains(.async) else { return }
+        Render.ImageQueue.setNeedsFrame()
     }
     
     ///
@@ -365,9 +486,6 @@ internal final class ImageQueue: Drawable {
 
 extension ImageQueue: RenderConvertible {
     var renderValue: Any {
-		if case let Image.ioSurface(id) = self.imageQueue.last! {
-			return Render.Surface(unsafeBitCast(IOSurfaceLookup(id)!, to: IOSurface.self))
-		}
-		return 0
+		return self.renderQueue
     }
 }
@@ -1,10 +1,15 @@
 import Foundation
 
 /// The gradient layer draws a color gradient over its background color, filling the shape of the layer (i.e. including rounded corners).
+///
+/// The gradient is evaluated per pixel by the renderer from a small color ramp,
+/// cached by stop list (see `Render.GradientLayer`), so the layer is never drawn
+/// into a bitmap, and animating its points only changes the parameters it is
+/// drawn with.
 public class GradientLayer: Layer {
 	
 	///
-	public enum GradientType {
+	public enum GradientType: Int, Codable {
 		
 		///
 		case axial
@@ -22,10 +27,22 @@ public class GradientLayer: Layer {
 		/// positive x-axis towards positive y-axis.
 		case conic
 	}
-
+    
+    public override class func defaultValue(forKey keyPath: String) -> Any? {
+        switch keyPath {
+        case "startPoint": return CGPoint(x: 0.5, y: 0.0)
+        case "endPoint": return CGPoint(x: 0.5, y: 1.0)
+        case "type": return GradientType.axial
+        default: return super.defaultValue(forKey: keyPath)
+        }
+    }
+    
     /// The array of CGColorRef objects defining the color of each gradient
     /// stop. Defaults to nil. Animatable.
-    public var colors: [Any]? = nil
+    public var colors: [CGColor]? {
+        get { return self.values[#function] }
+        set { self.values[#function] = newValue }
+    }
     
     /// An optional array of NSNumber objects defining the location of each
     /// gradient stop as a value in the range [0,1]. The values must be
@@ -33,7 +50,10 @@ public class GradientLayer: Layer {
     /// assumed to spread uniformly across the [0,1] range. When rendered,
     /// the colors are mapped to the output colorspace before being
     /// interpolated. Defaults to nil. Animatable.
-    public var locations: [Double]? = nil
+    public var locations: [Double]? {
+        get { return self.values[#function] }
+        set { self.values[#function] = newValue }
+    }
     
     /// The start and end points of the gradient when drawn into the layer's
     /// coordinate space. The start point corresponds to the first gradient
@@ -42,8 +62,11 @@ public class GradientLayer: Layer {
     /// layer's bounds rectangle when drawn. (I.e. [0,0] is the bottom-left
     /// corner of the layer, [1,1] is the top-right corner.) The default values
     /// are [.5,0] and [.5,1] respectively. Both are animatable.
-    public var startPoint: CGPoint = CGPoint(x: 0, y: 0)
-	
+    public var startPoint: CGPoint {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
     /// The start and end points of the gradient when drawn into the layer's
     /// coordinate space. The start point corresponds to the first gradient
     /// stop, the end point to the last gradient stop. Both points are
@@ -51,14 +74,32 @@ public class GradientLayer: Layer {
     /// layer's bounds rectangle when drawn. (I.e. [0,0] is the bottom-left
     /// corner of the layer, [1,1] is the top-right corner.) The default values
     /// are [.5,0] and [.5,1] respectively. Both are animatable.
-	public var endPoint: CGPoint = CGPoint(x: 0, y: 0)
-    
-    /// The kind of gradient that will be drawn.
-	public var type: GradientType = .axial
+	public var endPoint: CGPoint {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
     
-	// TODO: properties to add: colorMap, interpolations
-    // TODO: didChangeValueForKey -> self.props contains key? -> layer_set_commit_needed
+    /// The kind of gradient that will be drawn. Defaults to `.axial`.
+	public var type: GradientType {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
 	
+	/// The gradient is drawn by the renderer from a cached color ramp (see
+	/// `Render.GradientLayer`), so no backing store is needed.
+	internal override func prepareContents() {
+		// no-op
+	}
+	
+	/// Draws the gradient on the CPU, for render targets without a GPU.
+	public override func draw(in context: CGContext) {
+		super.draw(in: context)
+		Render.GradientLayer.render(self, in: context)
+	}
+	
+	// TODO: properties to add: interpolations
+    // TODO: didChangeValueForKey -> self.props contains key? -> layer_set_commit_needed
+    
     
 	
 	
@@ -1057,13 +1057,16 @@ public class Layer: Hashable, MediaTiming {
             // etc, fill in the blank values
             
             // TODO: At commit time:
-            anim.beginTime = CurrentMediaTime()
-            anim.duration = Transaction.animationDuration
+            if anim.beginTime == 0 {
+                anim.beginTime = CurrentMediaTime()
+            }
+            if anim.duration == 0 {
+                anim.duration = Transaction.animationDuration
+            }
             anim.timingFunction = Transaction.animationTimingFunction ?? .default
             
             self.animations[key ?? anim.fallbackIdentifier] = anim
-            
-            // mark self?
+            self.mark()
         }
     }
     
@@ -1072,6 +1075,7 @@ public class Layer: Hashable, MediaTiming {
         Transaction.ensure()
         Transaction.whileLocked {
             self.animations[key] = nil
+            self.mark()
         }
     }
     
@@ -1080,6 +1084,7 @@ public class Layer: Hashable, MediaTiming {
         Transaction.ensure()
         Transaction.whileLocked {
             self.animations.removeAll()
+            self.mark()
         }
     }
     
@@ -1105,6 +1110,13 @@ public class Layer: Hashable, MediaTiming {
         return clone
     }
     
+    /// The receiver presented at `time`, or the receiver itself if it has no
+    /// animations to apply, avoiding a copy.
+    internal func presentedLayer(at time: TimeInterval) -> Self {
+        guard self.animations.count > 0 else { return self }
+        return self.layer(at: time)
+    }
+    
     ///
     internal func layerBeingDrawn() -> Self {
         guard self.animations.count > 0 else { return self }
@@ -1144,9 +1156,8 @@ public class Layer: Hashable, MediaTiming {
         // ensure layer transaction
         Transaction.whileLocked {
             if let store = self.contents as? BackingStore {
-                // TODO: flip the rectangle if self.contentsAreFlipped!
                 store.invalidate(rect != .infinite ?
-                    rect.constrain(self.bounds.size) :
+                    rect.applying(self.contentsTransform) :
                     rect)
             }
         }
@@ -1194,9 +1205,9 @@ public class Layer: Hashable, MediaTiming {
             return self.contents as? BackingStore ?? BackingStore()
         }
         var opts: BackingStore.Flags = []
-        opts.formIntersection(self.isOpaque ? .opaque : [])
-        opts.formIntersection(self.minificationFilter == .trilinear ? .mipmap : [])
-        store.update(size: self.bounds.size, opts) { ctx in
+        opts.formUnion(self.isOpaque ? .opaque : [])
+        opts.formUnion(self.minificationFilter == .trilinear ? .mipmap : [])
+        store.update(size: self.bounds.size, format: self.contentsFormat, opts) { ctx in
             self.prepare(context: ctx)
             self.layerBeingDrawn().draw(in: ctx)
         }
@@ -1205,11 +1216,18 @@ public class Layer: Hashable, MediaTiming {
     
     /// Applies the transformation matrix on the context for drawing the receiver.
     internal func prepare(context ctx: CGContext) {
+        ctx.concatenate(self.contentsTransform)
+    }
+    
+    /// The transformation from the receiver's coordinate space to that of its
+    /// backing store, accounting for `contentsAreFlipped`.
+    internal var contentsTransform: CGAffineTransform {
+        var t = CGAffineTransform.identity
         if self.contentsAreFlipped {
-            ctx.translateBy(x: 0, y: CGFloat(self.bounds.height))
-            ctx.scaleBy(x: 1, y: -1)
+            t = t.translatedBy(x: 0, y: CGFloat(self.bounds.height))
+            t = t.scaledBy(x: 1, y: -1)
         }
-        ctx.translateBy(x: self.bounds.minX, y: self.bounds.minY)
+        return t.translatedBy(x: self.bounds.minX, y: self.bounds.minY)
     }
     
     /// Draws the layer’s content using the specified graphics context.
@@ -1382,8 +1400,28 @@ public class Layer: Hashable, MediaTiming {
         
     }
     
-    ///
-    internal var nextAnimationTime: TimeInterval = .infinity
+    /// The earliest time, no earlier than `time`, at which an animation of the
+    /// receiver or any of its sublayers changes their presentation (or
+    /// `.infinity` if none will), and the longest interval between frames
+    /// permitted by the animations running at `time` (or `.infinity` if none
+    /// are; zero if any require every display refresh).
+    internal func nextAnimationTime(after time: TimeInterval) -> (time: TimeInterval,
+                                                                 interval: TimeInterval)
+    {
+        var next = (time: TimeInterval.infinity, interval: TimeInterval.infinity)
+        for anim in self.animations.values where anim.isEnabled {
+            let t = Render.Timing(anim).next(after: time)
+            next.time = min(next.time, t)
+            if t <= time {
+                next.interval = min(next.interval, anim.frameInterval)
+            }
+        }
+        for l in self.sublayers + (self.mask.map { [$0] } ?? []) {
+            let n = l.nextAnimationTime(after: time)
+            next = (min(next.time, n.time), min(next.interval, n.interval))
+        }
+        return next
+    }
     
     //
     // MARK: - Layer KVO Changes
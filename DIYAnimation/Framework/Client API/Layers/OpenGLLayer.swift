@@ -168,21 +168,20 @@ public class OpenGLLayer: Layer {
 					CGLSetVirtualScreen(ctx, screen)
 					CGLUpdateContext(ctx)
 					
-					//
-					let surface = IOSurface(properties: [
-						.width: queue.size.width,
-						.height: queue.size.height,
-						.bytesPerElement: 4,
-						.bytesPerRow: queue.size.width * 16, /* TODO: why 16??? */
-						//.allocSize: queue.size.width * queue.size.height * 4,
-						.pixelFormat: 0x47524142 /* RGBA */
-					])!
-					let image = Transaction.whileLocked {
-						return queue.register(ioSurface: surface)
-						
-						// TODO: unsure when to do the below instead
-						//let id = IOSurfaceGetID(unsafeBitCast(surface, to: IOSurfaceRef.self))
-						// alternatively call CGLCreatePBuffer()
+					// Draw into a surface the renderer has finished displaying, if
+					// any, rather than allocating one per frame:
+					let (image, surface): (ImageQueue.Image, IOSurface) = Transaction.whileLocked {
+						if let reused = queue.dequeueReusableImage() {
+							return reused
+						}
+						let surface = IOSurface(properties: [
+							.width: queue.size.width,
+							.height: queue.size.height,
+							.bytesPerElement: PixelFormat.bgra8Unorm.bytesPerElement,
+							.bytesPerRow: Int(queue.size.width) * PixelFormat.bgra8Unorm.bytesPerElement,
+							.pixelFormat: PixelFormat.bgra8Unorm.ioSurfaceFormat
+						])!
+						return (queue.register(ioSurface: surface), surface)
 					}
 					
 					//
@@ -1,8 +1,193 @@
 import Foundation
 
+/// A layer that draws a cubic Bezier spline in its coordinate space.
 ///
+/// The shape is composited between the layer's contents and its first sublayer.
+/// It is flattened and tessellated once per path (see `Render.ShapeLayer`), so
+/// animating the transform, colors, or `strokeStart`/`strokeEnd` of the layer
+/// does not rasterize the shape again.
 public class ShapeLayer: Layer {
     
-    //
+    /// The fill rule used when filling the shape's path.
+    public enum FillRule: Int, Codable {
+        
+        /// Specifies the non-zero winding rule.
+        case nonZero
+        
+        /// Specifies the even-odd winding rule.
+        case evenOdd
+    }
     
+    /// The shape of the endpoints of an open path when stroked.
+    public enum LineCap: Int, Codable {
+        
+        ///
+        case butt
+        
+        ///
+        case round
+        
+        ///
+        case square
+    }
+    
+    /// The shape of the joints between connected segments of a stroked path.
+    public enum LineJoin: Int, Codable {
+        
+        ///
+        case miter
+        
+        ///
+        case round
+        
+        ///
+        case bevel
+    }
+    
+    public override class func defaultValue(forKey keyPath: String) -> Any? {
+        switch keyPath {
+        case "fillColor": return CGColor.black
+        case "fillRule": return FillRule.nonZero
+        case "strokeStart": return 0.0 as CGFloat
+        case "strokeEnd": return 1.0 as CGFloat
+        case "lineWidth": return 1.0 as CGFloat
+        case "miterLimit": return 10.0 as CGFloat
+        case "lineCap": return LineCap.butt
+        case "lineJoin": return LineJoin.miter
+        case "lineDashPhase": return 0.0 as CGFloat
+        default: return super.defaultValue(forKey: keyPath)
+        }
+    }
+    
+    /// The path defining the shape to be rendered. Animatable. The path is
+    /// copied, so that mutating a `CGMutablePath` afterwards has no effect.
+    public var path: CGPath? {
+        get { return self.values[#function] }
+        set { self.values[#function] = newValue?.copy() }
+    }
+    
+    /// The color used to fill the shape’s path. Setting `fillColor` to `nil`
+    /// results in no fill being rendered. Defaults to opaque black. Animatable.
+    public var fillColor: CGColor? {
+        get { return self.values[#function] }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// The fill rule used when filling the shape’s path. Defaults to `.nonZero`.
+    public var fillRule: FillRule {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// The color used to stroke the shape’s path. Setting `strokeColor` to `nil`
+    /// results in no stroke being rendered. Defaults to `nil`. Animatable.
+    public var strokeColor: CGColor? {
+        get { return self.values[#function] }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// The relative location at which to begin stroking the path, from 0 to 1.
+    /// Defaults to 0. Animatable.
+    public var strokeStart: CGFloat {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// The relative location at which to stop stroking the path, from 0 to 1.
+    /// Defaults to 1. Animatable.
+    public var strokeEnd: CGFloat {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// Specifies the line width of the shape’s path. Defaults to 1. Animatable.
+    public var lineWidth: CGFloat {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// The miter limit used when stroking the shape’s path. Defaults to 10.
+    /// Animatable.
+    public var miterLimit: CGFloat {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// Specifies the line cap style for the shape’s path. Defaults to `.butt`.
+    public var lineCap: LineCap {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// Specifies the line join style for the shape’s path. Defaults to `.miter`.
+    public var lineJoin: LineJoin {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// The dash phase applied to the shape’s path when stroked. Defaults to 0.
+    /// Animatable.
+    public var lineDashPhase: CGFloat {
+        get { return self.values[#function]! }
+        set { self.values[#function] = newValue }
+    }
+    
+    /// The dash pattern applied to the shape’s path when stroked, as alternating
+    /// painted and unpainted segment lengths. Defaults to `nil`, a solid line.
+    public var lineDashPattern: [CGFloat]? {
+        get { return self.values[#function] }
+        set { self.values[#function] = newValue }
+    }
+    
+    public required init() {
+        super.init()
+    }
+    
+    public required init(layer: Layer) {
+        super.init(layer: layer)
+    }
+    
+    /// The shape is drawn by the renderer from cached meshes (see
+    /// `Render.ShapeLayer`), so no backing store is needed.
+    internal override func prepareContents() {
+        // no-op
+    }
+    
+    /// Draws the shape with the coverage rasterizer, for render targets
+    /// without a GPU.
+    public override func draw(in context: CGContext) {
+        super.draw(in: context)
+        Render.ShapeLayer.render(self, in: context)
+    }
+    
+    /// The stroke parameters of the receiver.
+    internal var strokeStyle: PathRasterizer.StrokeStyle {
+        var style = PathRasterizer.StrokeStyle()
+        style.lineWidth = self.lineWidth
+        style.miterLimit = self.miterLimit
+        style.dashPhase = self.lineDashPhase
+        style.dashPattern = self.lineDashPattern ?? []
+        switch self.lineCap {
+        case .butt: style.lineCap = .butt
+        case .round: style.lineCap = .round
+        case .square: style.lineCap = .square
+        }
+        switch self.lineJoin {
+        case .miter: style.lineJoin = .miter
+        case .round: style.lineJoin = .round
+        case .bevel: style.lineJoin = .bevel
+        }
+        return style
+    }
+}
+
+internal extension ShapeLayer.FillRule {
+    
+    ///
+    var cgFillRule: CGPathFillRule {
+        switch self {
+        case .nonZero: return .winding
+        case .evenOdd: return .evenOdd
+        }
+    }
 }
@@ -119,9 +119,23 @@ public class TextLayer: Layer {
         ctx.setAllowsFontSubpixelQuantization(self.allowsFontSubpixelQuantization)
     }
     
+    /// Text is drawn by the renderer as glyph quads from a shared atlas (see
+    /// `Render.TextLayer`), so no backing store is needed.
+    internal override func prepareContents() {
+        // no-op
+    }
+    
     ///
     public override func draw(in context: CGContext) {
-        guard let str = self.string else { return }
+        guard let attr = self.attributedString else { return }
+        
+        // Create a framesetter and draw into the context:
+        CTFramesetter.draw(attr, to: self.bounds, in: context)
+    }
+    
+    /// The `string` with the layer's text attributes applied.
+    internal var attributedString: NSAttributedString? {
+        guard let str = self.string else { return nil }
         
         // Set up attributed string styles, if we weren't given any:
         let style = NSMutableParagraphStyle()
@@ -148,14 +162,11 @@ public class TextLayer: Layer {
                                                   self.fontSize, nil, nil)
         
         // Modify out, or create, a `CFAttributedString` (if we were not provided one):
-        let attr = NSAttributedString(string: str, attributes: [
+        return NSAttributedString(string: str, attributes: [
             .font: font as NSFont,
             .paragraphStyle: style,
             .foregroundColor: NSColor(cgColor: (self.foregroundColor ?? .white))!
         ])
-        
-        // Create a framesetter and draw into the context:
-        CTFramesetter.draw(attr, to: self.bounds, in: context)
     }
     
     /// Get the correct underlying `CTFont` for our `DrawableFont`.
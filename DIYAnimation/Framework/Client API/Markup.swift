@@ -1,24 +1,443 @@
 import Foundation.NSXMLParser
+import ImageIO
 
 // TODO: CAML support for type `com.avaidyam.diyanimation-xml`
 // TODO: CodingProxy for some classes? not needed if Codable extension works...
 // TODO: support CA_attributes (sliderValue, etc...), attributesForKeyPath, etc
 
+/// Describes a layer tree, and the animations attached to it, as XML:
+///
+///     <layer class="ShapeLayer" name="badge" bounds="0 0 64 64" position="32 32"
+///            path="M 0 0 L 64 0 L 32 64 Z" fillColor="#FF3B30">
+///         <animation class="BasicAnimation" key="pulse" keyPath="opacity"
+///                    fromValue="1" toValue="0.5" duration="0.8"
+///                    repeatCount="1000" autoreverses="true"/>
+///         <mask><layer bounds="0 0 64 64" backgroundColor="#000000"/></mask>
+///         <layer class="TextLayer" string="1" fontSize="24"/>
+///     </layer>
+///
+/// The root element must be a `layer`; nested `layer`s become its sublayers, in
+/// order, and a `mask` holds the single layer used as its `mask`. The `class`
+/// attribute selects the `Layer` or `Animation` subclass, and every other
+/// attribute sets the property of the same name (see `Markup.layerProperties`):
+///
+/// - numbers and booleans are written as-is (`0.5`, `true`);
+/// - points, sizes, and rects as space- or comma-separated numbers;
+/// - colors as `#RRGGBB`, `#RRGGBBAA`, or 3 or 4 numbers from 0 to 1;
+/// - transforms as 6 (affine) or 16 (`m11` through `m44`) numbers;
+/// - paths as absolute `M`, `L`, `Q`, `C`, and `Z` commands;
+/// - images as a path relative to the document.
+///
+/// Markup is loaded by compiling it into a `Markup.Package`, which may also be
+/// done ahead of time with `Markup.Package.compile(_:relativeTo:)`.
 public enum Markup {
     
-    // might require state transitions
+    /// The errors thrown while compiling or loading markup.
+    public enum Error: Swift.Error {
+        
+        /// The document is not well-formed, or its root is not a `layer`.
+        case malformed(String)
+        
+        /// The `class` attribute names no known `Layer` or `Animation` subclass.
+        case unknownClass(String)
+        
+        /// The attribute names no known property.
+        case unknownProperty(String)
+        
+        /// The attribute's value could not be parsed as its property's kind.
+        case invalidValue(key: String, value: String)
+        
+        /// The image named by an attribute could not be read.
+        case missingImage(String)
+        
+        /// The package is truncated, corrupt, or of an unsupported version.
+        case invalidPackage
+    }
     
-    ///
-    public final class Package {
+    /// The kind of value held by a property, both in markup and in a `Package`.
+    internal enum Kind: UInt32 {
+        case number, bool, point, size, rect, color, transform, string, image, path
+    }
+    
+    /// An image embedded in a document, decoded on first use.
+    internal final class Image {
         
-        // root must be layer
+        /// The encoded image, as read from its file.
+        let data: Data
         
-        // read from data or URL to file
+        ///
+        private let lock = Lock()
         
+        ///
+        private var decoded: CGImage? = nil
+        
+        ///
+        init(_ data: Data) {
+            self.data = data
+        }
+        
+        /// The decoded image, or `nil` if `data` is not a supported image format.
+        var cgImage: CGImage? {
+            return self.lock.whileLocked {
+                if self.decoded == nil, let src = CGImageSourceCreateWithData(self.data as CFData, nil) {
+                    self.decoded = CGImageSourceCreateImageAtIndex(src, 0, nil)
+                }
+                return self.decoded
+            }
+        }
     }
     
+    /// A single element of a path, with the points it uses.
+    internal typealias PathElement = (type: CGPathElementType, points: [CGPoint])
+    
+    /// A property value, as parsed from markup or read from a `Package`.
+    internal enum Value {
+        case number(Double)
+        case bool(Bool)
+        case point(CGPoint)
+        case size(CGSize)
+        case rect(CGRect)
+        case color(SIMD4<Double>)
+        case transform(Transform3D)
+        case string(String)
+        case image(Image)
+        case path([PathElement])
+        
+        ///
+        var number: Double? {
+            guard case .number(let x) = self else { return nil }
+            return x
+        }
+        
+        ///
+        var bool: Bool? {
+            guard case .bool(let x) = self else { return nil }
+            return x
+        }
+        
+        ///
+        var point: CGPoint? {
+            guard case .point(let x) = self else { return nil }
+            return x
+        }
+        
+        ///
+        var size: CGSize? {
+            guard case .size(let x) = self else { return nil }
+            return x
+        }
+        
+        ///
+        var rect: CGRect? {
+            guard case .rect(let x) = self else { return nil }
+            return x
+        }
+        
+        ///
+        var color: CGColor? {
+            guard case .color(let c) = self else { return nil }
+            return CGColor(red: CGFloat(c.x), green: CGFloat(c.y),
+                           blue: CGFloat(c.z), alpha: CGFloat(c.w))
+        }
+        
+        ///
+        var transform: Transform3D? {
+            guard case .transform(let x) = self else { return nil }
+            return x
+        }
+        
+        ///
+        var string: String? {
+            guard case .string(let x) = self else { return nil }
+            return x
+        }
+        
+        ///
+        var image: CGImage? {
+            guard case .image(let x) = self else { return nil }
+            return x.cgImage
+        }
+        
+        ///
+        var path: CGPath? {
+            guard case .path(let elements) = self else { return nil }
+            let path = CGMutablePath()
+            for e in elements {
+                switch e.type {
+                case .moveToPoint: path.move(to: e.points[0])
+                case .addLineToPoint: path.addLine(to: e.points[0])
+                case .addQuadCurveToPoint: path.addQuadCurve(to: e.points[1], control: e.points[0])
+                case .addCurveToPoint: path.addCurve(to: e.points[2], control1: e.points[0],
+                                                     control2: e.points[1])
+                case .closeSubpath: path.closeSubpath()
+                @unknown default: break
+                }
+            }
+            return path
+        }
+        
+        /// Parses the `text` of the attribute `key` as a value of `kind`;
+        /// images are read relative to `baseURL`.
+        static func parse(_ text: String, as kind: Kind, key: String,
+                          relativeTo baseURL: URL?) throws -> Value
+        {
+            let invalid = Markup.Error.invalidValue(key: key, value: text)
+            let tokens = text.split { $0 == "," || $0.isWhitespace }.map(String.init)
+            let numbers = tokens.compactMap(Double.init)
+            let count = numbers.count == tokens.count ? numbers.count : -1
+            
+            switch kind {
+            case .number:
+                guard count == 1 else { throw invalid }
+                return .number(numbers[0])
+            case .bool:
+                switch text.trimmingCharacters(in: .whitespaces) {
+                case "true", "yes", "1": return .bool(true)
+                case "false", "no", "0": return .bool(false)
+                default: throw invalid
+                }
+            case .point:
+                guard count == 2 else { throw invalid }
+                return .point(CGPoint(x: numbers[0], y: numbers[1]))
+            case .size:
+                guard count == 2 else { throw invalid }
+                return .size(CGSize(width: numbers[0], height: numbers[1]))
+            case .rect:
+                guard count == 4 else { throw invalid }
+                return .rect(CGRect(x: numbers[0], y: numbers[1],
+                                    width: numbers[2], height: numbers[3]))
+            case .color:
+                if count == 3 || count == 4 {
+                    return .color(SIMD4(numbers[0], numbers[1], numbers[2],
+                                        count == 4 ? numbers[3] : 1.0))
+                }
+                let hex = text.trimmingCharacters(in: .whitespaces)
+                guard hex.hasPrefix("#"), hex.count == 7 || hex.count == 9,
+                    var rgba = UInt32(hex.dropFirst(), radix: 16) else { throw invalid }
+                if hex.count == 7 {
+                    rgba = rgba << 8 | 0xFF
+                }
+                let c = SIMD4<UInt32>(rgba >> 24, rgba >> 16, rgba >> 8, rgba) & 0xFF
+                return .color(SIMD4<Double>(Double(c.x), Double(c.y),
+                                            Double(c.z), Double(c.w)) / 255.0)
+            case .transform:
+                let m = numbers.map { Float($0) }
+                if count == 6 {
+                    return .transform(Transform3D(affine: CGAffineTransform(a: numbers[0], b: numbers[1],
+                                                                            c: numbers[2], d: numbers[3],
+                                                                            tx: numbers[4], ty: numbers[5])))
+                }
+                guard count == 16 else { throw invalid }
+                return .transform(Transform3D(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7],
+                                              m[8], m[9], m[10], m[11], m[12], m[13], m[14], m[15]))
+            case .string:
+                return .string(text)
+            case .image:
+                let url = URL(fileURLWithPath: text, relativeTo: baseURL)
+                guard let data = try? Data(contentsOf: url) else {
+                    throw Markup.Error.missingImage(url.path)
+                }
+                return .image(Image(data))
+            case .path:
+                return .path(try Value.parsePath(tokens, invalid))
+            }
+        }
+        
+        /// Parses the tokens of a path of absolute `M`, `L`, `Q`, `C`, and `Z`
+        /// commands; a command may be followed by any number of its operands.
+        private static func parsePath(_ tokens: [String], _ invalid: Markup.Error) throws -> [PathElement] {
+            var elements = [PathElement]()
+            var i = 0, command: Character = "M"
+            while i < tokens.count {
+                if let c = tokens[i].first, c.isLetter {
+                    guard tokens[i].count == 1 else { throw invalid }
+                    command = c
+                    i += 1
+                    if c == "Z" || c == "z" {
+                        elements.append((.closeSubpath, []))
+                        continue
+                    }
+                }
+                
+                let (type, n): (CGPathElementType, Int)
+                switch command {
+                case "M": (type, n) = (.moveToPoint, 1)
+                case "L": (type, n) = (.addLineToPoint, 1)
+                case "Q": (type, n) = (.addQuadCurveToPoint, 2)
+                case "C": (type, n) = (.addCurveToPoint, 3)
+                default: throw invalid
+                }
+                guard i + n * 2 <= tokens.count else { throw invalid }
+                let xy = try tokens[i..<(i + n * 2)].map { (s: String) -> Double in
+                    guard let x = Double(s) else { throw invalid }
+                    return x
+                }
+                elements.append((type, (0..<n).map { CGPoint(x: xy[$0 * 2], y: xy[$0 * 2 + 1]) }))
+                i += n * 2
+                
+                // Subsequent operands of a move are lines, as in SVG:
+                if command == "M" { command = "L" }
+            }
+            return elements
+        }
+    }
+    
+    /// A property that may be set from markup on a layer or animation.
+    internal struct Property {
+        
+        ///
+        let kind: Kind
+        
+        /// Converts a value to the property's type, as it would be stored in
+        /// the object's `values`; used for the values of animations.
+        let box: (Value) -> Any?
+        
+        /// Sets the property of an object to the value, if the object has it.
+        let apply: (AnyObject, Value) -> ()
+        
+        ///
+        static func bind<Root: AnyObject, T>(_ keyPath: ReferenceWritableKeyPath<Root, T>,
+                                             _ kind: Kind, _ convert: @escaping (Value) -> T?) -> Property
+        {
+            return Property(kind: kind, box: { convert($0) }, apply: { object, value in
+                guard let object = object as? Root, let x = convert(value) else { return }
+                object[keyPath: keyPath] = x
+            })
+        }
+        
+        ///
+        static func bind<Root: AnyObject, T>(optional keyPath: ReferenceWritableKeyPath<Root, T?>,
+                                             _ kind: Kind, _ convert: @escaping (Value) -> T?) -> Property
+        {
+            return Property(kind: kind, box: { convert($0) }, apply: { object, value in
+                guard let object = object as? Root, let x = convert(value) else { return }
+                object[keyPath: keyPath] = x
+            })
+        }
+    }
+    
+    /// The `Layer` subclasses that may be named by the `class` attribute.
+    internal static let layerClasses: [String: Layer.Type] = [
+        "Layer": Layer.self,
+        "ShapeLayer": ShapeLayer.self,
+        "TextLayer": TextLayer.self,
+        "GradientLayer": GradientLayer.self,
+        "ReplicatorLayer": ReplicatorLayer.self,
+        "TransformLayer": TransformLayer.self,
+        "ScrollLayer": ScrollLayer.self,
+        "BackdropLayer": BackdropLayer.self,
+    ]
+    
+    /// The `Animation` subclasses that may be named by the `class` attribute.
+    internal static let animationClasses: [String: () -> Animation] = [
+        "BasicAnimation": { BasicAnimation() },
+    ]
+    
+    /// The properties that may be set on layers, in the order they are applied;
+    /// properties that a layer's class doesn't have are ignored.
+    ///
+    /// Geometry is applied before `frame`, which is derived from it, so that a
+    /// `frame` attribute takes precedence regardless of attribute order.
+    internal static let layerProperties: [(key: String, property: Property)] = {
+        let number = { (v: Value) in v.number.map { CGFloat($0) } }
+        return [
+            ("name", .bind(optional: \Layer.name, .string) { $0.string }),
+            ("bounds", .bind(\Layer.bounds, .rect) { $0.rect }),
+            ("anchorPoint", .bind(\Layer.anchorPoint, .point) { $0.point }),
+            ("position", .bind(\Layer.position, .point) { $0.point }),
+            ("frame", .bind(\Layer.frame, .rect) { $0.rect }),
+            ("zPosition", .bind(\Layer.zPosition, .number, number)),
+            ("anchorPointZ", .bind(\Layer.anchorPointZ, .number, number)),
+            ("transform", .bind(optional: \Layer.transform, .transform) { $0.transform }),
+            ("sublayerTransform", .bind(optional: \Layer.sublayerTransform, .transform) { $0.transform }),
+            ("isHidden", .bind(\Layer.isHidden, .bool) { $0.bool }),
+            ("isDoubleSided", .bind(\Layer.isDoubleSided, .bool) { $0.bool }),
+            ("isGeometryFlipped", .bind(\Layer.isGeometryFlipped, .bool) { $0.bool }),
+            ("masksToBounds", .bind(\Layer.masksToBounds, .bool) { $0.bool }),
+            ("isOpaque", .bind(\Layer.isOpaque, .bool) { $0.bool }),
+            ("opacity", .bind(\Layer.opacity, .number) { $0.number.map { Float($0) } }),
+            ("contents", .bind(optional: \Layer.contents, .image) { $0.image.map { $0 as Drawable } }),
+            ("contentsRect", .bind(\Layer.contentsRect, .rect) { $0.rect }),
+            ("contentsCenter", .bind(\Layer.contentsCenter, .rect) { $0.rect }),
+            ("minificationFilterBias", .bind(\Layer.minificationFilterBias, .number, number)),
+            ("backgroundColor", .bind(\Layer.backgroundColor, .color) { $0.color }),
+            ("cornerRadius", .bind(\Layer.cornerRadius, .number, number)),
+            ("borderWidth", .bind(\Layer.borderWidth, .number, number)),
+            ("borderColor", .bind(\Layer.borderColor, .color) { $0.color }),
+            ("shadowColor", .bind(\Layer.shadowColor, .color) { $0.color }),
+            ("shadowOpacity", .bind(\Layer.shadowOpacity, .number, number)),
+            ("shadowOffset", .bind(\Layer.shadowOffset, .size) { $0.size }),
+            ("shadowRadius", .bind(\Layer.shadowRadius, .number, number)),
+            
+            ("path", .bind(optional: \ShapeLayer.path, .path) { $0.path }),
+            ("fillColor", .bind(optional: \ShapeLayer.fillColor, .color) { $0.color }),
+            ("strokeColor", .bind(optional: \ShapeLayer.strokeColor, .color) { $0.color }),
+            ("strokeStart", .bind(\ShapeLayer.strokeStart, .number, number)),
+            ("strokeEnd", .bind(\ShapeLayer.strokeEnd, .number, number)),
+            ("lineWidth", .bind(\ShapeLayer.lineWidth, .number, number)),
+            ("miterLimit", .bind(\ShapeLayer.miterLimit, .number, number)),
+            ("lineDashPhase", .bind(\ShapeLayer.lineDashPhase, .number, number)),
+            
+            ("string", .bind(optional: \TextLayer.string, .string) { $0.string }),
+            ("fontSize", .bind(\TextLayer.fontSize, .number, number)),
+            ("foregroundColor", .bind(optional: \TextLayer.foregroundColor, .color) { $0.color }),
+            ("isWrapped", .bind(\TextLayer.isWrapped, .bool) { $0.bool }),
+        ]
+    }()
+    
+    /// The properties that may be set on animations, in the order they are
+    /// applied. The `fromValue`, `toValue`, and `byValue` of a property animation
+    /// take the kind of the layer property named by its `keyPath`.
+    internal static let animationProperties: [(key: String, property: Property)] = [
+        ("keyPath", .bind(optional: \PropertyAnimation.keyPath, .string) { $0.string }),
+        ("beginTime", .bind(\Animation.beginTime, .number) { $0.number }),
+        ("duration", .bind(\Animation.duration, .number) { $0.number }),
+        ("speed", .bind(\Animation.speed, .number) { $0.number }),
+        ("timeOffset", .bind(\Animation.timeOffset, .number) { $0.number }),
+        ("repeatCount", .bind(\Animation.repeatCount, .number) { $0.number.map { Int($0) } }),
+        ("repeatDuration", .bind(\Animation.repeatDuration, .number) { $0.number }),
+        ("autoreverses", .bind(\Animation.autoreverses, .bool) { $0.bool }),
+        ("fillMode", .bind(\Animation.fillMode, .string) {
+            switch $0.string {
+            case "forwards": return .forwards
+            case "backwards": return .backwards
+            case "both": return .both
+            case "removed": return .removed
+            default: return nil
+            }
+        }),
+        ("removedOnCompletion", .bind(\Animation.removedOnCompletion, .bool) { $0.bool }),
+        ("frameInterval", .bind(\Animation.frameInterval, .number) { $0.number }),
+        ("additive", .bind(\PropertyAnimation.additive, .bool) { $0.bool }),
+        ("cumulative", .bind(\PropertyAnimation.cumulative, .bool) { $0.bool }),
+    ]
+    
+    /// The keys of animation values, typed by the animation's `keyPath`.
+    internal static let animationValueKeys: Set<String> = ["fromValue", "toValue", "byValue"]
+    
     ///
-    class Transformer: NSObject, XMLParserDelegate {
+    internal static let layerIndex: [String: Int] = Dictionary(uniqueKeysWithValues:
+        Markup.layerProperties.enumerated().map { ($1.key, $0) })
+    
+    ///
+    internal static let animationIndex: [String: Int] = Dictionary(uniqueKeysWithValues:
+        Markup.animationProperties.enumerated().map { ($1.key, $0) })
+    
+    /// Loads the layer tree described by the markup in `data`, reading any
+    /// images it names relative to `baseURL`.
+    public static func layer(from data: Data, relativeTo baseURL: URL? = nil) throws -> Layer {
+        let package = try Package(data: Package.compile(data, relativeTo: baseURL))
+        return try package.instantiate()
+    }
+    
+    /// Loads the layer tree described by the markup file at `url`.
+    public static func layer(contentsOf url: URL) throws -> Layer {
+        return try Markup.layer(from: Data(contentsOf: url),
+                                relativeTo: url.deletingLastPathComponent())
+    }
+    
+    /// Parses markup into a tree of its elements.
+    internal final class Transformer: NSObject, XMLParserDelegate {
         
         ///
         internal enum Tag: String {
@@ -28,6 +447,9 @@ public enum Markup {
             
             ///
             case animation
+            
+            /// Contains the single layer used as its parent layer's `mask`.
+            case mask
         }
         
         ///
@@ -68,14 +490,18 @@ public enum Markup {
             self.parser.delegate = self
         }
         
-        ///
-        internal func parse() throws -> Node? {
+        /// Returns the root `layer` element of the document.
+        internal func parse() throws -> Node {
             self.parser.parse()
-            if let e = parser.parserError { throw e }
+            if let e = parser.parserError {
+                throw Markup.Error.malformed(e.localizedDescription)
+            }
             
             assert(self.stack.isEmpty)
-            assert(self.tree != nil)
-            return self.tree
+            guard let tree = self.tree, tree.tag == .layer else {
+                throw Markup.Error.malformed("the root element must be a layer")
+            }
+            return tree
         }
         
         ///
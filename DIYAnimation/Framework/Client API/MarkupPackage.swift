@@ -0,0 +1,621 @@
+import Foundation
+
+extension Markup {
+    
+    /// A layer tree compiled from markup into a flat binary form, which can be
+    /// mapped into memory and instantiated without parsing any XML.
+    ///
+    /// A package begins with a header of 16 little-endian 32-bit words: a magic
+    /// number, the format version, and the byte offset and count of each
+    /// `Section`. Every section is aligned to 8 bytes, and every record in it is
+    /// made of 32-bit words:
+    ///
+    /// - **layers**: `(class, firstProperty, propertyCount, firstAnimation,
+    ///   animationCount, end, flags, reserved)`, in preorder; `end` is the index
+    ///   after the layer's subtree, and a layer that is its parent's `mask`
+    ///   precedes its siblings and has `flags` bit 0 set.
+    /// - **animations**: `(class, key, firstProperty, propertyCount)`; `key` is
+    ///   `0xFFFFFFFF` for an animation added without one.
+    /// - **properties**: `(key, kind, offset, reserved)`; the value of `kind`
+    ///   begins at word `offset` of the data section.
+    /// - **keys**: `(offset, length)` of each interned class name, property key,
+    ///   and string value in the UTF-8 of the strings section.
+    /// - **data**: 64-bit words; numbers are stored as `Double`s, and strings and
+    ///   images as indices into the keys and images sections.
+    /// - **images**: `(offset, length)` of the encoded bytes of each image, which
+    ///   follow all other sections.
+    ///
+    /// Opening a package only validates its header; keys are decoded, images
+    /// are decoded, and layers are created only as each subtree is instantiated.
+    public final class Package {
+        
+        /// A subtree of the package's layer tree, which may be instantiated alone.
+        public struct Subtree: Hashable {
+            
+            /// The index of the subtree's root in the layers section.
+            fileprivate let index: Int
+        }
+        
+        /// The sections of a package, in the order of the header.
+        fileprivate enum Section: Int, CaseIterable {
+            case layers, animations, properties, keys, strings, data, images
+            
+            /// The size of each record of the section, in bytes.
+            var stride: Int {
+                switch self {
+                case .layers: return 32
+                case .animations: return 16
+                case .properties: return 16
+                case .keys: return 8
+                case .strings: return 1
+                case .data: return 8
+                case .images: return 8
+                }
+            }
+        }
+        
+        /// The bytes "DIYM", read as a little-endian word.
+        private static let magic: UInt32 = 0x4D594944
+        
+        ///
+        private static let version: UInt32 = 1
+        
+        ///
+        private static let headerSize = 64
+        
+        /// Set in the `flags` of a layer that is its parent's `mask`.
+        private static let maskFlag = 1
+        
+        /// The `key` of an animation added without one.
+        private static let noKey = Int(UInt32.max)
+        
+        ///
+        private let data: Data
+        
+        /// The byte offset and record count of each section.
+        private let sections: [(offset: Int, count: Int)]
+        
+        /// The keys decoded so far, by index.
+        private var keys: [Int: String] = [:]
+        
+        /// The images read so far, by index; each is decoded on first use.
+        private var images: [Int: Image] = [:]
+        
+        ///
+        private let lock = Lock()
+        
+        /// Opens the package in `data`, validating only its header. Words are
+        /// loaded in place, so `data` is copied if it is not 8-byte aligned (such
+        /// as a slice of a larger buffer).
+        public init(data: Data) throws {
+            guard data.count >= Package.headerSize else { throw Markup.Error.invalidPackage }
+            let aligned = data.withUnsafeBytes { p in Int(bitPattern: p.baseAddress) % 8 == 0 }
+            self.data = aligned ? data : data.withUnsafeBytes { p in
+                Data(bytes: p.baseAddress!, count: p.count)
+            }
+            let header = self.data.withUnsafeBytes { p in
+                (0..<(Package.headerSize / 4)).map {
+                    Int(UInt32(littleEndian: p.load(fromByteOffset: $0 * 4, as: UInt32.self)))
+                }
+            }
+            guard header[0] == Int(Package.magic), header[1] == Int(Package.version) else {
+                throw Markup.Error.invalidPackage
+            }
+            
+            self.sections = Section.allCases.map { (header[2 + $0.rawValue * 2], header[3 + $0.rawValue * 2]) }
+            for s in Section.allCases {
+                let (offset, count) = self.sections[s.rawValue]
+                guard offset % 8 == 0, offset >= Package.headerSize,
+                    offset + count * s.stride <= data.count else { throw Markup.Error.invalidPackage }
+            }
+            guard self.sections[Section.layers.rawValue].count > 0 else {
+                throw Markup.Error.invalidPackage
+            }
+        }
+        
+        /// Opens the package in the file at `url`, which is mapped into memory
+        /// rather than read.
+        public convenience init(contentsOf url: URL) throws {
+            try self.init(data: Data(contentsOf: url, options: .alwaysMapped))
+        }
+        
+        /// The whole layer tree of the package.
+        public var root: Subtree {
+            return Subtree(index: 0)
+        }
+        
+        /// The first subtree, in preorder, whose root layer has the `name`.
+        public func subtree(named name: String) throws -> Subtree? {
+            for i in 0..<self.sections[Section.layers.rawValue].count {
+                let r = try self.record(.layers, i)
+                for p in r[1]..<(r[1] + r[2]) {
+                    let (key, kind, offset) = try self.property(p)
+                    if key == "name" && kind == .string, try self.key(self.word(offset)) == name {
+                        return Subtree(index: i)
+                    }
+                }
+            }
+            return nil
+        }
+        
+        /// The subtrees of each sublayer of the root of `subtree`, in order.
+        public func sublayers(of subtree: Subtree) throws -> [Subtree] {
+            var sublayers = [Subtree]()
+            try self.children(of: subtree.index) { i, isMask in
+                if !isMask { sublayers.append(Subtree(index: i)) }
+            }
+            return sublayers
+        }
+        
+        /// Creates the layers of `subtree`, or of the whole tree if `nil`, and
+        /// adds their animations. Each call creates new layers.
+        public func instantiate(_ subtree: Subtree? = nil) throws -> Layer {
+            Transaction.begin()
+            Transaction.disableActions = true
+            defer { Transaction.commit() }
+            return try self.instantiate(at: (subtree ?? self.root).index)
+        }
+        
+        ///
+        private func instantiate(at index: Int) throws -> Layer {
+            let r = try self.record(.layers, index)
+            guard let cls = try Markup.layerClasses[self.key(r[0])] else {
+                throw Markup.Error.invalidPackage
+            }
+            
+            let layer = cls.init()
+            for p in r[1]..<(r[1] + r[2]) {
+                let (key, kind, offset) = try self.property(p)
+                guard let i = Markup.layerIndex[key] else { continue }
+                let property = Markup.layerProperties[i].property
+                guard property.kind == kind else { throw Markup.Error.invalidPackage }
+                property.apply(layer, try self.value(kind, at: offset))
+            }
+            try self.children(of: index) { i, isMask in
+                let sublayer = try self.instantiate(at: i)
+                if isMask {
+                    layer.mask = sublayer
+                } else {
+                    layer.addSublayer(sublayer)
+                }
+            }
+            for a in r[3]..<(r[3] + r[4]) {
+                let (animation, key) = try self.animation(a)
+                layer.addAnimation(animation, forKey: key)
+            }
+            return layer
+        }
+        
+        /// Creates the animation at `index`, and returns it with its key.
+        private func animation(_ index: Int) throws -> (Animation, String?) {
+            let r = try self.record(.animations, index)
+            guard let make = try Markup.animationClasses[self.key(r[0])] else {
+                throw Markup.Error.invalidPackage
+            }
+            
+            let animation = make()
+            var values = [(String, Value)]()
+            for p in r[2]..<(r[2] + r[3]) {
+                let (key, kind, offset) = try self.property(p)
+                if Markup.animationValueKeys.contains(key) {
+                    values.append((key, try self.value(kind, at: offset)))
+                } else if let i = Markup.animationIndex[key] {
+                    let property = Markup.animationProperties[i].property
+                    guard property.kind == kind else { throw Markup.Error.invalidPackage }
+                    property.apply(animation, try self.value(kind, at: offset))
+                }
+            }
+            
+            // Values are stored as the type of the animated layer property:
+            if let basic = animation as? BasicAnimation, let keyPath = basic.keyPath,
+                let i = Markup.layerIndex[keyPath]
+            {
+                let box = Markup.layerProperties[i].property.box
+                for (key, value) in values {
+                    switch key {
+                    case "fromValue": basic.fromValue = box(value)
+                    case "toValue": basic.toValue = box(value)
+                    case "byValue": basic.byValue = box(value)
+                    default: break
+                    }
+                }
+            }
+            
+            // A begin time in markup is relative to the time of instantiation:
+            if animation.beginTime != 0 {
+                animation.beginTime += CurrentMediaTime()
+            }
+            return (animation, r[1] == Package.noKey ? nil : try self.key(r[1]))
+        }
+        
+        /// Calls `body` with the index of each child of the layer at `index`,
+        /// and whether it is the layer's mask.
+        private func children(of index: Int, _ body: (Int, Bool) throws -> ()) throws {
+            let end = try self.record(.layers, index)[5]
+            var i = index + 1
+            while i < end {
+                let r = try self.record(.layers, i)
+                guard r[5] > i && r[5] <= end else { throw Markup.Error.invalidPackage }
+                try body(i, r[6] & Package.maskFlag != 0)
+                i = r[5]
+            }
+        }
+        
+        /// The words of the record at `index` in `section`.
+        private func record(_ section: Section, _ index: Int) throws -> [Int] {
+            let (offset, count) = self.sections[section.rawValue]
+            guard index >= 0 && index < count else { throw Markup.Error.invalidPackage }
+            return self.data.withUnsafeBytes { p in
+                (0..<(section.stride / 4)).map {
+                    Int(UInt32(littleEndian: p.load(fromByteOffset: offset + index * section.stride + $0 * 4,
+                                                    as: UInt32.self)))
+                }
+            }
+        }
+        
+        /// The key, kind, and data offset of the property at `index`.
+        private func property(_ index: Int) throws -> (String, Kind, Int) {
+            let r = try self.record(.properties, index)
+            guard let kind = Kind(rawValue: UInt32(r[1])) else { throw Markup.Error.invalidPackage }
+            return (try self.key(r[0]), kind, r[2])
+        }
+        
+        /// The word at `offset` in the data section.
+        private func word(_ offset: Int) throws -> Int {
+            let (start, count) = self.sections[Section.data.rawValue]
+            guard offset >= 0 && offset < count else { throw Markup.Error.invalidPackage }
+            let w = self.data.withUnsafeBytes { p in
+                UInt64(littleEndian: p.load(fromByteOffset: start + offset * 8, as: UInt64.self))
+            }
+            guard w <= UInt64(UInt32.max) else { throw Markup.Error.invalidPackage }
+            return Int(w)
+        }
+        
+        /// The `n` doubles at `offset` in the data section.
+        private func doubles(_ offset: Int, _ n: Int) throws -> [Double] {
+            let (start, count) = self.sections[Section.data.rawValue]
+            guard offset >= 0 && offset + n <= count else { throw Markup.Error.invalidPackage }
+            return self.data.withUnsafeBytes { p in
+                (0..<n).map {
+                    Double(bitPattern: UInt64(littleEndian: p.load(fromByteOffset: start + (offset + $0) * 8,
+                                                                   as: UInt64.self)))
+                }
+            }
+        }
+        
+        /// The key at `index`, decoded on first use.
+        private func key(_ index: Int) throws -> String {
+            let cached = self.lock.whileLocked { self.keys[index] }
+            if let k = cached {
+                return k
+            }
+            let r = try self.record(.keys, index)
+            let strings = self.sections[Section.strings.rawValue]
+            guard r[0] + r[1] <= strings.count else { throw Markup.Error.invalidPackage }
+            let start = self.data.startIndex + strings.offset + r[0]
+            let k = String(decoding: self.data[start..<(start + r[1])], as: UTF8.self)
+            self.lock.whileLocked { self.keys[index] = k }
+            return k
+        }
+        
+        /// The image at `index`, which refers to the package's bytes.
+        private func image(_ index: Int) throws -> Image {
+            let cached = self.lock.whileLocked { self.images[index] }
+            if let i = cached {
+                return i
+            }
+            let r = try self.record(.images, index)
+            guard r[0] + r[1] <= self.data.count else { throw Markup.Error.invalidPackage }
+            let start = self.data.startIndex + r[0]
+            let image = Image(self.data[start..<(start + r[1])])
+            return self.lock.whileLocked {
+                if let i = self.images[index] { return i }
+                self.images[index] = image
+                return image
+            }
+        }
+        
+        /// The value of `kind` at `offset` in the data section.
+        private func value(_ kind: Kind, at offset: Int) throws -> Value {
+            switch kind {
+            case .number:
+                return .number(try self.doubles(offset, 1)[0])
+            case .bool:
+                return .bool(try self.word(offset) != 0)
+            case .point:
+                let d = try self.doubles(offset, 2)
+                return .point(CGPoint(x: d[0], y: d[1]))
+            case .size:
+                let d = try self.doubles(offset, 2)
+                return .size(CGSize(width: d[0], height: d[1]))
+            case .rect:
+                let d = try self.doubles(offset, 4)
+                return .rect(CGRect(x: d[0], y: d[1], width: d[2], height: d[3]))
+            case .color:
+                let d = try self.doubles(offset, 4)
+                return .color(SIMD4(d[0], d[1], d[2], d[3]))
+            case .transform:
+                let m = try self.doubles(offset, 16).map { Float($0) }
+                return .transform(Transform3D(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7],
+                                              m[8], m[9], m[10], m[11], m[12], m[13], m[14], m[15]))
+            case .string:
+                return .string(try self.key(self.word(offset)))
+            case .image:
+                return .image(try self.image(self.word(offset)))
+            case .path:
+                let count = try self.word(offset)
+                
+                // Each element is a type and six coordinates, all of which must
+                // lie within the data section before any are reserved:
+                guard offset + 1 + count * 7 <= self.sections[Section.data.rawValue].count else {
+                    throw Markup.Error.invalidPackage
+                }
+                var elements = [PathElement]()
+                elements.reserveCapacity(count)
+                for i in 0..<count {
+                    let e = offset + 1 + i * 7
+                    guard let type = CGPathElementType(rawValue: Int32(try self.word(e))) else {
+                        throw Markup.Error.invalidPackage
+                    }
+                    let d = try self.doubles(e + 1, 6)
+                    let points = (0..<Package.pointCount(type)).map { CGPoint(x: d[$0 * 2], y: d[$0 * 2 + 1]) }
+                    elements.append((type, points))
+                }
+                return .path(elements)
+            }
+        }
+        
+        /// The number of points used by a path element of `type`.
+        private static func pointCount(_ type: CGPathElementType) -> Int {
+            switch type {
+            case .moveToPoint, .addLineToPoint: return 1
+            case .addQuadCurveToPoint: return 2
+            case .addCurveToPoint: return 3
+            default: return 0
+            }
+        }
+    }
+}
+
+extension Markup.Package {
+    
+    /// Compiles the markup in `xml` into a package, reading any images it names
+    /// relative to `baseURL` and embedding them.
+    public static func compile(_ xml: Data, relativeTo baseURL: URL? = nil) throws -> Data {
+        let root = try Markup.Transformer(data: xml).parse()
+        var writer = Writer(baseURL: baseURL)
+        try writer.layer(root, isMask: false)
+        return writer.encoded()
+    }
+    
+    /// Compiles the markup file at `url` into a package.
+    public static func compile(contentsOf url: URL) throws -> Data {
+        return try Markup.Package.compile(Data(contentsOf: url),
+                                          relativeTo: url.deletingLastPathComponent())
+    }
+    
+    /// Accumulates the sections of a package.
+    private struct Writer {
+        
+        ///
+        let baseURL: URL?
+        
+        ///
+        var layers = [UInt32]()
+        
+        ///
+        var animations = [UInt32]()
+        
+        ///
+        var properties = [UInt32]()
+        
+        ///
+        var keys = [String]()
+        
+        ///
+        var keyIndex = [String: UInt32]()
+        
+        ///
+        var data = [UInt64]()
+        
+        /// The encoded bytes of each image; identical images are stored once.
+        var images = [Data]()
+        
+        ///
+        var imageIndex = [Data: UInt32]()
+        
+        ///
+        init(baseURL: URL?) {
+            self.baseURL = baseURL
+        }
+        
+        /// Appends the records of the layer `node` and its subtree.
+        mutating func layer(_ node: Markup.Transformer.Node, isMask: Bool) throws {
+            let cls = node.attributes["class"] ?? "Layer"
+            guard Markup.layerClasses[cls] != nil else { throw Markup.Error.unknownClass(cls) }
+            
+            let index = self.layers.count / 8
+            self.layers += [self.intern(cls), 0, 0, 0, 0, 0, isMask ? UInt32(Markup.Package.maskFlag) : 0, 0]
+            
+            // Properties are stored in the order they must be applied:
+            let first = self.properties.count / 4
+            let attributes = try node.attributes.filter { $0.key != "class" }.map {
+                attribute -> (Int, String, String) in
+                let (key, text) = attribute
+                guard let i = Markup.layerIndex[key] else { throw Markup.Error.unknownProperty(key) }
+                return (i, key, text)
+            }
+            for (i, key, text) in attributes.sorted(by: { $0.0 < $1.0 }) {
+                try self.property(key, text, Markup.layerProperties[i].property.kind)
+            }
+            self.layers[index * 8 + 1] = UInt32(first)
+            self.layers[index * 8 + 2] = UInt32(self.properties.count / 4 - first)
+            
+            let firstAnimation = self.animations.count / 4
+            for n in node.nodes where n.tag == .animation {
+                try self.animation(n)
+            }
+            self.layers[index * 8 + 3] = UInt32(firstAnimation)
+            self.layers[index * 8 + 4] = UInt32(self.animations.count / 4 - firstAnimation)
+            
+            let masks = node.nodes.filter { $0.tag == .mask }
+            guard masks.count <= 1 else { throw Markup.Error.malformed("a layer may have only one mask") }
+            if let mask = masks.first {
+                guard mask.nodes.count == 1 && mask.nodes[0].tag == .layer else {
+                    throw Markup.Error.malformed("a mask must contain a single layer")
+                }
+                try self.layer(mask.nodes[0], isMask: true)
+            }
+            for n in node.nodes where n.tag == .layer {
+                try self.layer(n, isMask: false)
+            }
+            self.layers[index * 8 + 5] = UInt32(self.layers.count / 8)
+        }
+        
+        /// Appends the records of the animation `node`.
+        mutating func animation(_ node: Markup.Transformer.Node) throws {
+            let cls = node.attributes["class"] ?? "BasicAnimation"
+            guard Markup.animationClasses[cls] != nil else { throw Markup.Error.unknownClass(cls) }
+            var key = UInt32(Markup.Package.noKey)
+            if let k = node.attributes["key"] {
+                key = self.intern(k)
+            }
+            let first = self.properties.count / 4
+            
+            // The values follow all other properties, and take the kind of the
+            // layer property being animated:
+            let valueKind = node.attributes["keyPath"].flatMap { Markup.layerIndex[$0] }
+                .map { Markup.layerProperties[$0].property.kind }
+            let attributes = try node.attributes.filter { $0.key != "class" && $0.key != "key" }.map {
+                attribute -> (Int, String, String, Markup.Kind) in
+                let (key, text) = attribute
+                if Markup.animationValueKeys.contains(key) {
+                    guard let kind = valueKind else {
+                        throw Markup.Error.unknownProperty(node.attributes["keyPath"] ?? "keyPath")
+                    }
+                    return (Markup.animationProperties.count, key, text, kind)
+                }
+                guard let i = Markup.animationIndex[key] else { throw Markup.Error.unknownProperty(key) }
+                return (i, key, text, Markup.animationProperties[i].property.kind)
+            }
+            for (_, key, text, kind) in attributes.sorted(by: { ($0.0, $0.1) < ($1.0, $1.1) }) {
+                try self.property(key, text, kind)
+            }
+            self.animations += [self.intern(cls), key, UInt32(first),
+                                UInt32(self.properties.count / 4 - first)]
+        }
+        
+        /// Appends a property record and its value.
+        mutating func property(_ key: String, _ text: String, _ kind: Markup.Kind) throws {
+            let value = try Markup.Value.parse(text, as: kind, key: key, relativeTo: self.baseURL)
+            self.properties += [self.intern(key), kind.rawValue, UInt32(self.data.count), 0]
+            self.append(value)
+        }
+        
+        /// Appends a value to the data section.
+        mutating func append(_ value: Markup.Value) {
+            switch value {
+            case .number(let x):
+                self.append([x])
+            case .bool(let b):
+                self.data.append(b ? 1 : 0)
+            case .point(let p):
+                self.append([Double(p.x), Double(p.y)])
+            case .size(let s):
+                self.append([Double(s.width), Double(s.height)])
+            case .rect(let r):
+                self.append([Double(r.origin.x), Double(r.origin.y),
+                         Double(r.size.width), Double(r.size.height)])
+            case .color(let c):
+                self.append([c.x, c.y, c.z, c.w])
+            case .transform(let t):
+                let c = t.m.columns
+                self.append([c.0, c.1, c.2, c.3].flatMap { v in (0..<4).map { Double(v[$0]) } })
+            case .string(let s):
+                self.data.append(UInt64(self.intern(s)))
+            case .image(let image):
+                if let i = self.imageIndex[image.data] {
+                    self.data.append(UInt64(i))
+                } else {
+                    let i = UInt32(self.images.count)
+                    self.images.append(image.data)
+                    self.imageIndex[image.data] = i
+                    self.data.append(UInt64(i))
+                }
+            case .path(let elements):
+                self.data.append(UInt64(elements.count))
+                for e in elements {
+                    self.data.append(UInt64(e.type.rawValue))
+                    let xy = e.points.flatMap { [Double($0.x), Double($0.y)] }
+                    self.append(xy + [Double](repeating: 0, count: 6 - xy.count))
+                }
+            }
+        }
+        
+        ///
+        mutating func append(_ doubles: [Double]) {
+            self.data += doubles.map { $0.bitPattern }
+        }
+        
+        /// The index of `key` in the keys section, adding it if needed.
+        mutating func intern(_ key: String) -> UInt32 {
+            if let i = self.keyIndex[key] {
+                return i
+            }
+            let i = UInt32(self.keys.count)
+            self.keys.append(key)
+            self.keyIndex[key] = i
+            return i
+        }
+        
+        /// The package's bytes.
+        func encoded() -> Data {
+            var out = Data(count: Markup.Package.headerSize)
+            var header = [UInt32](repeating: 0, count: Markup.Package.headerSize / 4)
+            header[0] = Markup.Package.magic
+            header[1] = Markup.Package.version
+            
+            let words = { (w: [UInt32]) -> Data in
+                w.map { $0.littleEndian }.withUnsafeBufferPointer { Data(buffer: $0) }
+            }
+            let section = { (s: Markup.Package.Section, count: Int, bytes: Data) in
+                out.append(Data(count: (8 - out.count % 8) % 8))
+                header[2 + s.rawValue * 2] = UInt32(out.count)
+                header[3 + s.rawValue * 2] = UInt32(count)
+                out.append(bytes)
+            }
+            
+            var strings = Data(), table = [UInt32]()
+            for k in self.keys {
+                let utf8 = Data(k.utf8)
+                table += [UInt32(strings.count), UInt32(utf8.count)]
+                strings.append(utf8)
+            }
+            section(.layers, self.layers.count / 8, words(self.layers))
+            section(.animations, self.animations.count / 4, words(self.animations))
+            section(.properties, self.properties.count / 4, words(self.properties))
+            section(.keys, self.keys.count, words(table))
+            section(.strings, strings.count, strings)
+            section(.data, self.data.count, self.data.map { $0.littleEndian }.withUnsafeBufferPointer {
+                Data(buffer: $0)
+            })
+            
+            // Images follow their table, which is written once their offsets are known:
+            var offset = (out.count + 7) / 8 * 8 + self.images.count * 8
+            var images = [UInt32]()
+            for image in self.images {
+                offset = (offset + 7) / 8 * 8
+                images += [UInt32(offset), UInt32(image.count)]
+                offset += image.count
+            }
+            section(.images, self.images.count, words(images))
+            for image in self.images {
+                out.append(Data(count: (8 - out.count % 8) % 8))
+                out.append(image)
+            }
+            
+            out.replaceSubrange(0..<Markup.Package.headerSize, with: words(header))
+            return out
+        }
+    }
+}
@@ -5,6 +5,59 @@ import Metal
 /// rendering context.
 public final class Renderer {
     
+    /// A summary of the frames most recently rendered by a `Renderer`.
+    ///
+    /// Times are measured on the CPU from the start of building a frame to the
+    /// end of its encoding, and on the GPU from the start to the end of its
+    /// command buffer. Counts are the mean per frame (see `Trace.Counter`), and
+    /// include the work done on any thread since the previous frame, such as
+    /// textures loaded in the background.
+    public struct Statistics {
+        
+        /// The number of frames summarized.
+        public fileprivate(set) var frames: Int = 0
+        
+        ///
+        public fileprivate(set) var meanEncodeTime: TimeInterval = 0.0
+        
+        ///
+        public fileprivate(set) var maxEncodeTime: TimeInterval = 0.0
+        
+        /// The mean GPU time; zero where GPU timestamps are unavailable.
+        public fileprivate(set) var meanGPUTime: TimeInterval = 0.0
+        
+        ///
+        public fileprivate(set) var maxGPUTime: TimeInterval = 0.0
+        
+        ///
+        public fileprivate(set) var layersVisited: Double = 0.0
+        
+        ///
+        public fileprivate(set) var opsEmitted: Double = 0.0
+        
+        ///
+        public fileprivate(set) var offscreenPasses: Double = 0.0
+        
+        ///
+        public fileprivate(set) var textureAllocations: Double = 0.0
+        
+        ///
+        public fileprivate(set) var bytesUploaded: Double = 0.0
+        
+        ///
+        public fileprivate(set) var drawCalls: Double = 0.0
+    }
+    
+    /// The measurements of a single rendered frame.
+    private struct Frame {
+        let encodeTime: TimeInterval
+        let gpuTime: TimeInterval
+        let counters: Trace.Counters
+    }
+    
+    /// The number of frames summarized by `statistics`.
+    private static let statisticsWindow = 120
+    
     /// The possible phases a `Renderer` can be in.
     private enum Phase {
         
@@ -66,6 +119,7 @@ public final class Renderer {
             self.viewport.1 = .orthographic(left: 0, right: Float(self.bounds.width),
                                             bottom: 0, top: Float(self.bounds.height),
                                             zNear: -1.0, zFar: 1.0)
+            self.globalNode = nil
         }
     }
     
@@ -75,12 +129,29 @@ public final class Renderer {
     /// The origin frame time for the current frame pass.
     private var frameTime: TimeInterval = 0.0
     
+    /// The origin frame time of the most recently begun frame pass.
+    private var lastFrameTime: TimeInterval = -.infinity
+    
+    /// The `Context.seed` of the layer tree drawn by the most recent frame pass.
+    private var renderedSeed: UInt64? = nil
+    
+    /// The `Render.Image.Cache.generation` when the most recent frame pass began.
+    private var renderedImages: UInt64 = 0
+    
+    /// The `Render.ImageQueue.generation` when the most recent frame pass began.
+    private var renderedQueues: UInt64 = 0
+    
     /// The region to update in the next frame pass.
     private var updateShape: Shape = .empty
     
     /// The viewport and projection matrix (MVP) for rendering; dependent on `bounds`.
     private var viewport = (MTLViewport(), Transform3D.identity)
     
+    /// The `GlobalNode` buffer shared by all frames rendered with `viewport`.
+    /// It is replaced, not modified, when the viewport changes, as prior frames
+    /// may still be in flight.
+    private var globalNode: (buffer: MTLBuffer, width: Int, height: Int)? = nil
+    
     /// The per-frame render semaphore that synchronizes each frame render.
     private var semaphore: DispatchSemaphore
     
@@ -96,6 +167,19 @@ public final class Renderer {
     /// The pipeline used by rendering operations.
     private var pipeline: RenderOp.State.Pipeline
     
+    /// The most recent `statisticsWindow` frames, as a ring.
+    private var frames: [Frame] = []
+    
+    /// The index in `frames` of the next frame to be recorded.
+    private var nextFrame = 0
+    
+    /// The `Trace.counters` at the end of encoding the most recent frame.
+    private var countedTotals = Trace.counters
+    
+    /// Guards `frames`, which are recorded on completion of each frame, and
+    /// `countedTotals`.
+    private let framesLock = Lock()
+    
     /// Create a new `Renderer` with the given `device`.
     public required init(_ device: MTLDevice) {
         self.semaphore = DispatchSemaphore(value: 1)
@@ -115,7 +199,12 @@ public final class Renderer {
         assert(self.phase == .ended, "Cannot begin a new frame with phase \(self.phase)!")
         
         // Perform actions:
+        Trace.begin("Renderer.frame")
         self.frameTime = t
+        self.lastFrameTime = t
+        self.renderedSeed = self.context?.seed
+        self.renderedImages = Render.Image.Cache.shared.generation
+        self.renderedQueues = Render.ImageQueue.generation
         // add self.layer.context to update list
         
         // Set new phase:
@@ -130,17 +219,28 @@ public final class Renderer {
         
         let frameTime = self.frameTime // local shadow
         let output = self.renderTarget! // local shadow
+        let outputSize = MTLSize(width: output.width, height: output.height, depth: output.depth)
+        let scale = self.bounds.width > 0.0 ? CGFloat(output.width) / self.bounds.width : 1.0
+        let reuseGlobal = self.globalNode.map {
+            $0.width == output.width && $0.height == output.height &&
+            $0.buffer.device.registryID == self.device.registryID
+        } ?? false
+        if !reuseGlobal {
+            self.globalNode = (RenderOp.State.globalNode(self.device, self.viewport.1.m, outputSize),
+                               output.width, output.height)
+        }
+        let globalNode = self.globalNode!.buffer // local shadow
         
         // Wait for prior render pass first, then queue the current one:
         _ = self.semaphore.wait(timeout: .now() + .milliseconds(16))
         self.dispatch.async {
             
             // Create a command buffer and begin asynchronous encoding:
+            Trace.begin("Renderer.render")
+            let start = CurrentMediaTime()
             let commandBuffer = self.queue.makeCommandBuffer()!
             commandBuffer.enqueue()
-            let texSize = MTLSize(width: output.width,
-                                  height: output.height,
-                                  depth: output.depth)
+            let texSize = outputSize
             
             // Encodes the drawing commands for the `layer` and its sublayers, returning
             // an `MTLTexture` containing the rendered output.
@@ -151,11 +251,17 @@ public final class Renderer {
             // TODO: `LayerNode(from:at:)` is absurdly slow! About ~0.5ms per conversion!
             // TODO: Don't recreate the buffer each time in RenderOp!
             //
-            let op = RenderOp(for: self.layer!, with: self.device, size: texSize) {
-                $0.displayIfNeeded() // TODO!
-                return LayerNode(from: $0, at: frameTime)
+            let op = Trace.scope("RenderOp.init") {
+                RenderOp(for: self.layer!, with: self.device, size: texSize, scale: scale,
+                         at: frameTime) {
+                    $0.displayIfNeeded() // TODO!
+                    return LayerNode(from: $0, at: frameTime, transforms: &$1)
+                }
+            }
+            Trace.scope("RenderOp.perform") {
+                op.perform(RenderOp.State(commandBuffer, self.ciContext, self.pipeline,
+                                          self.viewport.1.m, texSize, globalBuffer: globalNode))
             }
-            op.perform(RenderOp.State(commandBuffer, self.ciContext, self.pipeline, self.viewport.1.m))
             
             // Blit from the current texture into the render target:
             let blit = commandBuffer.makeBlitCommandEncoder()!
@@ -172,10 +278,23 @@ public final class Renderer {
             commandBuffer.addScheduledHandler { _ in
                 scheduledHandler()
             }
-            commandBuffer.addCompletedHandler { _ in
+            let counters = self.framesLock.whileLocked { () -> Trace.Counters in
+                let totals = Trace.counters
+                defer { self.countedTotals = totals }
+                return totals - self.countedTotals
+            }
+            let frame = (encodeTime: CurrentMediaTime() - start, counters: counters)
+            commandBuffer.addCompletedHandler { b in
+                var gpuTime = 0.0
+                if #available(macOS 10.15, *) {
+                    gpuTime = b.gpuEndTime - b.gpuStartTime
+                }
+                self.record(Frame(encodeTime: frame.encodeTime, gpuTime: gpuTime,
+                                  counters: frame.counters))
                 self.semaphore.signal()
             }
             commandBuffer.commit()
+            Trace.end("Renderer.render")
         }
         
         // Set new phase:
@@ -191,11 +310,52 @@ public final class Renderer {
         // Perform actions:
         self.updateShape.components = [] // clear
         self.frameTime = 0.0
+        Trace.end("Renderer.frame")
         
         // Set new phase:
         self.phase = .ended
     }
     
+    /// A summary of the most recently completed frames.
+    public var statistics: Statistics {
+        let frames = self.framesLock.whileLocked { self.frames }
+        var s = Statistics()
+        guard frames.count > 0 else { return s }
+        
+        let n = Double(frames.count)
+        let mean = { (c: Trace.Counter) in Double(frames.map { $0.counters[c] }.reduce(0, +)) / n }
+        s.frames = frames.count
+        s.meanEncodeTime = frames.map { $0.encodeTime }.reduce(0.0, +) / n
+        s.maxEncodeTime = frames.map { $0.encodeTime }.max()!
+        s.meanGPUTime = frames.map { $0.gpuTime }.reduce(0.0, +) / n
+        s.maxGPUTime = frames.map { $0.gpuTime }.max()!
+        s.layersVisited = mean(.layersVisited)
+        s.opsEmitted = mean(.opsEmitted)
+        s.offscreenPasses = mean(.offscreenPasses)
+        s.textureAllocations = mean(.textureAllocations)
+        s.bytesUploaded = mean(.bytesUploaded)
+        s.drawCalls = mean(.drawCalls)
+        return s
+    }
+    
+    /// The trace events recorded by all renderers, in the Chrome trace event
+    /// format. Scopes are only recorded in builds with the `TRACE` condition.
+    public static func exportTrace() throws -> Data {
+        return try Trace.export()
+    }
+    
+    /// Adds the `frame` to the ring of recent frames.
+    private func record(_ frame: Frame) {
+        self.framesLock.whileLocked {
+            if self.frames.count < Renderer.statisticsWindow {
+                self.frames.append(frame)
+            } else {
+                self.frames[self.nextFrame] = frame
+            }
+            self.nextFrame = (self.nextFrame + 1) % Renderer.statisticsWindow
+        }
+    }
+    
     /// Returns the bounds of the update region that contains all pixels that
     /// will be rendered by the current frame.
     public var updateBounds: CGRect {
@@ -211,7 +371,33 @@ public final class Renderer {
     /// needs to be scheduled yet. If nextFrameTime is the current frame time,
     /// a continuous animation is running and an update should be scheduled after
     /// an appropriate delay.
+    ///
+    /// A commit to the layer tree since the last frame, an image that has
+    /// finished loading since, or an image inserted into an asynchronous image
+    /// queue since, must be drawn at once, so the last frame time is returned. Otherwise, the earliest time any animation changes the tree
+    /// is predicted from the animations' timing.
     public func nextFrameTime() -> TimeInterval {
-        return .infinity
+        guard let layer = self.layer, let context = self.context else { return .infinity }
+        if self.renderedSeed != context.seed ||
+            self.renderedImages != Render.Image.Cache.shared.generation ||
+            self.renderedQueues != Render.ImageQueue.generation
+        {
+            return max(self.lastFrameTime, 0.0)
+        }
+        return layer.nextAnimationTime(after: self.lastFrameTime).time
+    }
+    
+    /// The number of display refreshes of length `period` that each frame may
+    /// be shown for, up to `maximum`, such that every running animation is
+    /// still drawn at least as often as its `frameInterval`. Animations with a
+    /// `frameInterval` of zero are drawn on every refresh.
+    public func refreshDivisor(forPeriod period: TimeInterval, maximum: Int = 4) -> Int {
+        guard let layer = self.layer, period > 0.0 else { return 1 }
+        let interval = layer.nextAnimationTime(after: self.lastFrameTime).interval
+        guard interval.isFinite else { return 1 }
+        
+        // Allow for jitter in the measured refresh period:
+        let divisor = Int((interval / period + 0.01).rounded(.down))
+        return min(max(divisor, 1), maximum)
     }
 }
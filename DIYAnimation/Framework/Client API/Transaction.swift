@@ -188,9 +188,10 @@ public final class Transaction: Hashable {
     
     // TODO: values should search the nested scope's parents!!
     
-    /// The animation duration used by all animations within this transaction group.
+    /// The animation duration used by all animations within this transaction
+    /// group that have none of their own. Defaults to 0.25 seconds.
     public class var animationDuration: TimeInterval {
-        get { return Transaction.ensure().values.animationDuration! }
+        get { return Transaction.ensure().values.animationDuration ?? 0.25 }
         set { Transaction.ensure().values.animationDuration = newValue }
     }
     
@@ -203,7 +204,7 @@ public final class Transaction: Hashable {
     /// Whether actions triggered as a result of property changes made within
     /// this transaction group are suppressed.
     public class var disableActions: Bool {
-        get { return Transaction.ensure().values.disableActions! }
+        get { return Transaction.ensure().values.disableActions ?? false }
         set { Transaction.ensure().values.disableActions = newValue }
     }
     
@@ -16,7 +16,7 @@ public final class DisplayLink {
 	private var modes: Set<RunLoop.Mode> = []
     
     /// The current timestamp of the display frame associated with the most
-    /// recent target invocation.
+    /// recent target invocation, in the timebase of `CurrentMediaTime()`.
     public private(set) var timestamp: CFTimeInterval = 0.0
     
     /// The current duration of the display frame associated with the most
@@ -28,7 +28,7 @@ public final class DisplayLink {
     
     /// When `true` the object is prevented from firing.
     public var isPaused: Bool {
-        get { return CVDisplayLinkIsRunning(self.displayLink!) }
+        get { return !CVDisplayLinkIsRunning(self.displayLink!) }
         set { CVDisplayLinkSetPaused(self.displayLink!, newValue) }
     }
     
@@ -114,9 +114,8 @@ public final class DisplayLink {
             self.duration = 1.0 / ((outputTime.pointee.rateScalar *
                 Double(outputTime.pointee.videoTimeScale) /
                 Double(outputTime.pointee.videoRefreshPeriod)))
-            self.timestamp = Double(nowTime.pointee.videoTime) /
-                Double(nowTime.pointee.videoTimeScale)
-            self.targetTimestamp = self.timestamp + self.duration
+            self.timestamp = TimeWithHostTime(nowTime.pointee.hostTime)
+            self.targetTimestamp = TimeWithHostTime(outputTime.pointee.hostTime)
             
             // Execute on our runloop and return:
             self.runloop?.perform(inModes: self.modes.map{$0}, block: self.action)
@@ -1,9 +1,496 @@
+import Foundation
 import CoreGraphics.CGPath
 
 /// Uses a scan rasterization technique to convert a `CGPath` into a renderable
-/// shape. Maintains a grid for tiled rasterization requests.
+/// shape. Curves are adaptively flattened once into polylines (see `Flattening`),
+/// which are then either accumulated into a coverage `Mask` on the CPU, or
+/// tessellated into triangles for the GPU (see `PathTessellator`).
 internal struct PathRasterizer {
     
-    // TODO
+    /// The maximum distance between a curve and its flattening, in pixels.
+    internal static let tolerance: CGFloat = 0.25
     
+    /// Returns the flattening tolerance, in path units, of a path drawn at `scale`
+    /// pixels per unit. The scale is rounded up to a power of two so that a
+    /// gradual zoom does not defeat any caching of the flattening.
+    internal static func tolerance(forScale scale: CGFloat) -> CGFloat {
+        let s = max(scale, 1.0 / 64.0)
+        return PathRasterizer.tolerance / pow(2.0, ceil(log2(s)))
+    }
+    
+    /// Identifies a `CGPath` by its contents: paths with identical elements
+    /// share a key, regardless of their identity. The key holds an immutable
+    /// copy of the path, so that mutating the original does not change it.
+    internal struct Key: Hashable {
+        
+        ///
+        internal let path: CGPath
+        
+        ///
+        private let hash: Int
+        
+        ///
+        internal init(_ path: CGPath) {
+            var hasher = Hasher()
+            path.applyWithBlock { e in
+                let el = e.pointee
+                hasher.combine(el.type.rawValue)
+                for i in 0..<el.type.pointCount {
+                    hasher.combine(el.points[i].x)
+                    hasher.combine(el.points[i].y)
+                }
+            }
+            self.path = path.copy()!
+            self.hash = hasher.finalize()
+        }
+        
+        ///
+        internal func hash(into hasher: inout Hasher) {
+            hasher.combine(self.hash)
+        }
+        
+        ///
+        internal static func ==(_ lhs: Key, _ rhs: Key) -> Bool {
+            return lhs.hash == rhs.hash && lhs.path == rhs.path
+        }
+    }
+    
+    /// The parameters used to stroke a path, mirroring `ShapeLayer`.
+    internal struct StrokeStyle: Hashable {
+        internal var lineWidth: CGFloat = 1.0
+        internal var lineCap: CGLineCap = .butt
+        internal var lineJoin: CGLineJoin = .miter
+        internal var miterLimit: CGFloat = 10.0
+        internal var dashPhase: CGFloat = 0.0
+        internal var dashPattern: [CGFloat] = []
+    }
+    
+    /// A path flattened into polylines. The cumulative arc length is kept at each
+    /// point, so that the path may be trimmed (i.e. `strokeStart`/`strokeEnd`)
+    /// without flattening it again.
+    internal struct Flattening {
+        
+        ///
+        internal struct Subpath {
+            
+            ///
+            internal var points: [CGPoint] = []
+            
+            /// The arc length from the start of the path to each point.
+            internal var lengths: [CGFloat] = []
+            
+            ///
+            internal var isClosed: Bool = false
+            
+            /// The point at the arc length `l` along the segment ending at index `i`.
+            fileprivate func point(_ i: Int, at l: CGFloat) -> CGPoint {
+                let l0 = self.lengths[i - 1], l1 = self.lengths[i]
+                let t = l1 > l0 ? (l - l0) / (l1 - l0) : 0.0
+                let p0 = self.points[i - 1], p1 = self.points[i]
+                return CGPoint(x: p0.x + (p1.x - p0.x) * t, y: p0.y + (p1.y - p0.y) * t)
+            }
+        }
+        
+        ///
+        internal private(set) var subpaths: [Subpath] = []
+        
+        /// The total arc length of all subpaths.
+        internal var length: CGFloat {
+            return self.subpaths.last?.lengths.last ?? 0.0
+        }
+        
+        ///
+        internal init() {}
+        
+        /// Flattens the `path` such that no segment strays from its curve by more
+        /// than `tolerance`. The number of segments of each curve is selected up
+        /// front from its control polygon (Wang's formula), so no recursion is
+        /// needed and straight lines are never subdivided.
+        internal init(_ path: CGPath, tolerance: CGFloat = PathRasterizer.tolerance) {
+            var subpaths: [Subpath] = []
+            var current = Subpath()
+            var origin = CGPoint.zero
+            var total: CGFloat = 0.0
+            
+            func add(_ p: CGPoint) {
+                if let last = current.points.last {
+                    guard last != p else { return }
+                    total += last.distance(to: p)
+                }
+                current.points.append(p)
+                current.lengths.append(total)
+            }
+            func finish() {
+                if current.points.count > 1 {
+                    subpaths.append(current)
+                }
+                current = Subpath()
+            }
+            func segments(_ dd: CGFloat, _ degree: CGFloat) -> Int {
+                let n = (degree * (degree - 1.0) * dd / (8.0 * max(tolerance, 1e-4))).squareRoot()
+                return min(max(Int(n.rounded(.up)), 1), 256)
+            }
+            
+            path.applyWithBlock { e in
+                let el = e.pointee
+                if el.type != .moveToPoint && current.points.isEmpty {
+                    add(origin)
+                }
+                switch el.type {
+                case .moveToPoint:
+                    finish()
+                    origin = el.points[0]
+                    add(origin)
+                case .addLineToPoint:
+                    add(el.points[0])
+                case .addQuadCurveToPoint:
+                    let p0 = current.points.last!, p1 = el.points[0], p2 = el.points[1]
+                    let dd = CGPoint(x: p0.x - 2 * p1.x + p2.x, y: p0.y - 2 * p1.y + p2.y)
+                    let n = segments(dd.distance(), 2.0)
+                    for i in 1...n {
+                        let t = CGFloat(i) / CGFloat(n), u = 1.0 - t
+                        add(CGPoint(x: u * u * p0.x + 2 * u * t * p1.x + t * t * p2.x,
+                                    y: u * u * p0.y + 2 * u * t * p1.y + t * t * p2.y))
+                    }
+                case .addCurveToPoint:
+                    let p0 = current.points.last!, p1 = el.points[0]
+                    let p2 = el.points[1], p3 = el.points[2]
+                    let d1 = CGPoint(x: p0.x - 2 * p1.x + p2.x, y: p0.y - 2 * p1.y + p2.y)
+                    let d2 = CGPoint(x: p1.x - 2 * p2.x + p3.x, y: p1.y - 2 * p2.y + p3.y)
+                    let n = segments(max(d1.distance(), d2.distance()), 3.0)
+                    for i in 1...n {
+                        let t = CGFloat(i) / CGFloat(n), u = 1.0 - t
+                        let a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t, d = t * t * t
+                        add(CGPoint(x: a * p0.x + b * p1.x + c * p2.x + d * p3.x,
+                                    y: a * p0.y + b * p1.y + c * p2.y + d * p3.y))
+                    }
+                case .closeSubpath:
+                    add(origin)
+                    current.isClosed = true
+                    finish()
+                @unknown default:
+                    break
+                }
+            }
+            finish()
+            self.subpaths = subpaths
+        }
+        
+        /// Returns the portion of the receiver between the fractions `start` and
+        /// `end` of its total length. Trimmed subpaths are no longer closed.
+        internal func trimmed(from start: CGFloat, to end: CGFloat) -> Flattening {
+            let total = self.length
+            let a = max(min(start, end), 0.0) * total
+            let b = min(max(start, end), 1.0) * total
+            guard a > 0.0 || b < total else { return self }
+            
+            var result = Flattening()
+            for s in self.subpaths where s.lengths.last! > a && s.lengths.first! < b {
+                var out = Subpath()
+                for i in 1..<s.points.count where s.lengths[i] >= a && s.lengths[i - 1] <= b {
+                    if out.points.isEmpty {
+                        let l = max(s.lengths[i - 1], a)
+                        out.points.append(s.point(i, at: l))
+                        out.lengths.append(l)
+                    }
+                    let l = min(s.lengths[i], b)
+                    out.points.append(s.point(i, at: l))
+                    out.lengths.append(l)
+                }
+                out.isClosed = s.isClosed && s.lengths.first! >= a && s.lengths.last! <= b
+                if out.points.count > 1 {
+                    result.subpaths.append(out)
+                }
+            }
+            return result
+        }
+        
+        /// Returns the dashes of the receiver as open subpaths, restarting the
+        /// `pattern` at `phase` for each subpath. Each point keeps its arc length
+        /// along the receiver.
+        internal func dashed(phase: CGFloat, pattern: [CGFloat]) -> Flattening {
+            let period = pattern.reduce(0.0, +)
+            guard period > 0.0 && !pattern.contains(where: { $0 < 0.0 }) else { return self }
+            
+            var result = Flattening()
+            for s in self.subpaths {
+                var out = Subpath()
+                func finish() {
+                    if out.points.count > 1 {
+                        result.subpaths.append(out)
+                    }
+                    out = Subpath()
+                }
+                
+                // Find the dash within which the subpath starts:
+                var i = 0
+                var remaining = phase.truncatingRemainder(dividingBy: period)
+                if remaining < 0.0 {
+                    remaining += period
+                }
+                while remaining >= pattern[i] {
+                    remaining -= pattern[i]
+                    i = (i + 1) % pattern.count
+                }
+                remaining = pattern[i] - remaining
+                if i % 2 == 0 {
+                    out.points.append(s.points[0])
+                    out.lengths.append(s.lengths[0])
+                }
+                
+                // Walk each segment, toggling the dash at every boundary crossed:
+                for j in 1..<s.points.count {
+                    var l = s.lengths[j - 1]
+                    while s.lengths[j] - l > remaining {
+                        l += remaining
+                        out.points.append(s.point(j, at: l))
+                        out.lengths.append(l)
+                        if i % 2 == 0 {
+                            finish()
+                        }
+                        i = (i + 1) % pattern.count
+                        remaining = pattern[i]
+                    }
+                    remaining -= s.lengths[j] - l
+                    if i % 2 == 0 {
+                        out.points.append(s.points[j])
+                        out.lengths.append(s.lengths[j])
+                    }
+                }
+                finish()
+            }
+            return result
+        }
+        
+        /// Returns the outline of the stroke of the receiver as a new flattening,
+        /// whose nonzero fill is the stroke.
+        internal func stroked(_ style: StrokeStyle,
+                              tolerance: CGFloat = PathRasterizer.tolerance) -> Flattening
+        {
+            var path = self.path
+            if style.dashPattern.count > 0 {
+                path = path.copy(dashingWithPhase: style.dashPhase, lengths: style.dashPattern)
+            }
+            path = path.copy(strokingWithWidth: style.lineWidth, lineCap: style.lineCap,
+                             lineJoin: style.lineJoin, miterLimit: style.miterLimit)
+            return Flattening(path, tolerance: tolerance)
+        }
+        
+        /// The polylines of the receiver as a `CGPath`.
+        internal var path: CGPath {
+            let path = CGMutablePath()
+            for s in self.subpaths {
+                path.addLines(between: s.isClosed ? Array(s.points.dropLast()) : s.points)
+                if s.isClosed {
+                    path.closeSubpath()
+                }
+            }
+            return path
+        }
+        
+        /// The smallest rectangle containing all points of the receiver.
+        internal var boundingBox: CGRect {
+            var r = CGRect.null
+            for s in self.subpaths {
+                for p in s.points {
+                    r = r.union(CGRect(origin: p, size: .zero))
+                }
+            }
+            return r
+        }
+        
+        /// Invokes `body` for every edge of the receiver when filled, that is,
+        /// with every subpath implicitly closed.
+        internal func forEachEdge(_ body: (CGPoint, CGPoint) -> ()) {
+            for s in self.subpaths {
+                for i in 1..<s.points.count {
+                    body(s.points[i - 1], s.points[i])
+                }
+                if !s.isClosed, let first = s.points.first, let last = s.points.last, first != last {
+                    body(last, first)
+                }
+            }
+        }
+    }
+    
+    /// An 8-bit coverage mask, stored in rows from the top.
+    internal struct Mask {
+        
+        ///
+        internal let width: Int
+        
+        ///
+        internal let height: Int
+        
+        ///
+        internal var data: [UInt8]
+        
+        /// The mask as a `DeviceGray` image, suitable for `CGContext.clip(to:mask:)`.
+        internal var image: CGImage? {
+            guard let provider = CGDataProvider(data: Data(self.data) as CFData) else {
+                return nil
+            }
+            return CGImage(width: self.width, height: self.height,
+                           bitsPerComponent: 8, bitsPerPixel: 8, bytesPerRow: self.width,
+                           space: CGColorSpaceCreateDeviceGray(),
+                           bitmapInfo: CGBitmapInfo(rawValue: CGImageAlphaInfo.none.rawValue),
+                           provider: provider, decode: nil, shouldInterpolate: false,
+                           intent: .defaultIntent)
+        }
+    }
+    
+    /// Rasterizes the fill of `flattening` into a `width` by `height` coverage
+    /// mask, after applying `transform` (into pixels, with the y-axis down).
+    ///
+    /// Each edge deposits the exact signed area it covers in each pixel into an
+    /// accumulation buffer, and the coverage of a pixel is then the running sum
+    /// of its row up to that pixel. There are no samples, so the anti-aliasing
+    /// is exact for paths that do not overlap themselves.
+    internal static func rasterize(_ flattening: Flattening, width: Int, height: Int,
+                                   transform: CGAffineTransform = .identity,
+                                   rule: CGPathFillRule = .winding) -> Mask
+    {
+        var mask = Mask(width: width, height: height,
+                        data: [UInt8](repeating: 0, count: width * height))
+        guard width > 0 && height > 0 else { return mask }
+        
+        // Edges are clamped horizontally to the mask, and may write up to two
+        // columns past its right side:
+        let stride = width + 2
+        var acc = [Float](repeating: 0.0, count: stride * height)
+        flattening.forEachEdge { a, b in
+            let p0 = a.applying(transform), p1 = b.applying(transform)
+            PathRasterizer.accumulate(&acc, stride, width, height,
+                                      SIMD2<Float>(Float(p0.x), Float(p0.y)),
+                                      SIMD2<Float>(Float(p1.x), Float(p1.y)))
+        }
+        
+        // Resolve the running sums eight pixels at a time:
+        let evenOdd = rule == .evenOdd
+        acc.withUnsafeBufferPointer { a in
+            mask.data.withUnsafeMutableBufferPointer { m in
+                for y in 0..<height {
+                    let row = y * stride, out = y * width
+                    var carry: Float = 0.0
+                    var x = 0
+                    while x + 8 <= width {
+                        let i = row + x
+                        var v = SIMD8<Float>(a[i], a[i + 1], a[i + 2], a[i + 3],
+                                             a[i + 4], a[i + 5], a[i + 6], a[i + 7])
+                        v += PathRasterizer.shifted(v, by: 1)
+                        v += PathRasterizer.shifted(v, by: 2)
+                        v += PathRasterizer.shifted(v, by: 4)
+                        v += SIMD8<Float>(repeating: carry)
+                        carry = v[7]
+                        
+                        let c = PathRasterizer.coverage(v, evenOdd) * 255.0
+                        let u = SIMD8<UInt8>(c, rounding: .toNearestOrEven)
+                        for j in 0..<8 {
+                            m[out + x + j] = u[j]
+                        }
+                        x += 8
+                    }
+                    while x < width {
+                        carry += a[row + x]
+                        let c = PathRasterizer.coverage(SIMD8<Float>(repeating: carry), evenOdd)
+                        m[out + x] = UInt8((c[0] * 255.0).rounded())
+                        x += 1
+                    }
+                }
+            }
+        }
+        return mask
+    }
+    
+    /// Deposits the signed area covered by the edge `p0`-`p1` into `acc`.
+    private static func accumulate(_ acc: inout [Float], _ stride: Int,
+                                   _ width: Int, _ height: Int,
+                                   _ p0: SIMD2<Float>, _ p1: SIMD2<Float>)
+    {
+        guard p0.y != p1.y else { return }
+        let (dir, a, b) = p0.y < p1.y ? (Float(1.0), p0, p1) : (Float(-1.0), p1, p0)
+        let dxdy = (b.x - a.x) / (b.y - a.y)
+        let w = Float(width)
+        var x = a.x
+        if a.y < 0.0 {
+            x -= a.y * dxdy
+        }
+        let y0 = max(Int(a.y), 0), y1 = min(Int(b.y.rounded(.up)), height)
+        guard y0 < y1 else { return }
+        
+        for y in y0..<y1 {
+            let row = y * stride
+            let dy = min(Float(y + 1), b.y) - max(Float(y), a.y)
+            let xnext = x + dxdy * dy
+            let d = dy * dir
+            let x0 = min(max(min(x, xnext), 0.0), w)
+            let x1 = min(max(max(x, xnext), 0.0), w)
+            let x0floor = x0.rounded(.down), x1ceil = x1.rounded(.up)
+            let x0i = Int(x0floor), x1i = Int(x1ceil)
+            
+            if x1i <= x0i + 1 {
+                // The edge lies within a single pixel of this row:
+                let xmf = 0.5 * (x0 + x1) - x0floor
+                acc[row + x0i] += d - d * xmf
+                acc[row + x0i + 1] += d * xmf
+            } else {
+                // The edge spans several pixels; the first and last are covered
+                // by a triangle, and those between by a linear ramp:
+                let s = 1.0 / (x1 - x0)
+                let x0f = x0 - x0floor
+                let a0 = 0.5 * s * (1.0 - x0f) * (1.0 - x0f)
+                let x1f = x1 - x1ceil + 1.0
+                let am = 0.5 * s * x1f * x1f
+                acc[row + x0i] += d * a0
+                if x1i == x0i + 2 {
+                    acc[row + x0i + 1] += d * (1.0 - a0 - am)
+                } else {
+                    let a1 = s * (1.5 - x0f)
+                    acc[row + x0i + 1] += d * (a1 - a0)
+                    for xi in (x0i + 2)..<(x1i - 1) {
+                        acc[row + xi] += d * s
+                    }
+                    let a2 = a1 + Float(x1i - x0i - 3) * s
+                    acc[row + x1i - 1] += d * (1.0 - a2 - am)
+                }
+                acc[row + x1i] += d * am
+            }
+            x = xnext
+        }
+    }
+    
+    /// Shifts the lanes of `v` up by `n`, filling the lowest lanes with zero.
+    @inline(__always)
+    private static func shifted(_ v: SIMD8<Float>, by n: Int) -> SIMD8<Float> {
+        var r = SIMD8<Float>()
+        for i in n..<8 {
+            r[i] = v[i - n]
+        }
+        return r
+    }
+    
+    /// Converts accumulated winding areas into coverage for the fill rule.
+    @inline(__always)
+    private static func coverage(_ v: SIMD8<Float>, _ evenOdd: Bool) -> SIMD8<Float> {
+        let one = SIMD8<Float>(repeating: 1.0)
+        let a = pointwiseMax(v, -v)
+        guard evenOdd else { return pointwiseMin(a, one) }
+        let t = a - 2.0 * (a * 0.5).rounded(.down)
+        return pointwiseMin(t, 2.0 - t)
+    }
+}
+
+internal extension CGPathElementType {
+    
+    /// The number of points held by an element of this type.
+    var pointCount: Int {
+        switch self {
+        case .moveToPoint: return 1
+        case .addLineToPoint: return 1
+        case .addQuadCurveToPoint: return 2
+        case .addCurveToPoint: return 3
+        case .closeSubpath: return 0
+        @unknown default: return 0
+        }
+    }
 }
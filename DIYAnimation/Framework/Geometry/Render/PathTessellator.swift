@@ -0,0 +1,329 @@
+import Foundation
+import CoreGraphics.CGPath
+
+/// Tessellates the fill of a flattened path into a triangle list drawn by the
+/// `shape_emit_mesh` shader, so that a shape is rasterized by the GPU alone.
+///
+/// The fill is decomposed into trapezoids between each consecutive pair of
+/// vertex (or edge intersection) heights, so any fill rule, hole, or
+/// self-intersection is handled without a stencil pass. Every boundary of the
+/// fill is then fringed by a quad that the shader extrudes outward by one pixel,
+/// whose coverage falls from one to zero, for anti-aliasing at any scale.
+///
+/// A stroke may instead be tessellated segment by segment, keeping the arc
+/// length of each vertex along the path, so that the shader may trim it.
+internal struct PathTessellator {
+    
+    /// A straight edge of the path, oriented by increasing y.
+    private struct Edge {
+        let p0: CGPoint
+        let p1: CGPoint
+        let winding: Int
+        
+        func x(at y: CGFloat) -> CGFloat {
+            return self.p0.x + (self.p1.x - self.p0.x) * (y - self.p0.y) / (self.p1.y - self.p0.y)
+        }
+    }
+    
+    /// A horizontal interval of the fill.
+    private typealias Span = (CGFloat, CGFloat)
+    
+    /// The tessellated triangle list.
+    internal private(set) var vertices: [ShapeVertex] = []
+    
+    /// Tessellates the fill of the `flattening` with the fill `rule`.
+    internal init(fill flattening: PathRasterizer.Flattening, rule: CGPathFillRule) {
+        var edges = [Edge]()
+        flattening.forEachEdge { a, b in
+            guard a.y != b.y else { return }
+            edges.append(a.y < b.y ? Edge(p0: a, p1: b, winding: 1) :
+                                     Edge(p0: b, p1: a, winding: -1))
+        }
+        guard edges.count > 0 else { return }
+        edges.sort { $0.p0.y < $1.p0.y }
+        let ys = Set(edges.flatMap { [$0.p0.y, $0.p1.y] }).sorted()
+        
+        // Sweep each band between vertex heights; every active edge spans the
+        // entire band, as no vertex lies within it.
+        var active = [Edge]()
+        var next = 0
+        var previous = [Span]()
+        for (ya, yb) in zip(ys, ys.dropFirst()) {
+            active.removeAll { $0.p1.y <= ya }
+            while next < edges.count && edges[next].p0.y <= ya {
+                active.append(edges[next])
+                next += 1
+            }
+            var y = ya
+            while y < yb {
+                y = self.sweep(active, from: y, to: yb, rule, &previous)
+            }
+        }
+        for s in previous {
+            self.fringe(CGPoint(x: s.1, y: ys.last!), CGPoint(x: s.0, y: ys.last!),
+                        CGPoint(x: 0, y: 1))
+        }
+    }
+    
+    /// Tessellates the stroke of the `flattening` with the `style` into a quad
+    /// per segment, a wedge at each join, and a cap at each open end. Every
+    /// vertex keeps its arc length along the `flattening`, so the stroke may be
+    /// trimmed (`strokeStart` and `strokeEnd`) by the shader alone; round joins
+    /// and caps are flattened to the `tolerance`.
+    ///
+    /// Unlike the fill of the outline of a stroke, adjacent quads overlap within
+    /// each join, where a translucent stroke is drawn twice.
+    internal init(stroke flattening: PathRasterizer.Flattening,
+                  style: PathRasterizer.StrokeStyle, tolerance: CGFloat)
+    {
+        let f = style.dashPattern.count > 0 ?
+            flattening.dashed(phase: style.dashPhase, pattern: style.dashPattern) : flattening
+        let h = Float(style.lineWidth / 2.0)
+        guard h > 0.0 else { return }
+        
+        // The angle subtended by each chord of a round join or cap:
+        let step = max(2.0 * acos(min(max(1.0 - Float(tolerance) / h, -1.0), 1.0)), 1e-3)
+        
+        for s in f.subpaths {
+            
+            // Coincident points have no direction, so drop them:
+            var points = [SIMD2<Float>](), lengths = [Float]()
+            for (p, l) in zip(s.points, s.lengths) {
+                let v = SIMD2<Float>(p)
+                if let last = points.last, PathTessellator.length(v - last) < 1e-6 {
+                    continue
+                }
+                points.append(v)
+                lengths.append(Float(l))
+            }
+            guard points.count > 1 else { continue }
+            
+            var directions = [SIMD2<Float>]()
+            for i in 1..<points.count {
+                let a = points[i - 1], b = points[i]
+                let la = lengths[i - 1], lb = lengths[i]
+                let d = (b - a) / PathTessellator.length(b - a)
+                let n = SIMD2<Float>(-d.y, d.x)
+                self.vertices += [PathTessellator.vertex(a + n * h, la),
+                                  PathTessellator.vertex(a - n * h, la),
+                                  PathTessellator.vertex(b - n * h, lb),
+                                  PathTessellator.vertex(a + n * h, la),
+                                  PathTessellator.vertex(b - n * h, lb),
+                                  PathTessellator.vertex(b + n * h, lb)]
+                self.fringe(a + n * h, b + n * h, n, la, lb)
+                self.fringe(b - n * h, a - n * h, -n, lb, la)
+                if let d0 = directions.last {
+                    self.join(a, d0, d, la, h, style, step)
+                }
+                directions.append(d)
+            }
+            
+            // A closed subpath ends where it began, and is joined there instead:
+            if s.isClosed && points.count > 2 && points.first! == points.last! {
+                self.join(points[0], directions.last!, directions[0], lengths.last!,
+                          h, style, step)
+            } else {
+                self.cap(points[0], -directions[0], lengths[0], h, style.lineCap, step)
+                self.cap(points.last!, directions.last!, lengths.last!, h, style.lineCap, step)
+            }
+        }
+    }
+    
+    /// Emits the wedge on the outer side of the join at `p` of the segments
+    /// along the directions `d0` and `d1`.
+    private mutating func join(_ p: SIMD2<Float>, _ d0: SIMD2<Float>, _ d1: SIMD2<Float>,
+                               _ l: Float, _ h: Float, _ style: PathRasterizer.StrokeStyle,
+                               _ step: Float)
+    {
+        let cross = d0.x * d1.y - d0.y * d1.x
+        let dot = (d0 * d1).sum()
+        guard abs(cross) > 1e-6 || dot < 0.0 else { return }
+        
+        // The outer side of a left turn is to the right:
+        let side: Float = cross > 0.0 ? -1.0 : 1.0
+        let n0 = SIMD2<Float>(-d0.y, d0.x) * side, n1 = SIMD2<Float>(-d1.y, d1.x) * side
+        let o0 = p + n0 * h, o1 = p + n1 * h
+        let bisector = n0 + n1, c = PathTessellator.length(bisector) / 2.0
+        
+        switch style.lineJoin {
+        case .round:
+            self.arc(p, n0, atan2(n0.x * n1.y - n0.y * n1.x, (n0 * n1).sum()), l, h, step)
+        case .miter where c > 1e-6 && 1.0 / c <= Float(style.miterLimit):
+            let m = p + bisector * (h / (2.0 * c * c))
+            self.vertices += [p, o0, m, p, m, o1].map { PathTessellator.vertex($0, l) }
+            self.fringe(o0, m, n0, l, l)
+            self.fringe(m, o1, n1, l, l)
+        default:
+            self.vertices += [p, o0, o1].map { PathTessellator.vertex($0, l) }
+            self.fringe(o0, o1, c > 1e-6 ? bisector / (2.0 * c) : d0, l, l)
+        }
+    }
+    
+    /// Emits the cap at the open end `p` of a subpath, facing outward along `d`.
+    private mutating func cap(_ p: SIMD2<Float>, _ d: SIMD2<Float>, _ l: Float, _ h: Float,
+                              _ cap: CGLineCap, _ step: Float)
+    {
+        let n = SIMD2<Float>(-d.y, d.x)
+        switch cap {
+        case .round:
+            self.arc(p, n, -.pi, l, h, step)
+        case .square:
+            let a = p + n * h, b = p - n * h, c = b + d * h, e = a + d * h
+            self.vertices += [a, b, c, a, c, e].map { PathTessellator.vertex($0, l) }
+            self.fringe(e, c, d, l, l)
+            self.fringe(a, e, n, l, l)
+            self.fringe(c, b, -n, l, l)
+        default:
+            self.fringe(p + n * h, p - n * h, d, l, l)
+        }
+    }
+    
+    /// Emits the fan of the circular arc of radius `h` about `p`, starting from
+    /// the direction `u` and sweeping by `angle` radians.
+    private mutating func arc(_ p: SIMD2<Float>, _ u: SIMD2<Float>, _ angle: Float,
+                              _ l: Float, _ h: Float, _ step: Float)
+    {
+        let count = min(max(Int((abs(angle) / step).rounded(.up)), 1), 64)
+        var u0 = u
+        for i in 1...count {
+            let t = angle * Float(i) / Float(count)
+            let u1 = SIMD2<Float>(u.x * cos(t) - u.y * sin(t), u.x * sin(t) + u.y * cos(t))
+            self.vertices += [p, p + u0 * h, p + u1 * h].map { PathTessellator.vertex($0, l) }
+            let mid = u0 + u1
+            self.fringe(p + u0 * h, p + u1 * h, mid / max(PathTessellator.length(mid), 1e-6), l, l)
+            u0 = u1
+        }
+    }
+    
+    /// Emits the trapezoids of the fill from `y0` toward `yb`, stopping early at
+    /// the first intersection of two edges, and returns the height reached.
+    /// The `previous` spans at `y0` are replaced by the spans at that height.
+    private mutating func sweep(_ active: [Edge], from y0: CGFloat, to yb: CGFloat,
+                                _ rule: CGPathFillRule, _ previous: inout [Span]) -> CGFloat
+    {
+        // Order the edges across the top of the band, breaking ties by the bottom:
+        var xs = active.map { ($0, $0.x(at: y0), $0.x(at: yb)) }
+        xs.sort { $0.1 != $1.1 ? $0.1 < $1.1 : $0.2 < $1.2 }
+        
+        // Any two edges that swap order must be adjacent just before crossing:
+        var y1 = yb
+        for i in xs.indices.dropLast() where xs[i].2 > xs[i + 1].2 {
+            let top = xs[i].1 - xs[i + 1].1, bottom = xs[i].2 - xs[i + 1].2
+            let yc = y0 + (yb - y0) * top / (top - bottom)
+            if yc > y0 + 1e-6 && yc < y1 {
+                y1 = yc
+            }
+        }
+        
+        // Walk the edges accumulating the winding number, emitting a trapezoid
+        // for each span inside the fill:
+        var top = [Span](), bottom = [Span]()
+        var winding = 0
+        var left: (CGFloat, CGFloat)? = nil
+        for (e, xa, _) in xs {
+            let xb = e.x(at: y1)
+            let was = PathTessellator.inside(winding, rule)
+            winding += e.winding
+            let now = PathTessellator.inside(winding, rule)
+            if !was && now {
+                left = (xa, xb)
+            } else if was && !now, let l = left {
+                self.trapezoid(l, (xa, xb), y0, y1)
+                top.append((l.0, xa))
+                bottom.append((l.1, xb))
+            }
+        }
+        
+        // Fringe the horizontal boundaries not shared with the previous band:
+        for s in PathTessellator.subtract(top, previous) {
+            self.fringe(CGPoint(x: s.0, y: y0), CGPoint(x: s.1, y: y0), CGPoint(x: 0, y: -1))
+        }
+        for s in PathTessellator.subtract(previous, top) {
+            self.fringe(CGPoint(x: s.1, y: y0), CGPoint(x: s.0, y: y0), CGPoint(x: 0, y: 1))
+        }
+        previous = bottom
+        return y1
+    }
+    
+    /// Emits the trapezoid between the `left` and `right` edges (given as the x
+    /// at `y0` and `y1`), along with the fringes of both edges.
+    private mutating func trapezoid(_ left: (CGFloat, CGFloat), _ right: (CGFloat, CGFloat),
+                                    _ y0: CGFloat, _ y1: CGFloat)
+    {
+        guard right.0 > left.0 || right.1 > left.1 else { return }
+        let a = CGPoint(x: left.0, y: y0), b = CGPoint(x: right.0, y: y0)
+        let c = CGPoint(x: right.1, y: y1), d = CGPoint(x: left.1, y: y1)
+        self.vertices += [a, b, c, a, c, d].map {
+            PathTessellator.vertex(SIMD2<Float>($0), 0.0)
+        }
+        
+        // The outward normal of each edge points away from the span:
+        func normal(_ p: CGPoint, _ q: CGPoint, _ side: CGFloat) -> CGPoint {
+            let v = CGPoint(x: q.x - p.x, y: q.y - p.y)
+            let l = max(v.distance(), 1e-9)
+            return CGPoint(x: -side * v.y / l, y: side * v.x / l)
+        }
+        self.fringe(a, d, normal(a, d, 1.0))
+        self.fringe(c, b, normal(b, c, -1.0))
+    }
+    
+    /// Emits a quad along the boundary `p`-`q`, extruded along the outward
+    /// `normal` by one pixel in the shader, with coverage falling to zero.
+    private mutating func fringe(_ p: CGPoint, _ q: CGPoint, _ normal: CGPoint) {
+        self.fringe(SIMD2<Float>(p), SIMD2<Float>(q), SIMD2<Float>(normal), 0.0, 0.0)
+    }
+    
+    /// Emits a fringe quad as above, whose ends lie at the arc lengths `lp` and `lq`.
+    private mutating func fringe(_ p: SIMD2<Float>, _ q: SIMD2<Float>, _ normal: SIMD2<Float>,
+                                 _ lp: Float, _ lq: Float)
+    {
+        let pi = PathTessellator.vertex(p, lp), qi = PathTessellator.vertex(q, lq)
+        let po = PathTessellator.vertex(p, lp, normal, 0.0)
+        let qo = PathTessellator.vertex(q, lq, normal, 0.0)
+        self.vertices += [pi, qi, po, po, qi, qo]
+    }
+    
+    ///
+    @inline(__always)
+    private static func vertex(_ p: SIMD2<Float>, _ length: Float, _ extrude: SIMD2<Float> = .zero,
+                               _ coverage: Float = 1.0) -> ShapeVertex
+    {
+        return ShapeVertex(position: p, extrude: extrude, coverage: coverage, length: length)
+    }
+    
+    ///
+    @inline(__always)
+    private static func length(_ v: SIMD2<Float>) -> Float {
+        return (v * v).sum().squareRoot()
+    }
+    
+    ///
+    @inline(__always)
+    private static func inside(_ winding: Int, _ rule: CGPathFillRule) -> Bool {
+        return rule == .evenOdd ? winding & 1 != 0 : winding != 0
+    }
+    
+    /// Returns the parts of the sorted, disjoint spans `a` not covered by `b`.
+    private static func subtract(_ a: [Span], _ b: [Span]) -> [Span] {
+        var result = [Span]()
+        var j = 0
+        for s in a {
+            var x0 = s.0
+            while j < b.count && b[j].1 <= x0 {
+                j += 1
+            }
+            var k = j
+            while k < b.count && b[k].0 < s.1 {
+                if b[k].0 > x0 {
+                    result.append((x0, b[k].0))
+                }
+                x0 = max(x0, b[k].1)
+                k += 1
+            }
+            if s.1 > x0 {
+                result.append((x0, s.1))
+            }
+        }
+        return result
+    }
+}
@@ -1,11 +1,116 @@
+import CoreGraphics
+import IOSurface
+import Metal.MTLPixelFormat
 
-///
-internal enum PixelFormat {
+/// Describes the storage layout of a pixel buffer, and converts between the
+/// equivalent `IOSurface`, `CGContext` and `MTLPixelFormat` representations.
+internal enum PixelFormat: Int, Codable {
     
-    // TODO: allow conversion between (bpp, bpc, etc.) and MTLPixelFormat and
-    // IOSurface, CVPixelBuffer, etc...
-   
     ///
     case none
     
+    /// 32-bit premultiplied BGRA, 8 bits per component. The default format.
+    case bgra8Unorm
+    
+    /// 64-bit premultiplied RGBA, 16-bit half-float per component.
+    case rgba16Float
+    
+    /// 8-bit single-component luminance.
+    case r8Unorm
+    
+    /// Select the most compact format suitable for the layer `ContentsFormat`.
+    internal init(_ format: Layer.ContentsFormat) {
+        switch format {
+        case .RGBA8Uint: self = .bgra8Unorm
+        case .RGBA16Float: self = .rgba16Float
+        case .gray8Uint: self = .r8Unorm
+        }
+    }
+    
+    /// Recover the format from an `IOSurface` pixel format code, if known.
+    internal init(ioSurface code: OSType) {
+        switch code {
+        case PixelFormat.bgra8Unorm.ioSurfaceFormat: self = .bgra8Unorm
+        case PixelFormat.rgba16Float.ioSurfaceFormat: self = .rgba16Float
+        case PixelFormat.r8Unorm.ioSurfaceFormat: self = .r8Unorm
+        default: self = .none
+        }
+    }
+    
+    /// The number of bytes used to store a single pixel.
+    internal var bytesPerElement: Int {
+        switch self {
+        case .none: return 0
+        case .bgra8Unorm: return 4
+        case .rgba16Float: return 8
+        case .r8Unorm: return 1
+        }
+    }
+    
+    /// The number of bits used to store a single component of a pixel.
+    internal var bitsPerComponent: Int {
+        switch self {
+        case .none: return 0
+        case .bgra8Unorm: return 8
+        case .rgba16Float: return 16
+        case .r8Unorm: return 8
+        }
+    }
+    
+    /// The four-character code used by `IOSurface` and `CVPixelBuffer`.
+    internal var ioSurfaceFormat: OSType {
+        switch self {
+        case .none: return 0
+        case .bgra8Unorm: return 0x42475241 /* 'BGRA' */
+        case .rgba16Float: return 0x52476841 /* 'RGhA' */
+        case .r8Unorm: return 0x4C303038 /* 'L008' */
+        }
+    }
+    
+    /// The equivalent Metal texture format.
+    internal var metalFormat: MTLPixelFormat {
+        switch self {
+        case .none: return .invalid
+        case .bgra8Unorm: return .bgra8Unorm
+        case .rgba16Float: return .rgba16Float
+        case .r8Unorm: return .r8Unorm
+        }
+    }
+    
+    /// The `CGBitmapInfo` used to draw into a buffer of this format; if `opaque`,
+    /// the alpha channel is skipped where the format has one.
+    internal func bitmapInfo(opaque: Bool) -> UInt32 {
+        switch self {
+        case .none:
+            return 0
+        case .bgra8Unorm:
+            let alpha: CGImageAlphaInfo = opaque ? .noneSkipFirst : .premultipliedFirst
+            return alpha.rawValue | CGBitmapInfo.byteOrder32Little.rawValue
+        case .rgba16Float:
+            let alpha: CGImageAlphaInfo = opaque ? .noneSkipLast : .premultipliedLast
+            return alpha.rawValue | CGBitmapInfo.byteOrder16Little.rawValue |
+                   CGBitmapInfo.floatComponents.rawValue
+        case .r8Unorm:
+            return CGImageAlphaInfo.none.rawValue
+        }
+    }
+    
+    /// The color space a `CGContext` must use to draw into this format; formats
+    /// with a fixed color model ignore `preferred`.
+    internal func colorSpace(_ preferred: CGColorSpace) -> CGColorSpace {
+        switch self {
+        case .r8Unorm: return CGColorSpaceCreateDeviceGray()
+        case .rgba16Float: return CGColorSpace(name: CGColorSpace.extendedSRGB) ?? preferred
+        default: return preferred
+        }
+    }
+    
+    /// Single-component formats are expanded to opaque gray when sampled.
+    internal var swizzle: MTLTextureSwizzleChannels {
+        switch self {
+        case .r8Unorm: return MTLTextureSwizzleChannels(red: .red, green: .red,
+                                                        blue: .red, alpha: .one)
+        default: return .default
+        }
+    }
 }
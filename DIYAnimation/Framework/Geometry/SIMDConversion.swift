@@ -63,3 +63,27 @@ internal extension SIMD4 where Scalar == Float {
         self.init(value.rgba.map { Float($0) })
     }
 }
+internal extension UInt32 {
+    
+    /// Packs the straight-alpha RGBA `color` as premultiplied unorm8 components,
+    /// in the byte order read by `unpack_unorm4x8_to_float()`.
+    @inline(__always)
+	init(premultiplied color: SIMD4<Float>) {
+        self.init(unorm: SIMD4<Float>(color.x * color.w, color.y * color.w, color.z * color.w, color.w))
+    }
+    
+    /// Packs the RGBA `color` as unorm8 components, without premultiplying it.
+    @inline(__always)
+	init(unorm color: SIMD4<Float>) {
+        let b = SIMD4<UInt32>(color.clamped(lowerBound: .zero, upperBound: .one) * 255,
+                              rounding: .toNearestOrEven)
+        self = b.x | (b.y << 8) | (b.z << 16) | (b.w << 24)
+    }
+    
+    /// Unpacks the unorm8 components of the receiver; the inverse of `init(unorm:)`.
+    @inline(__always)
+	var unorm: SIMD4<Float> {
+        return SIMD4<Float>(SIMD4<UInt32>(self & 0xff, (self >> 8) & 0xff,
+                                          (self >> 16) & 0xff, self >> 24)) / 255
+    }
+}
@@ -16,17 +16,23 @@ extension IOSurface: Drawable, RenderConvertible {
         return Render.Surface(self)
     }
 }
-extension CGImage: Drawable, RenderConvertible {
+extension CGImage: Drawable, RenderConvertible, RenderCachedImage {
     var renderValue: Any {
-        return Render.Image.cached(for: self)
+        return Render.Image(self, [.swapOrder])
+    }
+    func decodableImage() -> CGImage? {
+        return self
     }
 }
 #if canImport(AppKit)
 import AppKit
-extension NSImage: Drawable, RenderConvertible {
+extension NSImage: Drawable, RenderConvertible, RenderCachedImage {
     var renderValue: Any {
         let img = self.cgImage(forProposedRect: nil, context: nil, hints: nil)!
-        return Render.Image.cached(for: img)
+        return Render.Image(img, [.swapOrder])
+    }
+    func decodableImage() -> CGImage? {
+        return self.cgImage(forProposedRect: nil, context: nil, hints: nil)
     }
 }
 #endif
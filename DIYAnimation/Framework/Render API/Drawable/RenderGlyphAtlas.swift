@@ -0,0 +1,258 @@
+import Foundation
+import CoreText
+import Metal
+
+extension Render {
+    
+    /// A single texture shared by all text, into which each glyph is rasterized
+    /// once for every font, pixel size, and subpixel offset it is drawn at.
+    ///
+    /// Glyphs are packed into shelves (rows as tall as their tallest glyph), and
+    /// their pixels are kept on the CPU so that only newly packed regions are
+    /// uploaded to the texture. Entries are addressed in texels, so the atlas
+    /// may grow without invalidating them; once it can grow no further, it is
+    /// cleared before the next frame (see `prepareFrame()`) and its
+    /// `generation` advances.
+    internal final class GlyphAtlas {
+        
+        /// The shared atlas used by all `TextLayer`s.
+        internal static let shared = GlyphAtlas()
+        
+        /// The number of horizontal subpixel positions each glyph is rasterized at.
+        internal static let subpixelSteps = 4
+        
+        /// The transparent border around each glyph, to avoid sampling neighbors.
+        private static let padding = 1
+        
+        ///
+        private static let initialSize = 1024
+        
+        ///
+        private static let maximumSize = 4096
+        
+        ///
+        internal struct Key: Hashable {
+            
+            /// The PostScript name of the font.
+            let font: String
+            
+            /// The font size, in pixels.
+            let size: CGFloat
+            
+            ///
+            let glyph: CGGlyph
+            
+            /// The horizontal offset, in `1 / subpixelSteps` pixels.
+            let subpixel: Int
+        }
+        
+        /// The location of a glyph within the atlas.
+        internal struct Entry {
+            
+            /// The origin and size of the glyph bitmap, in texels.
+            let rect: SIMD4<Float>
+            
+            /// The offset of the bitmap's bottom-left corner from the glyph's
+            /// origin, in pixels.
+            let bearing: SIMD2<Float>
+        }
+        
+        /// The number of times the atlas has been cleared. All entries retrieved
+        /// from a previous generation are invalid.
+        internal private(set) var generation = 0
+        
+        ///
+        private var size = GlyphAtlas.initialSize
+        
+        ///
+        private var pixels = [UInt8](repeating: 0, count: GlyphAtlas.initialSize *
+                                                         GlyphAtlas.initialSize)
+        
+        ///
+        private var entries: [Key: Entry] = [:]
+        
+        /// The shelves packed so far, as (y, height, x).
+        private var shelves: [(y: Int, height: Int, x: Int)] = []
+        
+        /// The rows modified since the texture was last uploaded.
+        private var dirty: Range<Int>? = nil
+        
+        /// Whether the atlas filled up, and is to be cleared before the next frame.
+        private var needsClear = false
+        
+        ///
+        private var texture: MTLTexture? = nil
+        
+        ///
+        private let lock = Lock()
+        
+        ///
+        private init() {}
+        
+        /// Returns the atlas entry of `glyph` in `font` at `size` pixels, offset
+        /// horizontally by `subpixel` steps, rasterizing the glyph if needed.
+        /// Glyphs with no pixels (such as spaces) have an empty entry.
+        internal func entry(_ font: CTFont, _ glyph: CGGlyph,
+                            size: CGFloat, subpixel: Int) -> Entry
+        {
+            let key = Key(font: CTFontCopyPostScriptName(font) as String, size: size,
+                          glyph: glyph, subpixel: subpixel)
+            return self.lock.whileLocked {
+                if let e = self.entries[key] {
+                    return e
+                }
+                let e = self.rasterize(key, font)
+                self.entries[key] = e
+                return e
+            }
+        }
+        
+        /// Clears the atlas if it filled up during a prior frame; called before
+        /// the ops of each frame are built, so that no frame mixes entries of two
+        /// generations. The cleared atlas is drawn into a new texture, as frames
+        /// still in flight sample the old one.
+        internal func prepareFrame() {
+            self.lock.whileLocked {
+                guard self.needsClear else { return }
+                self.needsClear = false
+                self.entries.removeAll()
+                self.shelves.removeAll()
+                self.pixels = [UInt8](repeating: 0, count: self.size * self.size)
+                self.texture = nil
+                self.dirty = nil
+                self.generation += 1
+            }
+        }
+        
+        /// The atlas texture on `device`, with any newly rasterized glyphs uploaded,
+        /// or `nil` if the atlas was cleared since the `generation` of the entries
+        /// to be drawn from it.
+        internal func texture(_ device: MTLDevice, generation: Int) -> MTLTexture? {
+            return self.lock.whileLocked {
+                guard generation == self.generation else { return nil }
+                if let tex = self.texture, tex.width == self.size,
+                    tex.device.registryID == device.registryID
+                {
+                    if let rows = self.dirty {
+                        self.upload(rows, to: tex)
+                    }
+                    self.dirty = nil
+                    return tex
+                }
+                
+                let desc = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .r8Unorm,
+                                                                    width: self.size,
+                                                                    height: self.size,
+                                                                    mipmapped: false)
+                desc.usage = .shaderRead
+                desc.storageMode = .managed
+                let tex = device.makeTexture(descriptor: desc)!
+                Trace.count(.textureAllocations)
+                self.upload(0..<self.size, to: tex)
+                self.texture = tex
+                self.dirty = nil
+                return tex
+            }
+        }
+        
+        /// Copies the `rows` of the atlas into the texture.
+        private func upload(_ rows: Range<Int>, to tex: MTLTexture) {
+            self.pixels.withUnsafeBytes { p in
+                tex.replace(region: MTLRegionMake2D(0, rows.lowerBound, self.size, rows.count),
+                            mipmapLevel: 0,
+                            withBytes: p.baseAddress! + rows.lowerBound * self.size,
+                            bytesPerRow: self.size)
+            }
+            Trace.count(.bytesUploaded, rows.count * self.size)
+        }
+        
+        /// Draws the glyph for `key` into a new region of the atlas.
+        private func rasterize(_ key: Key, _ font: CTFont) -> Entry {
+            let pad = GlyphAtlas.padding
+            let f = CTFontCreateCopyWithAttributes(font, key.size, nil, nil)
+            var glyph = key.glyph
+            var bounds = CGRect.zero
+            CTFontGetBoundingRectsForGlyphs(f, .horizontal, &glyph, &bounds, 1)
+            guard !bounds.isEmpty else {
+                return Entry(rect: .zero, bearing: .zero)
+            }
+            
+            // The bitmap covers the glyph bounds, rounded out, plus the padding
+            // and one pixel for the subpixel offset:
+            let x0 = Int(bounds.minX.rounded(.down)) - pad
+            let y0 = Int(bounds.minY.rounded(.down)) - pad
+            let width = Int(bounds.maxX.rounded(.up)) + pad + 1 - x0
+            let height = Int(bounds.maxY.rounded(.up)) + pad - y0
+            guard let origin = self.allocate(width, height) else {
+                return Entry(rect: .zero, bearing: .zero)
+            }
+            let (x, y) = origin
+            
+            // Draw the glyph as white coverage on black, straight into the atlas:
+            self.pixels.withUnsafeMutableBytes { p in
+                let ctx = CGContext(data: p.baseAddress! + y * self.size + x,
+                                    width: width, height: height, bitsPerComponent: 8,
+                                    bytesPerRow: self.size,
+                                    space: CGColorSpaceCreateDeviceGray(),
+                                    bitmapInfo: CGImageAlphaInfo.none.rawValue)!
+                ctx.setShouldSmoothFonts(false)
+                ctx.setAllowsFontSubpixelPositioning(true)
+                ctx.setShouldSubpixelPositionFonts(true)
+                ctx.setFillColor(gray: 1.0, alpha: 1.0)
+                let offset = CGFloat(key.subpixel) / CGFloat(GlyphAtlas.subpixelSteps)
+                var position = CGPoint(x: CGFloat(-x0) + offset, y: CGFloat(-y0))
+                CTFontDrawGlyphs(f, &glyph, &position, 1, ctx)
+                ctx.flush()
+            }
+            
+            let rows = y..<(y + height)
+            self.dirty = self.dirty.map { min($0.lowerBound, y)..<max($0.upperBound, y + height) } ?? rows
+            return Entry(rect: SIMD4<Float>(Float(x), Float(y), Float(width), Float(height)),
+                         bearing: SIMD2<Float>(Float(x0), Float(y0)))
+        }
+        
+        /// Reserves a `width` by `height` region of the atlas, growing the atlas if
+        /// it is full. Once it can grow no further, no region is reserved until it
+        /// is cleared, so glyphs new to that frame are only drawn from the next.
+        private func allocate(_ width: Int, _ height: Int) -> (Int, Int)? {
+            guard width <= GlyphAtlas.maximumSize && height <= GlyphAtlas.maximumSize else {
+                return nil
+            }
+            
+            // Use the first shelf that fits, wasting no more than a quarter of it:
+            for i in self.shelves.indices {
+                let s = self.shelves[i]
+                if height <= s.height && height * 4 >= s.height * 3 && s.x + width <= self.size {
+                    self.shelves[i].x += width
+                    return (s.x, s.y)
+                }
+            }
+            
+            // Otherwise open a new shelf below the last:
+            let top = self.shelves.last.map { $0.y + $0.height } ?? 0
+            if top + height <= self.size && width <= self.size {
+                self.shelves.append((y: top, height: height, x: width))
+                return (0, top)
+            }
+            
+            // Double the atlas, keeping all existing entries in place:
+            if self.size < GlyphAtlas.maximumSize {
+                let old = self.size, pixels = self.pixels
+                self.size *= 2
+                self.pixels = [UInt8](repeating: 0, count: self.size * self.size)
+                for row in 0..<old {
+                    self.pixels.replaceSubrange((row * self.size)..<(row * self.size + old),
+                                                with: pixels[(row * old)..<(row * old + old)])
+                }
+                self.texture = nil
+                self.dirty = nil
+                return self.allocate(width, height)
+            }
+            
+            // Start over at the next frame; all glyphs will be rasterized again on
+            // demand.
+            self.needsClear = true
+            return nil
+        }
+    }
+}
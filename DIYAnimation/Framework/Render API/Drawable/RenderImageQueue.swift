@@ -1,33 +1,161 @@
 import Foundation
+import Metal
 
 extension Render {
-	    
+	
+	/// The render server's side of an `ImageQueue`: it samples the queue's
+	/// `SlotRing` at each frame and displays the chosen image's surface directly,
+	/// without copying it.
 	///
+	/// Asynchronous queues are continuously polled: inserting an image advances
+	/// `generation` and posts `didChangeNotification` to `Render.notificationCenter`,
+	/// as does sampling a queue that still holds images to display later, so that
+	/// a frame may be scheduled (see `Renderer.nextFrameTime()`).
     internal final class ImageQueue: RenderValue {
         
-        //
-		private var flags: Int {
-			return 0 // get from shmem -> flags
+        /// Posted to `Render.notificationCenter` whenever an image is inserted
+        /// into an asynchronous queue.
+        internal static let didChangeNotification = Notification.Name("Render.ImageQueue.didChange")
+        
+        /// Advances whenever an asynchronous queue needs to be sampled again.
+        internal static var generation: UInt64 {
+            return ImageQueue.generationLock.whileLocked { ImageQueue._generation }
+        }
+        
+        ///
+        private static var _generation: UInt64 = 0
+        
+        ///
+        private static let generationLock = Lock()
+        
+        /// Advances the `generation`, and if `notify` is set, wakes any idle
+        /// scheduler. May be called from any thread.
+        internal static func setNeedsFrame(notify: Bool = true) {
+            ImageQueue.generationLock.whileLocked { ImageQueue._generation += 1 }
+            if notify {
+                Render.notificationCenter.post(name: ImageQueue.didChangeNotification, object: nil)
+            }
+        }
+        
+        ///
+        private enum CodingKeys: CodingKey {
+            case memory
+        }
+        
+        /// Holds the ring; retained so it outlives the client's queue.
+        private let memory: SharedMemory
+        
+        ///
+        private let ring: SlotRing
+        
+        /// The textures of the surfaces displayed so far, by slot identifier.
+        ///
+        /// A surface is recycled by the client after it is retired, so its
+        /// texture remains valid and is reused when the surface is inserted again.
+        /// Once the client deletes a surface its identifier may be reused by
+        /// another, so its texture is evicted then; see `evict(_:)`.
+        private var textures: [UInt64: MTLTexture] = [:]
+        
+        /// The frame time and texture of the latest sample, returned again if
+        /// the queue is sampled more than once in a frame (i.e. by several
+        /// layers), so that only the first of them retires any images.
+        private var last: (frameTime: TimeInterval, texture: MTLTexture?) = (-.infinity, nil)
+        
+        ///
+        private let lock = Lock()
+		
+		/// The flags of the client's queue.
+		private var flags: DIYAnimation.ImageQueue.Flags {
+			return DIYAnimation.ImageQueue.Flags(Int(self.ring.options))
 		}
 		
 		internal init(_ shmem: SharedMemory) {
-			// retain shmem
+			self.memory = shmem
+			self.ring = SlotRing(attaching: shmem.pointer.baseAddress!)
 		}
+        
+        ///
+        internal init(from decoder: Decoder) throws {
+            let container = try decoder.container(keyedBy: CodingKeys.self)
+            self.memory = try container.decode(SharedMemory.self, forKey: .memory)
+            self.ring = SlotRing(attaching: self.memory.pointer.baseAddress!)
+        }
+        
+        ///
+        internal func encode(to encoder: Encoder) throws {
+            var container = encoder.container(keyedBy: CodingKeys.self)
+            try container.encode(self.memory, forKey: .memory)
+        }
+        
+        /// Samples the queue at the layer `time`, for the frame at the media time
+        /// `frameTime`, returning the texture of the image to display, or `nil`
+        /// if the queue holds none.
+        ///
+        /// Only `IOSurface` images are displayed; others are retired unseen.
+        internal func texture(_ device: MTLDevice, at time: TimeInterval,
+                              frameTime: TimeInterval) -> MTLTexture?
+        {
+            return self.lock.whileLocked {
+                if self.last.frameTime == frameTime {
+                    return self.last.texture
+                }
+                
+                var tex: MTLTexture? = nil
+                let fill = self.flags.contains(.fill)
+                if let slot = self.ring.sample(at: time, frameTime: frameTime, fill: fill) {
+                    tex = self.texture(for: slot, device)
+                }
+                
+                // Keep sampling while later images are queued; the renderer is
+                // already running, so it need not be woken:
+                let ring = self.ring
+                if self.flags.contains(.async) && ring.head > max(ring.displayed, ring.flushed) {
+                    ImageQueue.setNeedsFrame(notify: false)
+                }
+                self.last = (frameTime, tex)
+                return tex
+            }
+        }
+        
+        /// Note: the lock must be held.
+        private func texture(for slot: SlotRing.Slot, _ device: MTLDevice) -> MTLTexture? {
+            guard slot.kind == DIYAnimation.ImageQueue.Kind.ioSurface.rawValue else { return nil }
+            if let tex = self.textures[slot.id], tex.device.registryID == device.registryID {
+                return tex
+            }
+            guard let ref = IOSurfaceLookup(IOSurfaceID(truncatingIfNeeded: slot.id)) else { return nil }
+            
+            // Surfaces no longer in use by the client accumulate as it replaces
+            // them (i.e. when resized), so forget them all once there are too many:
+            if self.textures.count >= self.ring.capacity * 2 {
+                self.textures.removeAll()
+            }
+            let tex = Render.Surface(unsafeBitCast(ref, to: IOSurface.self)).texture(device)
+            self.textures[slot.id] = tex
+            return tex
+        }
 		
-		deinit {
-			// global list being foreach released?
-			// texture release?
-			// release all registered buffers?
+		/// Forgets the texture of the surface `id`, which the client deleted.
+		func evict(_ id: IOSurfaceID) {
+			self.lock.whileLocked {
+				self.textures[UInt64(id)] = nil
+				self.last = (-.infinity, nil)
+			}
 		}
-        
+		
 		///
 		func flush() {
-			
+			self.lock.whileLocked {
+				self.last = (-.infinity, nil)
+			}
 		}
 		
 		///
 		func flushCache() {
-			
+			self.lock.whileLocked {
+				self.textures.removeAll()
+				self.last = (-.infinity, nil)
+			}
 		}
 		
 		///
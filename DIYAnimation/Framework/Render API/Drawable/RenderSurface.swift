@@ -66,15 +66,24 @@ extension Render {
 			try container.encode(IOSurfaceGetID(unsafeBitCast(self.surface, to: IOSurfaceRef.self)), forKey: .surfaceID)
         }
         
+        /// The `PixelFormat` of the underlying surface; defaults to BGRA.
+        internal var format: PixelFormat {
+            let f = PixelFormat(ioSurface: self.surface.pixelFormat)
+            return f == .none ? .bgra8Unorm : f
+        }
+
         ///
         internal func texture(_ device: MTLDevice) -> MTLTexture {
+            let format = self.format
             let desc = MTLTextureDescriptor()
             desc.width = self.surface.width
             desc.height = self.surface.height
             desc.textureType = .type2D
             desc.usage = .shaderRead
             desc.storageMode = .managed
-            desc.pixelFormat = .bgra8Unorm
+            desc.pixelFormat = format.metalFormat
+            desc.swizzle = format.swizzle
+            Trace.count(.textureAllocations)
             return device.makeTexture(descriptor: desc,
 									  iosurface: unsafeBitCast(self.surface, to: IOSurfaceRef.self),
                                       plane: 0)!
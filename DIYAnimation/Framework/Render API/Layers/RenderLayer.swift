@@ -137,10 +137,16 @@ contentsRect:
 ///
 extension LayerNode {
     
-    ///
-    internal init(from layer2: Layer, at time: TimeInterval) {
+    /// Converts the `layer` presented at `time` into a node. If its transform
+    /// is not affine, the full matrix is appended to `transforms` and indexed.
+    internal init(from layer2: Layer, at time: TimeInterval, transforms: inout [float4x4]) {
+        self.init(presenting: layer2.layer(at: time), transforms: &transforms)
+    }
+    
+    /// Converts the `layer`, whose animations have already been applied, into
+    /// a node. See `init(from:at:transforms:)`.
+    internal init(presenting layer: Layer, transforms: inout [float4x4]) {
         self.init()
-        let layer = layer2.layer(at: time)
         
         /*var benchmark = CurrentMediaTime() * 1000 {
             didSet {
@@ -148,51 +154,47 @@ extension LayerNode {
             }
         }*/
         
-        self.position = SIMD2<Float>(layer.position)
-        self.anchorPoint = SIMD2<Float>(layer.anchorPoint)
-        self.bounds = SIMD4<Float>(layer.bounds)
+        let position = SIMD2<Float>(layer.position)
+        let anchorPoint = SIMD2<Float>(layer.anchorPoint)
+        self.size = SIMD2<Float>(layer.bounds.size)
         self.cornerRadius = Float(layer.cornerRadius)
         self.borderWidth = Float(layer.borderWidth)
-        self.borderColor = SIMD4<Float>(layer.borderColor)
-        self.backgroundColor = SIMD4<Float>(layer.backgroundColor)
+        self.borderColor = UInt32(premultiplied: SIMD4<Float>(layer.borderColor))
+        self.backgroundColor = UInt32(premultiplied: SIMD4<Float>(layer.backgroundColor))
         self.mipBias = Float(layer.minificationFilterBias)
         
         self.shadowOpacity = Float(layer.shadowOpacity)
         self.shadowRadius = Float(layer.shadowRadius)
         self.shadowOffset = SIMD2<Float>(layer.shadowOffset)
-        self.shadowColor = SIMD4<Float>(layer.shadowColor)
+        self.shadowColor = UInt32(premultiplied: SIMD4<Float>(layer.shadowColor))
         
         //print("convert: ", terminator: "")
         //benchmark = CurrentMediaTime() * 1000
         
-        // transform:
-        /*
-        let value = Double((0.1 * time).truncatingRemainder(dividingBy: 1.0))
-        let r1 = Transform3D.scale(x: sin(Float.pi * Float(value)),
-                                   y: sin(Float.pi * Float(value))).m
-        let r2 = Transform3D.rotation(angle: 2 * Float.pi * Float(value), z: 1).m
-        let r3 = Transform3D.translation(x: Float(value) * 100,
-                                         y: Float(value) * 100).m
-        let transform = r3 * r2 * r1
-        */
         let transform = (layer.transform ?? .identity).m
         
         //print("get_t: ", terminator: "")
         //benchmark = CurrentMediaTime() * 1000
         
         // fix transform!
-        let pivot = self.position - SIMD2<Float>(self.bounds.z * 2.0 * (0.5 - self.anchorPoint.x),
-												 self.bounds.w * 2.0 * (0.5 - self.anchorPoint.y))
+        let pivot = position - SIMD2<Float>(self.size.x * 2.0 * (0.5 - anchorPoint.x),
+                                            self.size.y * 2.0 * (0.5 - anchorPoint.y))
         let forward = Transform3D.translation(x: pivot.x, y: pivot.y).m
         let backward = Transform3D.translation(x: -pivot.x, y: -pivot.y).m
-        let bounds = Transform3D.scale(x: self.bounds.z, y: self.bounds.w).m
+        let bounds = Transform3D.scale(x: self.size.x, y: self.size.y).m
+        let m = (forward * transform * backward) * (forward * bounds)
         
         //print("calc_t: ", terminator: "")
         //benchmark = CurrentMediaTime() * 1000
         
-        // set transforms:
-        self.transform = (forward * transform * backward) * (forward * bounds)
-        self.contentsTransform = (forward * transform * backward) * (forward * bounds)
+        // set transforms; only 3D transforms need the full matrix:
+        if Transform3D(simd: m).isAffine {
+            self.transform = float3x2(m.columns.0.lowHalf, m.columns.1.lowHalf, m.columns.3.lowHalf)
+        } else {
+            self.flags |= UInt32(LayerNodeFlag.transform3D.rawValue)
+            self.transform3D = UInt32(transforms.count)
+            transforms.append(m)
+        }
         
         //print("apply_t: ", terminator: "")
         //benchmark = CurrentMediaTime() * 1000
@@ -1,4 +1,7 @@
 import Foundation
+import AppKit
+import CoreText
+import Metal
 
 extension Render {
     
@@ -27,14 +30,632 @@ extension Render {
         // func getVolume() -> Volume {}
     }
     
-    ///
+    /// An immutable array of vertices or instances built on the CPU, and
+    /// uploaded to the GPU on first use.
+    internal final class Mesh<Element> {
+        
+        ///
+        internal let elements: [Element]
+        
+        ///
+        private var buffer: MTLBuffer? = nil
+        
+        ///
+        private let lock = Lock()
+        
+        ///
+        internal init(_ elements: [Element]) {
+            self.elements = elements
+        }
+        
+        /// The buffer of the mesh on `device`, if it is not empty.
+        internal func buffer(_ device: MTLDevice) -> MTLBuffer? {
+            guard self.elements.count > 0 else { return nil }
+            return self.lock.whileLocked { () -> MTLBuffer? in
+                if let b = self.buffer, b.device.registryID == device.registryID {
+                    return b
+                }
+                self.buffer = device.makeBuffer(bytes: self.elements,
+                                                length: self.elements.count *
+                                                    MemoryLayout<Element>.stride,
+                                                options: .storageModeManaged)
+                Trace.count(.bytesUploaded, self.buffer?.length ?? 0)
+                return self.buffer
+            }
+        }
+    }
+    
+    /// Caches the flattening and tessellation of each shape's path, keyed by the
+    /// contents of the path, so that a shape whose path is unchanged is never
+    /// flattened or tessellated again. A trimmed stroke (`strokeStart` and
+    /// `strokeEnd`) is drawn from a mesh of the whole stroke trimmed by the
+    /// shader, so animating the trim never tessellates the stroke again.
     internal final class ShapeLayer: LayerClass {
-        // fill/stroke/dash/path stuff
+        
+        ///
+        internal typealias Mesh = Render.Mesh<ShapeVertex>
+        
+        /// The `ShapeNode.trim` of a mesh drawn in its entirety.
+        internal static let untrimmed = SIMD2<Float>(-.greatestFiniteMagnitude,
+                                                     .greatestFiniteMagnitude)
+        
+        /// The cached flattening and meshes of a path at a single tolerance. The
+        /// path is only flattened on first use, and its meshes tessellated, under
+        /// the geometry's own lock, so that shapes of other paths are not blocked.
+        private final class Geometry {
+            let path: CGPath
+            let tolerance: CGFloat
+            let lock = Lock()
+            var fills: [CGPathFillRule: Mesh] = [:]
+            var outlines: [PathRasterizer.StrokeStyle: PathRasterizer.Flattening] = [:]
+            var strokes: [PathRasterizer.StrokeStyle: Mesh] = [:]
+            var trimmableStrokes: [PathRasterizer.StrokeStyle: Mesh] = [:]
+            
+            init(_ path: CGPath, _ tolerance: CGFloat) {
+                self.path = path
+                self.tolerance = tolerance
+            }
+            
+            /// The flattening of the path. Note: the lock must be held.
+            lazy var flattening = PathRasterizer.Flattening(self.path, tolerance: self.tolerance)
+            
+            /// The outline of the untrimmed stroke. Note: the lock must be held.
+            func outline(_ style: PathRasterizer.StrokeStyle) -> PathRasterizer.Flattening {
+                if let o = self.outlines[style] {
+                    return o
+                }
+                let o = self.flattening.stroked(style, tolerance: self.tolerance)
+                self.outlines[style] = o
+                return o
+            }
+        }
+        
+        ///
+        private struct CacheKey: Hashable {
+            let path: PathRasterizer.Key
+            let tolerance: CGFloat
+        }
+        
+        /// The maximum number of paths cached.
+        private static let cacheLimit = 128
+        
+        ///
+        private static var cache: [CacheKey: Geometry] = [:]
+        
+        /// The cached paths, least recently used first.
+        private static var cacheOrder: [CacheKey] = []
+        
+        /// Memoizes the content key of each path object seen; the path is retained
+        /// so that its identifier is not reused. `ShapeLayer.path` only holds
+        /// immutable copies, so a path's contents never change under its key.
+        private static var pathKeys: [ObjectIdentifier: (CGPath, PathRasterizer.Key)] = [:]
+        
+        ///
+        private static var cacheLock = Lock()
+        
+        /// Executes `work` on the cached geometry of `path`, flattening it first
+        /// if it is not cached at the `scale` (in pixels per point).
+        ///
+        /// Only the lookup holds the cache lock; the path is hashed, and `work`
+        /// executed, outside of it.
+        private static func geometry<R>(_ path: CGPath, _ scale: CGFloat,
+                                        _ work: (Geometry) -> R) -> R
+        {
+            let tolerance = PathRasterizer.tolerance(forScale: scale)
+            let id = ObjectIdentifier(path)
+            let pathKey = ShapeLayer.cacheLock.whileLocked { ShapeLayer.pathKeys[id]?.1 } ??
+                PathRasterizer.Key(path)
+            
+            let g = ShapeLayer.cacheLock.whileLocked { () -> Geometry in
+                if ShapeLayer.pathKeys[id] == nil {
+                    if ShapeLayer.pathKeys.count >= ShapeLayer.cacheLimit * 2 {
+                        ShapeLayer.pathKeys.removeAll()
+                    }
+                    ShapeLayer.pathKeys[id] = (path, pathKey)
+                }
+                
+                let key = CacheKey(path: pathKey, tolerance: tolerance)
+                if let g = ShapeLayer.cache[key] {
+                    if let i = ShapeLayer.cacheOrder.lastIndex(of: key) {
+                        ShapeLayer.cacheOrder.remove(at: i)
+                    }
+                    ShapeLayer.cacheOrder.append(key)
+                    return g
+                }
+                
+                // Evict the least recently used paths:
+                while ShapeLayer.cacheOrder.count >= ShapeLayer.cacheLimit {
+                    let old = ShapeLayer.cacheOrder.removeFirst()
+                    ShapeLayer.cache[old] = nil
+                    ShapeLayer.pathKeys = ShapeLayer.pathKeys.filter { $0.value.1 != old.path }
+                }
+                let g = Geometry(pathKey.path, tolerance)
+                ShapeLayer.cache[key] = g
+                ShapeLayer.cacheOrder.append(key)
+                return g
+            }
+            return g.lock.whileLocked {
+                work(g)
+            }
+        }
+        
+        /// Returns the fill mesh of the `layer`, if it is filled, when drawn at
+        /// `scale` pixels per point.
+        internal static func fill(of layer: DIYAnimation.ShapeLayer, scale: CGFloat) -> Mesh? {
+            guard let path = layer.path, let color = layer.fillColor, color.alpha > 0.0 else {
+                return nil
+            }
+            let rule = layer.fillRule.cgFillRule
+            return ShapeLayer.geometry(path, scale) { g -> Mesh in
+                if let m = g.fills[rule] {
+                    return m
+                }
+                let m = Mesh(PathTessellator(fill: g.flattening, rule: rule).vertices)
+                g.fills[rule] = m
+                return m
+            }
+        }
+        
+        /// Returns the stroke mesh of the `layer`, if it is stroked, when drawn at
+        /// `scale` pixels per point, along with the `ShapeNode.trim` to draw it.
+        ///
+        /// An untrimmed stroke is drawn from the fill of its outline, so that it
+        /// never overlaps itself; otherwise, every vertex of the mesh carries its
+        /// arc length, and the shader trims it. The trimmed ends of a stroke are
+        /// always butt, whatever its `lineCap`.
+        internal static func stroke(of layer: DIYAnimation.ShapeLayer,
+                                    scale: CGFloat) -> (Mesh, SIMD2<Float>)?
+        {
+            guard let path = layer.path, let color = layer.strokeColor, color.alpha > 0.0,
+                layer.lineWidth > 0.0 && layer.strokeEnd > layer.strokeStart else {
+                return nil
+            }
+            let style = layer.strokeStyle
+            let (start, end) = (max(layer.strokeStart, 0.0), min(layer.strokeEnd, 1.0))
+            return ShapeLayer.geometry(path, scale) { g -> (Mesh, SIMD2<Float>) in
+                if start <= 0.0 && end >= 1.0 {
+                    if let m = g.strokes[style] {
+                        return (m, ShapeLayer.untrimmed)
+                    }
+                    let m = Mesh(PathTessellator(fill: g.outline(style), rule: .winding).vertices)
+                    g.strokes[style] = m
+                    return (m, ShapeLayer.untrimmed)
+                }
+                
+                // Only the trimmed ends are cut, so caps remain at any others:
+                let length = g.flattening.length
+                let trim = SIMD2<Float>(start > 0.0 ? Float(start * length) : ShapeLayer.untrimmed.x,
+                                        end < 1.0 ? Float(end * length) : ShapeLayer.untrimmed.y)
+                if let m = g.trimmableStrokes[style] {
+                    return (m, trim)
+                }
+                let m = Mesh(PathTessellator(stroke: g.flattening, style: style,
+                                             tolerance: g.tolerance).vertices)
+                g.trimmableStrokes[style] = m
+                return (m, trim)
+            }
+        }
+        
+        /// Draws the fill and stroke of the `layer` into `ctx` with the coverage
+        /// rasterizer, for render targets without a GPU.
+        internal static func render(_ layer: DIYAnimation.ShapeLayer, in ctx: CGContext) {
+            guard let path = layer.path else { return }
+            let t = ctx.ctm
+            let scale = abs(t.a * t.d - t.b * t.c).squareRoot()
+            
+            if let color = layer.fillColor, color.alpha > 0.0 {
+                let f = ShapeLayer.geometry(path, scale) { $0.flattening }
+                ShapeLayer.render(f, layer.fillRule.cgFillRule, color, scale, ctx)
+            }
+            if let color = layer.strokeColor, color.alpha > 0.0,
+                layer.lineWidth > 0.0 && layer.strokeEnd > layer.strokeStart
+            {
+                let style = layer.strokeStyle
+                let (start, end) = (layer.strokeStart, layer.strokeEnd)
+                let f = ShapeLayer.geometry(path, scale) { g -> PathRasterizer.Flattening in
+                    guard start > 0.0 || end < 1.0 else { return g.outline(style) }
+                    return g.flattening.trimmed(from: start, to: end)
+                                       .stroked(style, tolerance: g.tolerance)
+                }
+                ShapeLayer.render(f, .winding, color, scale, ctx)
+            }
+        }
+        
+        /// Rasterizes the `flattening` into a coverage mask at `scale`, and fills
+        /// the `color` through it.
+        private static func render(_ flattening: PathRasterizer.Flattening,
+                                   _ rule: CGPathFillRule, _ color: CGColor,
+                                   _ scale: CGFloat, _ ctx: CGContext)
+        {
+            let box = flattening.boundingBox
+            guard !box.isNull && scale > 0.0 else { return }
+            let width = Int((box.width * scale).rounded(.up)) + 1
+            let height = Int((box.height * scale).rounded(.up)) + 1
+            
+            // The mask rows run from the top of the box down:
+            let t = CGAffineTransform(a: scale, b: 0, c: 0, d: -scale,
+                                      tx: -box.minX * scale, ty: box.maxY * scale)
+            let mask = PathRasterizer.rasterize(flattening, width: width, height: height,
+                                                transform: t, rule: rule)
+            guard let image = mask.image else { return }
+            let rect = CGRect(x: box.minX, y: box.maxY - CGFloat(height) / scale,
+                              width: CGFloat(width) / scale, height: CGFloat(height) / scale)
+            
+            ctx.saveGState()
+            ctx.clip(to: rect, mask: image)
+            ctx.setFillColor(color)
+            ctx.fill(rect)
+            ctx.restoreGState()
+        }
+    }
+    
+    /// Caches the shaped glyph runs of each `TextLayer` string, keyed by the
+    /// attributed string and layout size, along with the glyph quads last built
+    /// from them. Glyphs are drawn from the shared `GlyphAtlas`, so changing the
+    /// text of a layer only shapes the new string, and rasterizes any glyphs not
+    /// yet drawn at that size.
+    internal final class TextLayer: LayerClass {
+        
+        ///
+        internal typealias Quads = Render.Mesh<GlyphInstance>
+        
+        /// A glyph positioned within the bounds of its layer, in points.
+        private struct Glyph {
+            let font: CTFont
+            let glyph: CGGlyph
+            let position: CGPoint
+            let color: UInt32
+        }
+        
+        /// The shaped glyphs of a string, and the quads last built from them.
+        private final class Run {
+            let glyphs: [Glyph]
+            var quads: Quads? = nil
+            var scale: CGFloat = 0.0
+            var generation = -1
+            
+            init(_ glyphs: [Glyph]) {
+                self.glyphs = glyphs
+            }
+        }
+        
+        /// The string of a run is an immutable copy of the layer's, as a mutable
+        /// string would change the key's hash once mutated.
+        private struct RunKey: Hashable {
+            let string: NSAttributedString
+            let size: CGSize
+        }
+        
+        /// The maximum number of runs cached.
+        private static let cacheLimit = 256
+        
+        ///
+        private static var cache: [RunKey: Run] = [:]
+        
+        /// The cached runs, least recently used first.
+        private static var cacheOrder: [RunKey] = []
+        
+        ///
+        private static var cacheLock = Lock()
+        
+        /// Returns the glyph quads of the `layer`, if it has any text, when drawn
+        /// at `scale` pixels per point, along with the atlas generation they are
+        /// drawn from. The quads are positioned relative to the origin of the
+        /// layer's bounds.
+        internal static func glyphs(of layer: DIYAnimation.TextLayer,
+                                    scale: CGFloat) -> (Quads, Int)?
+        {
+            guard let string = layer.attributedString, string.length > 0 else {
+                return nil
+            }
+            let key = RunKey(string: string.copy() as! NSAttributedString, size: layer.bounds.size)
+            return TextLayer.cacheLock.whileLocked {
+                let run: Run
+                if let r = TextLayer.cache[key] {
+                    if let i = TextLayer.cacheOrder.lastIndex(of: key) {
+                        TextLayer.cacheOrder.remove(at: i)
+                    }
+                    run = r
+                } else {
+                    while TextLayer.cacheOrder.count >= TextLayer.cacheLimit {
+                        TextLayer.cache[TextLayer.cacheOrder.removeFirst()] = nil
+                    }
+                    run = Run(TextLayer.shape(string, key.size))
+                    TextLayer.cache[key] = run
+                }
+                TextLayer.cacheOrder.append(key)
+                
+                // Rebuild the quads if the atlas was cleared since they were last built:
+                let atlas = GlyphAtlas.shared
+                if run.quads == nil || run.scale != scale || run.generation != atlas.generation {
+                    run.generation = atlas.generation
+                    run.scale = scale
+                    run.quads = Quads(run.glyphs.compactMap { TextLayer.quad($0, scale) })
+                }
+                return run.quads.map { ($0, run.generation) }
+            }
+        }
+        
+        /// Lays out the `string` within a rectangle of `size` into glyphs.
+        private static func shape(_ string: NSAttributedString, _ size: CGSize) -> [Glyph] {
+            let fs = CTFramesetterCreateWithAttributedString(string as CFAttributedString)
+            let frame = CTFramesetterCreateFrame(fs, CFRange(location: 0, length: 0),
+                                                 CGPath(rect: CGRect(origin: .zero, size: size),
+                                                        transform: nil), nil)
+            let lines = CTFrameGetLines(frame) as! [CTLine]
+            var origins = [CGPoint](repeating: .zero, count: lines.count)
+            CTFrameGetLineOrigins(frame, CFRange(location: 0, length: 0), &origins)
+            
+            var glyphs = [Glyph]()
+            for (line, origin) in zip(lines, origins) {
+                for run in CTLineGetGlyphRuns(line) as! [CTRun] {
+                    let attrs = CTRunGetAttributes(run) as NSDictionary
+                    guard let font = attrs[NSAttributedString.Key.font] as? NSFont else {
+                        continue
+                    }
+                    var color = CGColor.black
+                    if let c = attrs[NSAttributedString.Key.foregroundColor] as? NSColor {
+                        color = c.cgColor
+                    } else if let c = attrs[kCTForegroundColorAttributeName] {
+                        color = c as! CGColor
+                    }
+                    let packed = UInt32(premultiplied: SIMD4<Float>(color))
+                    
+                    let count = CTRunGetGlyphCount(run)
+                    var ids = [CGGlyph](repeating: 0, count: count)
+                    var positions = [CGPoint](repeating: .zero, count: count)
+                    CTRunGetGlyphs(run, CFRange(location: 0, length: 0), &ids)
+                    CTRunGetPositions(run, CFRange(location: 0, length: 0), &positions)
+                    for i in 0..<count {
+                        glyphs.append(Glyph(font: font as CTFont, glyph: ids[i],
+                                            position: CGPoint(x: origin.x + positions[i].x,
+                                                              y: origin.y + positions[i].y),
+                                            color: packed))
+                    }
+                }
+            }
+            return glyphs
+        }
+        
+        /// Builds the quad of `glyph` at `scale`, snapping it vertically to the
+        /// pixel grid, and horizontally to the nearest subpixel step.
+        private static func quad(_ glyph: Glyph, _ scale: CGFloat) -> GlyphInstance? {
+            let steps = GlyphAtlas.subpixelSteps
+            let px = glyph.position.x * scale, py = (glyph.position.y * scale).rounded()
+            var x = px.rounded(.down)
+            var subpixel = Int(((px - x) * CGFloat(steps)).rounded())
+            if subpixel == steps {
+                x += 1.0
+                subpixel = 0
+            }
+            
+            let e = GlyphAtlas.shared.entry(glyph.font, glyph.glyph,
+                                            size: CTFontGetSize(glyph.font) * scale,
+                                            subpixel: subpixel)
+            guard e.rect.z > 0.0 else { return nil }
+            let s = Float(scale)
+            let origin = (SIMD2<Float>(Float(x), Float(py)) + e.bearing) / s
+            return GlyphInstance(rect: SIMD4<Float>(origin.x, origin.y, e.rect.z / s, e.rect.w / s),
+                                 texRect: e.rect, color: glyph.color)
+        }
     }
     
+    /// Caches the color ramp of each gradient stop list, so that gradients are
+    /// evaluated per pixel (see `gradient_draw`) without drawing a bitmap of the
+    /// layer. Animating the points or type of a gradient only changes its
+    /// `GradientNode`, and animating its colors or locations builds a new ramp
+    /// of `rampWidth` texels, rather than redrawing the layer.
     ///
+    /// The ramp and node are also evaluated on the CPU, with the same stops and
+    /// arithmetic, for render targets without a GPU (see `render(_:in:)`).
     internal final class GradientLayer: LayerClass {
-        //image()
+        
+        /// The number of texels in each ramp.
+        internal static let rampWidth = 256
+        
+        /// The premultiplied colors of a gradient's stops, and their locations.
+        internal struct Stops: Hashable {
+            let colors: [SIMD4<Float>]
+            let locations: [Float]
+        }
+        
+        /// The premultiplied colors of a gradient at `rampWidth` evenly spaced
+        /// positions from its start to its end, uploaded to the GPU on first use.
+        internal final class Ramp {
+            
+            /// The colors, as packed unorm8 components.
+            internal let texels: [UInt32]
+            
+            ///
+            private var texture: MTLTexture? = nil
+            
+            ///
+            private let lock = Lock()
+            
+            /// Interpolates the `stops` between each pair of locations, holding
+            /// the first and last colors before and after them.
+            internal init(_ stops: Stops) {
+                let n = GradientLayer.rampWidth
+                let (colors, locations) = (stops.colors, stops.locations)
+                var texels = [UInt32](repeating: 0, count: n)
+                var j = 0
+                for i in 0..<n {
+                    let t = Float(i) / Float(n - 1)
+                    while j < locations.count - 2 && t > locations[j + 1] {
+                        j += 1
+                    }
+                    let (l0, l1) = (locations[j], locations[j + 1])
+                    let f = l1 > l0 ? min(max((t - l0) / (l1 - l0), 0.0), 1.0) : (t < l0 ? 0.0 : 1.0)
+                    texels[i] = UInt32(unorm: colors[j] + (colors[j + 1] - colors[j]) * f)
+                }
+                self.texels = texels
+            }
+            
+            /// The ramp as a texture of one row on `device`.
+            internal func texture(_ device: MTLDevice) -> MTLTexture {
+                return self.lock.whileLocked {
+                    if let t = self.texture, t.device.registryID == device.registryID {
+                        return t
+                    }
+                    let desc = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .rgba8Unorm,
+                                                                        width: self.texels.count,
+                                                                        height: 1,
+                                                                        mipmapped: false)
+                    desc.usage = .shaderRead
+                    let t = device.makeTexture(descriptor: desc)!
+                    t.replace(region: MTLRegionMake2D(0, 0, self.texels.count, 1), mipmapLevel: 0,
+                              withBytes: self.texels, bytesPerRow: self.texels.count * 4)
+                    Trace.count(.textureAllocations)
+                    Trace.count(.bytesUploaded, self.texels.count * 4)
+                    self.texture = t
+                    return t
+                }
+            }
+            
+            /// Samples the ramp at the position `t` between the centers of its
+            /// texels, as `gradient_draw` does.
+            internal func color(at t: Float) -> SIMD4<Float> {
+                let x = min(max(t, 0.0), 1.0) * Float(self.texels.count - 1)
+                let i = Int(x), f = x - Float(i)
+                let a = self.texels[i].unorm, b = self.texels[min(i + 1, self.texels.count - 1)].unorm
+                return a + (b - a) * f
+            }
+        }
+        
+        /// The maximum number of ramps cached.
+        private static let cacheLimit = 64
+        
+        ///
+        private static var cache: [Stops: Ramp] = [:]
+        
+        /// The cached ramps, least recently used first.
+        private static var cacheOrder: [Stops] = []
+        
+        ///
+        private static var cacheLock = Lock()
+        
+        /// Returns the stops of the `layer`, if it has any colors. Locations are
+        /// spread evenly if they are missing, or do not match the colors.
+        internal static func stops(of layer: DIYAnimation.GradientLayer) -> Stops? {
+            guard var colors = layer.colors, colors.count > 0 else { return nil }
+            if colors.count == 1 {
+                colors.append(colors[0])
+            }
+            let premultiplied = colors.map { c -> SIMD4<Float> in
+                let x = SIMD4<Float>(c)
+                return SIMD4<Float>(x.x * x.w, x.y * x.w, x.z * x.w, x.w)
+            }
+            var locations = (layer.locations ?? []).map { Float($0) }
+            if locations.count != colors.count {
+                locations = (0..<colors.count).map { Float($0) / Float(colors.count - 1) }
+            }
+            return Stops(colors: premultiplied, locations: locations)
+        }
+        
+        /// Returns the ramp of the `layer`, if it has any colors, building it if
+        /// its stops are not cached.
+        internal static func ramp(of layer: DIYAnimation.GradientLayer) -> Ramp? {
+            guard let stops = GradientLayer.stops(of: layer) else { return nil }
+            return GradientLayer.cacheLock.whileLocked {
+                if let r = GradientLayer.cache[stops] {
+                    if let i = GradientLayer.cacheOrder.lastIndex(of: stops) {
+                        GradientLayer.cacheOrder.remove(at: i)
+                    }
+                    GradientLayer.cacheOrder.append(stops)
+                    return r
+                }
+                while GradientLayer.cacheOrder.count >= GradientLayer.cacheLimit {
+                    GradientLayer.cache[GradientLayer.cacheOrder.removeFirst()] = nil
+                }
+                let r = Ramp(stops)
+                GradientLayer.cache[stops] = r
+                GradientLayer.cacheOrder.append(stops)
+                return r
+            }
+        }
+        
+        /// Returns the parameters the `layer` is drawn with; its points are
+        /// mapped from the unit square into its bounds.
+        internal static func node(of layer: DIYAnimation.GradientLayer) -> GradientNode {
+            let size = SIMD2<Float>(layer.bounds.size)
+            func point(_ p: CGPoint) -> SIMD2<Float> {
+                var x = SIMD2<Float>(p) * size
+                if layer.contentsAreFlipped {
+                    x.y = size.y - x.y
+                }
+                return x
+            }
+            
+            var node = GradientNode()
+            node.start = point(layer.startPoint)
+            node.end = point(layer.endPoint)
+            switch layer.type {
+            case .axial: node.type = UInt32(GradientNodeType.axial.rawValue)
+            case .radial: node.type = UInt32(GradientNodeType.radial.rawValue)
+            case .conic: node.type = UInt32(GradientNodeType.conic.rawValue)
+            }
+            return node
+        }
+        
+        /// Returns the position of `p` along the gradient of the `node`, as
+        /// `gradient_position` does.
+        internal static func position(_ node: GradientNode, _ p: SIMD2<Float>) -> Float {
+            let d = p - node.start, e = node.end - node.start
+            switch GradientNodeType(rawValue: Int32(bitPattern: node.type)) {
+            case .radial?:
+                let r = d / SIMD2<Float>(max(abs(e.x), 1e-5), max(abs(e.y), 1e-5))
+                return (r * r).sum().squareRoot()
+            case .conic?:
+                let a = (atan2(d.y, d.x) - atan2(e.y, e.x)) / (2.0 * .pi)
+                return a - a.rounded(.down)
+            default:
+                return (d * e).sum() / max((e * e).sum(), 1e-10)
+            }
+        }
+        
+        /// Draws the gradient of the `layer` into `ctx`, clipped to its rounded
+        /// bounds, for render targets without a GPU.
+        internal static func render(_ layer: DIYAnimation.GradientLayer, in ctx: CGContext) {
+            guard let ramp = GradientLayer.ramp(of: layer) else { return }
+            let t = ctx.ctm
+            let scale = abs(t.a * t.d - t.b * t.c).squareRoot()
+            let bounds = layer.bounds
+            let width = Int((bounds.width * scale).rounded(.up))
+            let height = Int((bounds.height * scale).rounded(.up))
+            guard width > 0 && height > 0 else { return }
+            
+            // Each pixel is sampled at its center; rows run from the top down,
+            // and the gradient from the bottom up:
+            let node = GradientLayer.node(of: layer)
+            let s = 1.0 / Float(scale)
+            var pixels = [UInt32](repeating: 0, count: width * height)
+            for y in 0..<height {
+                let py = (Float(height - y) - 0.5) * s
+                for x in 0..<width {
+                    let p = SIMD2<Float>((Float(x) + 0.5) * s, py)
+                    pixels[y * width + x] = UInt32(unorm: ramp.color(at: GradientLayer.position(node, p)))
+                }
+            }
+            
+            let data = pixels.withUnsafeBufferPointer { Data(buffer: $0) }
+            guard let provider = CGDataProvider(data: data as CFData),
+                let image = CGImage(width: width, height: height, bitsPerComponent: 8,
+                                    bitsPerPixel: 32, bytesPerRow: width * 4,
+                                    space: CGColor._space,
+                                    bitmapInfo: CGBitmapInfo(rawValue: CGImageAlphaInfo.premultipliedLast.rawValue),
+                                    provider: provider, decode: nil, shouldInterpolate: false,
+                                    intent: .defaultIntent) else { return }
+            let rect = CGRect(x: bounds.minX, y: bounds.minY,
+                              width: CGFloat(width) / scale, height: CGFloat(height) / scale)
+            
+            let radius = min(layer.cornerRadius, bounds.width / 2.0, bounds.height / 2.0)
+            ctx.saveGState()
+            ctx.addPath(CGPath(roundedRect: bounds, cornerWidth: radius,
+                               cornerHeight: radius, transform: nil))
+            ctx.clip()
+            ctx.draw(image, in: rect)
+            ctx.restoreGState()
+        }
     }
     
     ///
@@ -29,18 +29,6 @@ extension Render {
             internal static let swapOrder = Options(rawValue: 1 << 2)
         }
         
-        ///
-        private static var commandQueue: MTLCommandQueue?
-        
-        ///
-        private static var imageCache: [Weak<CGImage>: Image] = [:]
-        
-        ///
-        private static var textureCache: [Weak<Image>: MTLTexture] = [:]
-        
-        ///
-        private static var cacheLock = Lock()
-        
         ///
         internal var width: Int
         
@@ -59,10 +47,12 @@ extension Render {
         ///
         internal var options: Options = []
         
-        ///
-        internal var bytesPerRow: Int {
-            return self.width * self.bytesPerPixel
-        }
+        /// The distance between rows of `data`, which may exceed a row of the
+        /// receiver if it is a view of a larger image.
+        internal var bytesPerRow: Int
+        
+        /// The position of the receiver's first pixel in `data`.
+        internal var offset: Int = 0
         
         ///
         internal var dataSize: Int {
@@ -88,7 +78,7 @@ extension Render {
                            bytesPerRow: self.bytesPerRow,
                            space: CGColorSpaceCreateDeviceRGB(),
                            bitmapInfo: [],
-                           provider: CGDataProvider(data: self.data as CFData)!,
+                           provider: CGDataProvider(data: self.data.advanced(by: self.offset) as CFData)!,
                            decode: nil,
                            shouldInterpolate: true,
                            intent: .defaultIntent)!
@@ -105,6 +95,7 @@ extension Render {
             self.height = height
             self.bytesPerPixel = bytesPerPixel
             self.bitsPerComponent = bitsPerComponent
+            self.bytesPerRow = width * bytesPerPixel
             self.data = data
             self.options = options
         }
@@ -112,14 +103,16 @@ extension Render {
         ///
         internal convenience init(_ image: CGImage, _ options: Options = []) {
             
-            // Configure a new bitmap context:
+            // Configure a new bitmap context; swapping the byte order always
+            // produces 32-bit premultiplied BGRA, as used by the renderer:
+            let swap = options.contains(.swapOrder)
             let width = image.width
             let height = image.height
-            let bytesPerPixel = image.bytesPerRow / image.width
-            let bitsPerComponent = image.bitsPerComponent
-            let bytesPerRow = image.bytesPerRow
-            let colorSpace = image.colorSpace ?? CGColorSpaceCreateDeviceRGB()
-			let opt = !options.contains(.swapOrder) ? image.bitmapInfo.rawValue :
+            let bytesPerPixel = swap ? 4 : image.bytesPerRow / image.width
+            let bitsPerComponent = swap ? 8 : image.bitsPerComponent
+            let bytesPerRow = width * bytesPerPixel
+            let colorSpace = swap || image.colorSpace == nil ? CGColorSpaceCreateDeviceRGB() : image.colorSpace!
+			let opt = !swap ? image.bitmapInfo.rawValue :
 						CGBitmapInfo(arrayLiteral: CGBitmapInfo(rawValue: CGImageAlphaInfo.premultipliedFirst.rawValue), CGBitmapInfo(rawValue: CGImageByteOrderInfo.order32Little.rawValue)).rawValue
             
             // Draw the image into the new context (decoding it):
@@ -141,74 +134,66 @@ extension Render {
             self.init(width, height, bytesPerPixel, bitsPerComponent, data, options)
         }
         
-        deinit {
-            Image.cacheLock.whileLocked {
-                Image.textureCache[Weak(self)] = nil
-            }
-            // finalize... then, release data... call handlers?
+        /// Creates a texture on `device` holding the receiver, with a full chain
+        /// of mipmap levels (left undefined) if `mipmapped`.
+        internal func makeTexture(_ device: MTLDevice, mipmapped: Bool) -> MTLTexture {
+            let desc = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .bgra8Unorm,
+                                                                width: self.width,
+                                                                height: self.height,
+                                                                mipmapped: mipmapped)
+            desc.usage = .shaderRead
+            let tex = device.makeTexture(descriptor: desc)!
+            Trace.count(.textureAllocations)
+            self.draw(to: tex)
+            return tex
         }
         
-        ///
-        internal static func cached(for image: CGImage) -> Image {
-            return Image.cacheLock.whileLocked {
-                if let img = Image.imageCache[Weak(image)] {
-                    return img
-                } else {
-                    let img = Image(image)
-                    Image.imageCache[Weak(image)] = img
-                    return img
-                }
+        /// Uploads the receiver into a new texture; prefer `Image.Cache`, which
+        /// does so off the render thread, for images drawn repeatedly.
+        internal func texture(_ device: MTLDevice) -> MTLTexture {
+            let tex = self.makeTexture(device, mipmapped: self.options.contains(.mipmap))
+            if tex.mipmapLevelCount > 1, let queue = device.makeCommandQueue() {
+                Image.generateMipmaps(tex, on: queue)
             }
+            return tex
         }
         
-        ///
-        internal func texture(_ device: MTLDevice) -> MTLTexture {
-            return Image.cacheLock.whileLocked {
-                
-                // Return the previously cached texture if still valid:
-                if let tex = Image.textureCache[Weak(self)],
-                    tex.device.registryID == device.registryID {
-                    return tex
-                }
-                
-                // Transfer that bitmap data into a new `MTLTexture`:
-                let m = MTLTextureDescriptor.texture2DDescriptor(pixelFormat:width:
-                    height:mipmapped:)
-                let tex = device.makeTexture(descriptor: m(.bgra8Unorm, width, height,
-                                                           self.options.contains(.mipmap)))!
-				self.draw(to: tex)
-                
-                // If we require mipmaps, generate them:
-                if self.options.contains(.mipmap) && tex.mipmapLevelCount > 1 {
-                    if Image.commandQueue == nil {
-                        Image.commandQueue = device.makeCommandQueue()!
-                    }
-                    let b = Image.commandQueue!.makeCommandBuffer()!
-                    let c = b.makeBlitCommandEncoder()!
-                    c.generateMipmaps(for: tex)
-                    c.endEncoding()
-                    b.commit()
-                    b.waitUntilCompleted()
-                }
-                
-                // Cache and return the texture:
-                Image.textureCache[Weak(self)] = tex
-                return tex
-            }
+        /// Fills in every mipmap level of `texture` from its first, waiting for
+        /// the GPU to finish; must not be called on the render thread.
+        internal static func generateMipmaps(_ texture: MTLTexture, on queue: MTLCommandQueue) {
+            let b = queue.makeCommandBuffer()!
+            let c = b.makeBlitCommandEncoder()!
+            c.generateMipmaps(for: texture)
+            c.endEncoding()
+            b.commit()
+            b.waitUntilCompleted()
         }
         
         ///
 		internal func draw(to texture: MTLTexture) {
 			let r = MTLRegionMake2D(0, 0, self.width, self.height)
-			self.data.withUnsafeMutableBytes { (x: UnsafeMutableRawBufferPointer) -> Void in
-				texture.replace(region: r, mipmapLevel: 0, withBytes: x.baseAddress!,
-							bytesPerRow: self.width * self.bytesPerPixel)
+			self.data.withUnsafeBytes { (x: UnsafeRawBufferPointer) -> Void in
+				texture.replace(region: r, mipmapLevel: 0, withBytes: x.baseAddress! + self.offset,
+							bytesPerRow: self.bytesPerRow)
 			}
+            Trace.count(.bytesUploaded, self.height * self.width * self.bytesPerPixel)
         }
         
-        /// TODO: Copy sub-image range...
-        internal func copy(subrange: (width: Int, height: Int)) -> Image? {
-            return nil
+        /// Returns a view of the pixels of the receiver within `subrange`, which
+        /// shares the receiver's `data` rather than copying it; only the view's
+        /// own texture is uploaded separately. Returns `nil` if `subrange` is not
+        /// entirely within the receiver.
+        internal func copy(subrange: (x: Int, y: Int, width: Int, height: Int)) -> Image? {
+            guard subrange.x >= 0 && subrange.y >= 0 && subrange.width > 0 && subrange.height > 0 &&
+                subrange.x + subrange.width <= self.width &&
+                subrange.y + subrange.height <= self.height else { return nil }
+            
+            let view = Image(subrange.width, subrange.height, self.bytesPerPixel,
+                             self.bitsPerComponent, self.data, self.options)
+            view.bytesPerRow = self.bytesPerRow
+            view.offset = self.offset + subrange.y * self.bytesPerRow + subrange.x * self.bytesPerPixel
+            view.memory = self.memory
+            return view
         }
     }
 }
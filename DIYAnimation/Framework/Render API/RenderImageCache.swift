@@ -0,0 +1,383 @@
+import Foundation
+import Metal
+
+/// A `Drawable` whose texture is loaded by `Render.Image.Cache` rather than on
+/// the render thread.
+internal protocol RenderCachedImage: AnyObject {
+    
+    /// Returns the receiver as a `CGImage`; called on a background queue.
+    func decodableImage() -> CGImage?
+}
+
+extension Render.Image {
+    
+    /// A process-wide cache of the textures of images drawn as layer contents.
+    ///
+    /// Images are decoded and uploaded on a background queue, so the render
+    /// thread never waits on either: an image is simply not drawn until its
+    /// texture is ready, at which point `generation` advances and
+    /// `didLoadNotification` is posted to `Render.notificationCenter`, so that
+    /// a frame may be scheduled (see `Renderer.nextFrameTime()`). Mipmaps are
+    /// only generated once an image is drawn with a trilinear filter.
+    ///
+    /// Entries are keyed by the identity of their source image and the
+    /// `contentsRect` drawn from it, and spread over independently locked shards
+    /// so that the render thread rarely contends with loading threads. The
+    /// texture of a sub-rectangle holds only its own pixels, uploaded from a
+    /// view of the decoded bytes of the image, which are retained so that other
+    /// sub-rectangles (such as the frames of a sprite sheet) share one decode.
+    /// Each shard evicts the entries of released images, then its least
+    /// recently drawn entries, once it exceeds its share of `byteLimit`.
+    internal final class Cache {
+        
+        ///
+        internal static let shared = Cache()
+        
+        /// Posted to `Render.notificationCenter` whenever a texture is loaded.
+        internal static let didLoadNotification = Notification.Name("Render.Image.Cache.didLoad")
+        
+        /// The number of shards; a power of two.
+        private static let shardCount = 8
+        
+        /// The `contentsRect` that covers a whole image.
+        private static let unitRect = CGRect(x: 0, y: 0, width: 1, height: 1)
+        
+        /// Identifies the texture of the `rect` of an image, in its unit
+        /// coordinates, or if `rect` is `nil`, the decoded bytes of the image.
+        private struct Key: Hashable {
+            
+            ///
+            let source: ObjectIdentifier
+            
+            ///
+            let rect: SIMD4<Double>?
+            
+            ///
+            init(_ source: AnyObject, _ rect: CGRect?) {
+                self.source = ObjectIdentifier(source)
+                self.rect = rect.map { SIMD4(Double($0.minX), Double($0.minY),
+                                             Double($0.width), Double($0.height)) }
+            }
+        }
+        
+        ///
+        private final class Entry {
+            
+            ///
+            let key: Key
+            
+            /// The image the entry was created for; an entry whose source no
+            /// longer matches its key is stale, as the key may have been reused.
+            weak var source: AnyObject?
+            
+            ///
+            var texture: MTLTexture? = nil
+            
+            /// The decoded bytes of the source, if the entry holds them.
+            var image: Render.Image? = nil
+            
+            /// The `registryID` of the device of `texture`.
+            var device: UInt64 = 0
+            
+            /// Whether a texture is being loaded for the entry.
+            var isLoading = false
+            
+            /// Whether the source could not be decoded; it is not tried again.
+            var isFailed = false
+            
+            /// The size of `texture` or `image`, in bytes.
+            var cost = 0
+            
+            /// The next more recently used entry.
+            weak var newer: Entry? = nil
+            
+            /// The next less recently used entry.
+            var older: Entry? = nil
+            
+            ///
+            init(_ key: Key, _ source: AnyObject) {
+                self.key = key
+                self.source = source
+            }
+        }
+        
+        /// A set of entries with their own lock and recency list.
+        private final class Shard {
+            
+            ///
+            let lock = Lock()
+            
+            ///
+            var entries: [Key: Entry] = [:]
+            
+            /// The most recently used entry.
+            var newest: Entry? = nil
+            
+            /// The least recently used entry.
+            weak var oldest: Entry? = nil
+            
+            /// The total `cost` of the entries.
+            var bytes = 0
+            
+            /// Marks the entry as the most recently used. Note: the shard's lock
+            /// must be held.
+            func touch(_ entry: Entry) {
+                guard self.newest !== entry else { return }
+                self.unlink(entry)
+                entry.older = self.newest
+                self.newest?.newer = entry
+                self.newest = entry
+                if self.oldest == nil {
+                    self.oldest = entry
+                }
+            }
+            
+            /// Note: the shard's lock must be held.
+            func unlink(_ entry: Entry) {
+                if self.newest === entry { self.newest = entry.older }
+                if self.oldest === entry { self.oldest = entry.newer }
+                entry.newer?.older = entry.older
+                entry.older?.newer = entry.newer
+                entry.newer = nil
+                entry.older = nil
+            }
+            
+            /// Note: the shard's lock must be held.
+            func remove(_ entry: Entry) {
+                self.unlink(entry)
+                self.entries[entry.key] = nil
+                self.bytes -= entry.cost
+            }
+            
+            /// Removes the entries whose source has been released, then the least
+            /// recently used entries until the shard holds no more than `limit`
+            /// bytes, keeping the most recently used entry. Note: the shard's lock
+            /// must be held.
+            func evict(to limit: Int) {
+                for entry in self.entries.values where entry.source == nil {
+                    self.remove(entry)
+                }
+                while self.bytes > limit, let entry = self.oldest, entry !== self.newest || limit == 0 {
+                    self.remove(entry)
+                }
+            }
+        }
+        
+        /// The maximum number of bytes of textures retained by the cache.
+        internal var byteLimit: Int = 256 * 1024 * 1024 {
+            didSet {
+                self.evict(to: self.byteLimit)
+            }
+        }
+        
+        /// Advances whenever a texture is loaded.
+        internal var generation: UInt64 {
+            return self.lock.whileLocked { self._generation }
+        }
+        
+        ///
+        private var _generation: UInt64 = 0
+        
+        ///
+        private let shards = (0..<Cache.shardCount).map { _ in Shard() }
+        
+        /// Decodes and uploads images; concurrent, so one large image does not
+        /// hold up every other.
+        private let queue = DispatchQueue(label: "Render.Image.Cache", qos: .userInitiated,
+                                          attributes: .concurrent)
+        
+        /// The command queue used to generate mipmaps, by device `registryID`.
+        private var commandQueues: [UInt64: MTLCommandQueue] = [:]
+        
+        /// Guards `_generation` and `commandQueues`.
+        private let lock = Lock()
+        
+        ///
+        private var pressureSource: DispatchSourceMemoryPressure? = nil
+        
+        ///
+        private init() {
+            let source = DispatchSource.makeMemoryPressureSource(eventMask: [.warning, .critical],
+                                                                 queue: .global(qos: .utility))
+            source.setEventHandler { [unowned self] in
+                self.evict(to: source.data.contains(.critical) ? 0 : self.byteLimit / 2)
+            }
+            source.resume()
+            self.pressureSource = source
+        }
+        
+        /// Returns the texture of the `contentsRect` of `image` on `device`,
+        /// mipmapped if requested, or `nil` if it is still loading or the rect
+        /// is empty; never blocks on decoding or uploading. The rect is clipped
+        /// to the unit rectangle, with its origin at the first row of the image.
+        ///
+        /// While mipmaps are being generated, the texture without them is returned.
+        internal func texture(for image: RenderCachedImage, _ device: MTLDevice,
+                              contentsRect: CGRect,
+                              mipmapped: Bool) -> MTLTexture?
+        {
+            let rect = contentsRect.standardized.intersection(Cache.unitRect)
+            guard rect.width > 0 && rect.height > 0 else { return nil }
+            let key = Key(image, rect)
+            let shard = self.shards[key.source.hashValue & (Cache.shardCount - 1)]
+            return shard.lock.whileLocked {
+                if let stale = shard.entries[key], stale.source !== image {
+                    shard.remove(stale)
+                }
+                let entry = shard.entries[key] ?? Entry(key, image)
+                shard.entries[key] = entry
+                shard.touch(entry)
+                
+                if let tex = entry.texture, entry.device == device.registryID {
+                    if mipmapped && tex.mipmapLevelCount == 1 && max(tex.width, tex.height) > 1 &&
+                        !entry.isLoading
+                    {
+                        entry.isLoading = true
+                        self.queue.async {
+                            self.finish(entry, shard, self.mipmapped(tex), device)
+                        }
+                    }
+                    return tex
+                }
+                if !entry.isLoading && !entry.isFailed {
+                    entry.isLoading = true
+                    self.queue.async {
+                        Trace.scope("Image.Cache.load") {
+                            guard let decoded = self.decoded(image, shard, retain: rect != Cache.unitRect),
+                                let view = decoded.copy(subrange: Cache.pixels(of: rect, in: decoded)) else
+                            {
+                                self.finish(entry, shard, nil, device)
+                                return
+                            }
+                            let mip = mipmapped && max(view.width, view.height) > 1
+                            let tex = view.makeTexture(device, mipmapped: mip)
+                            if mip {
+                                Render.Image.generateMipmaps(tex, on: self.commandQueue(device))
+                            }
+                            self.finish(entry, shard, tex, device)
+                        }
+                    }
+                }
+                return nil
+            }
+        }
+        
+        /// Releases all textures retained by the cache.
+        internal func drain() {
+            self.evict(to: 0)
+        }
+        
+        ///
+        private func evict(to limit: Int) {
+            for shard in self.shards {
+                shard.lock.whileLocked {
+                    shard.evict(to: limit / Cache.shardCount)
+                }
+            }
+        }
+        
+        /// Returns the decoded bytes of `image`, shared with any sub-rectangles
+        /// already loaded, or decodes them; they are retained for later ones if
+        /// `retain`. Called on `queue`.
+        private func decoded(_ image: RenderCachedImage, _ shard: Shard, retain: Bool) -> Render.Image? {
+            let key = Key(image, nil)
+            let retained: Render.Image? = shard.lock.whileLocked {
+                guard let entry = shard.entries[key], entry.source === image else { return nil }
+                shard.touch(entry)
+                return entry.image
+            }
+            if let decoded = retained {
+                return decoded
+            }
+            guard let cg = image.decodableImage(), cg.width > 0, cg.height > 0 else { return nil }
+            let decoded = Render.Image(cg, [.swapOrder])
+            guard retain else { return decoded }
+            
+            shard.lock.whileLocked {
+                if let stale = shard.entries[key] {
+                    shard.remove(stale)
+                }
+                let entry = Entry(key, image)
+                entry.image = decoded
+                entry.cost = decoded.dataSize
+                shard.entries[key] = entry
+                shard.touch(entry)
+                shard.bytes += entry.cost
+                shard.evict(to: self.byteLimit / Cache.shardCount)
+            }
+            return decoded
+        }
+        
+        /// Returns the pixels of `image` covered by the unit `rect`, rounded
+        /// outwards and at least one pixel in each dimension.
+        private static func pixels(of rect: CGRect, in image: Render.Image)
+            -> (x: Int, y: Int, width: Int, height: Int)
+        {
+            let w = CGFloat(image.width), h = CGFloat(image.height)
+            let x = min(Int((rect.minX * w).rounded(.down)), image.width - 1)
+            let y = min(Int((rect.minY * h).rounded(.down)), image.height - 1)
+            let maxX = min(max(Int((rect.maxX * w).rounded(.up)), x + 1), image.width)
+            let maxY = min(max(Int((rect.maxY * h).rounded(.up)), y + 1), image.height)
+            return (x, y, maxX - x, maxY - y)
+        }
+        
+        /// Stores a loaded texture in its entry, unless the entry was evicted
+        /// while it was loading.
+        private func finish(_ entry: Entry, _ shard: Shard, _ texture: MTLTexture?, _ device: MTLDevice) {
+            let stored: Bool = shard.lock.whileLocked {
+                entry.isLoading = false
+                guard let tex = texture else {
+                    entry.isFailed = entry.texture == nil
+                    return false
+                }
+                guard shard.entries[entry.key] === entry else { return false }
+                shard.bytes -= entry.cost
+                entry.texture = tex
+                entry.device = device.registryID
+                entry.cost = tex.width * tex.height * 4 * (tex.mipmapLevelCount > 1 ? 4 : 3) / 3
+                shard.bytes += entry.cost
+                shard.evict(to: self.byteLimit / Cache.shardCount)
+                return true
+            }
+            guard stored else { return }
+            self.lock.whileLocked { self._generation += 1 }
+            Render.notificationCenter.post(name: Cache.didLoadNotification, object: self)
+        }
+        
+        /// Returns a copy of `texture` with mipmaps generated from its first level.
+        private func mipmapped(_ texture: MTLTexture) -> MTLTexture {
+            let desc = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: texture.pixelFormat,
+                                                                width: texture.width,
+                                                                height: texture.height,
+                                                                mipmapped: true)
+            desc.usage = .shaderRead
+            let tex = texture.device.makeTexture(descriptor: desc)!
+            Trace.count(.textureAllocations)
+            
+            let b = self.commandQueue(texture.device).makeCommandBuffer()!
+            let c = b.makeBlitCommandEncoder()!
+            c.copy(from: texture, sourceSlice: 0, sourceLevel: 0,
+                   sourceOrigin: MTLOrigin(x: 0, y: 0, z: 0),
+                   sourceSize: MTLSize(width: texture.width, height: texture.height, depth: 1),
+                   to: tex, destinationSlice: 0, destinationLevel: 0,
+                   destinationOrigin: MTLOrigin(x: 0, y: 0, z: 0))
+            c.generateMipmaps(for: tex)
+            c.endEncoding()
+            b.commit()
+            b.waitUntilCompleted()
+            return tex
+        }
+        
+        ///
+        private func commandQueue(_ device: MTLDevice) -> MTLCommandQueue {
+            return self.lock.whileLocked {
+                if let q = self.commandQueues[device.registryID] {
+                    return q
+                }
+                let q = device.makeCommandQueue()!
+                self.commandQueues[device.registryID] = q
+                return q
+            }
+        }
+    }
+}
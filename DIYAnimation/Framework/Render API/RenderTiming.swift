@@ -3,6 +3,11 @@ import Foundation
 extension Render {
     
     /// A cacheable sub-container for `Animation` and `Layer` to host their timing info.
+    ///
+    /// Times are mapped between three spaces: the parent's time, the active
+    /// time (elapsed since `beginTime`, scaled by `speed` and offset by
+    /// `timeOffset`), and the local time (within a single `duration`, after
+    /// repetition and reversal).
     internal struct Timing: MediaTiming, RenderValue {
         var beginTime: TimeInterval = 0.0
         var duration: TimeInterval = 0.0
@@ -14,52 +19,101 @@ extension Render {
         var fillMode: DIYAnimation.Animation.FillMode = .removed
         
         ///
+        init() {}
+        
+        /// Copies the timing of `other`.
+        init(_ other: MediaTiming) {
+            self.beginTime = other.beginTime
+            self.duration = other.duration
+            self.speed = other.speed
+            self.timeOffset = other.timeOffset
+            self.repeatCount = other.repeatCount
+            self.repeatDuration = other.repeatDuration
+            self.autoreverses = other.autoreverses
+            self.fillMode = other.fillMode
+        }
+        
+        /// The length of the active period in active time, including all
+        /// repetitions and reversals.
         var activeDuration: TimeInterval {
-            return 0.0
+            if self.repeatDuration > 0.0 {
+                return self.repeatDuration
+            }
+            let cycle = self.duration * (self.autoreverses ? 2.0 : 1.0)
+            return cycle * Double(max(self.repeatCount, 1))
         }
         
-        ///
+        /// The parent time at which the active period ends.
         var endTime: TimeInterval {
-            return self.beginTime + self.activeDuration
+            return self.map(activeToParent: self.activeDuration)
         }
         
-        ///
-        func next(beginTime: TimeInterval) -> TimeInterval {
-            return 0.0
+        /// The earliest parent time, no earlier than `time`, at which the local
+        /// time changes: `time` itself while active, the `beginTime` before it,
+        /// or `.infinity` if the local time is constant from `time` on.
+        func next(after time: TimeInterval) -> TimeInterval {
+            guard self.speed != 0.0 && self.duration > 0.0 else {
+                return .infinity
+            }
+            let begin = self.inverseMap(time: 0.0)
+            if time < begin {
+                return begin
+            }
+            return time < self.endTime ? time : .infinity
         }
         
-        ///
+        /// Maps the parent `time` to local time, or `.nan` if the receiver is
+        /// removed at that time (per its `fillMode`).
         func map(time: Double) -> Double {
-            // map parent to active
-            // map active to local
-            return 0.0
+            return self.map(activeToLocal: self.map(parentToActive: time))
         }
         
-        ///
+        /// Maps the local `time` of the first repetition to parent time.
         func inverseMap(time: Double) -> Double {
-            // map local to active
-            // map active to parent
-            return 0.0
+            return self.map(activeToParent: self.map(localToActive: time))
         }
         
         ///
-        func map(activeToLocal: Double) -> Double {
-            return 0.0
+        func map(activeToLocal t: Double) -> Double {
+            let fillsBackwards = self.fillMode == .backwards || self.fillMode == .both
+            let fillsForwards = self.fillMode == .forwards || self.fillMode == .both
+            let active = self.activeDuration
+            guard self.duration > 0.0 else { return .nan }
+            
+            // Before and after the active period, hold the first or last value:
+            if t < 0.0 {
+                return fillsBackwards ? 0.0 : .nan
+            } else if t >= active {
+                guard fillsForwards else { return .nan }
+                let cycles = active / self.duration
+                let reversed = self.autoreverses && Int(cycles.rounded(.up)) % 2 == 0
+                // A remainder of zero ends a complete (forward or reversed) half:
+                let end = active.truncatingRemainder(dividingBy: self.duration)
+                if reversed {
+                    return end == 0.0 ? 0.0 : self.duration - end
+                }
+                return end == 0.0 ? self.duration : end
+            }
+            
+            // Within it, fold the time into a single (possibly reversed) cycle:
+            let cycle = self.duration * (self.autoreverses ? 2.0 : 1.0)
+            let local = t.truncatingRemainder(dividingBy: cycle)
+            return local > self.duration ? cycle - local : local
         }
         
         ///
-        func map(activeToParent: Double) -> Double {
-            return 0.0
+        func map(activeToParent t: Double) -> Double {
+            return (t - self.timeOffset) / self.speed + self.beginTime
         }
         
         ///
-        func map(localToActive: Double) -> Double {
-            return 0.0
+        func map(localToActive t: Double) -> Double {
+            return t
         }
         
         ///
-        func map(parentToActive: Double) -> Double {
-            return 0.0
+        func map(parentToActive t: Double) -> Double {
+            return (t - self.beginTime) * self.speed + self.timeOffset
         }
     }
 }
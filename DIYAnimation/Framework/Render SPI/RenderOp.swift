@@ -19,11 +19,13 @@ internal class RenderOp {
         /// Container struct to hold all the various pipeline and sampler states used.
         internal struct Pipeline {
             fileprivate var composite: MTLRenderPipelineState!
-            fileprivate var background: MTLRenderPipelineState!
-            fileprivate var contents: MTLRenderPipelineState!
-            fileprivate var border: MTLRenderPipelineState!
+            fileprivate var draw: MTLRenderPipelineState!
+            fileprivate var clip: MTLRenderPipelineState!
             fileprivate var shadow: MTLRenderPipelineState!
-            fileprivate var mask: MTLComputePipelineState!
+            fileprivate var mask: MTLRenderPipelineState!
+            fileprivate var shape: MTLRenderPipelineState!
+            fileprivate var text: MTLRenderPipelineState!
+            fileprivate var gradient: MTLRenderPipelineState!
             
             fileprivate var linear_linearSampler: MTLSamplerState!
             fileprivate var linear_nearestSampler: MTLSamplerState!
@@ -33,6 +35,20 @@ internal class RenderOp {
             fileprivate var trilinear_nearestSampler: MTLSamplerState!
             
             fileprivate var depthState: MTLDepthStencilState!
+            
+            fileprivate var clipTestState: MTLDepthStencilState!
+            fileprivate var clipPushState: MTLDepthStencilState!
+            fileprivate var clipPopState: MTLDepthStencilState!
+            fileprivate var clipNoneState: MTLDepthStencilState!
+        }
+        
+        /// The stencil clip of a texture in the `textureStack`. The stencil holds
+        /// the number of nested clips covering each pixel, and only pixels at the
+        /// current `depth` are drawn.
+        fileprivate struct Clip {
+            fileprivate let texture: MTLTexture
+            fileprivate let stencil: MTLTexture
+            fileprivate var depth: Int
         }
         
         /// The stack of textures currently used.
@@ -45,6 +61,9 @@ internal class RenderOp {
         /// Mask boundaries indicate start-points for flatten operations.
         fileprivate var boundaries: [Int] = []
         
+        /// The stencil clips of each texture rendered into, keyed by texture.
+        fileprivate var clips: [ObjectIdentifier: Clip] = [:]
+        
         /// The current encoder that corresponds to the topmost texture, if any.
         fileprivate var encoder: MTLRenderCommandEncoder? = nil
         
@@ -59,28 +78,58 @@ internal class RenderOp {
         fileprivate var ciContext: CIContext? = nil
         
         /// The global scene viewport matrix (in MVP terms).
-        fileprivate var viewport: MTLBuffer? = nil
+        fileprivate var global: GlobalNode
+        
+        /// The shared buffer containing `global`, if any; otherwise, the node
+        /// is set inline for each pass.
+        fileprivate var globalBuffer: MTLBuffer? = nil
+        
+        /// The index of the `LayerNode` drawn by layer operations.
+        fileprivate var node: Int = 0
         
         /// Creates a new `RenderOp.State`.
-        /// Create and cache the `Pipeline` until the `MTLDevice` changes.
+        /// Create and cache the `Pipeline` until the `MTLDevice` changes, and the
+        /// `globalBuffer` (see `globalNode(_:_:_:)`) until the viewport changes.
         internal init(_ command: MTLCommandBuffer,
                       _ ciContext: CIContext,
                       _ pipeline: Pipeline,
-                      _ viewport: float4x4)
+                      _ viewport: float4x4,
+                      _ size: MTLSize,
+                      globalBuffer: MTLBuffer? = nil)
         {
             self.command = command
             self.ciContext = ciContext
             self.pipeline = pipeline
-            
-            // Create the global node's buffer ahead-of-time:
-            let buffer = command.device.makeBuffer(length: MemoryLayout<GlobalNode>.size,
-                                                   options: .storageModeManaged)!
-            let ptr = buffer.contents().bindMemory(to: GlobalNode.self, capacity: 1)
-            defer { buffer.didModifyRange(0..<buffer.length) }
+            self.global = RenderOp.State.global(viewport, size)
+            self.globalBuffer = globalBuffer
+        }
+        
+        /// Creates a `GlobalNode` buffer that may be shared by every frame and
+        /// pass rendered with the same viewport.
+        internal static func globalNode(_ device: MTLDevice, _ viewport: float4x4,
+                                        _ size: MTLSize) -> MTLBuffer
+        {
+            var g = RenderOp.State.global(viewport, size)
+            return device.makeBuffer(bytes: &g, length: MemoryLayout<GlobalNode>.size,
+                                     options: .storageModeManaged)!
+        }
+        
+        ///
+        private static func global(_ viewport: float4x4, _ size: MTLSize) -> GlobalNode {
             var g = GlobalNode()
             g.transform = viewport
-            ptr.pointee = g
-            self.viewport = buffer
+            g.viewport = SIMD4<Float>(0, 0, Float(size.width), Float(size.height))
+            return g
+        }
+    }
+    
+    /// The per-pass node buffers referenced by `AttachBufferOp`. The transform
+    /// buffer is only created once all nodes are known, if any are 3D.
+    fileprivate final class Buffers {
+        fileprivate let layers: MTLBuffer
+        fileprivate var transforms: MTLBuffer? = nil
+        fileprivate init(_ layers: MTLBuffer) {
+            self.layers = layers
         }
     }
     
@@ -96,9 +145,14 @@ internal class RenderOp {
     }
     
     /// Create a new `RenderOp` executing a sequence of operations that correspond
-    /// to rendering `layer` into a texture of size `size`.
+    /// to rendering `layer` into a texture of size `size` for the frame at `time`.
+    /// The texture has `scale` pixels per point (i.e. the backing scale).
+    ///
+    /// The `handler` converts each layer into its `LayerNode`, appending any 3D
+    /// transform it requires to the transform list.
     internal convenience init(for layer: Layer, with device: MTLDevice, size: MTLSize,
-                  _ handler: (Layer) -> (LayerNode))
+                              scale: CGFloat, at time: TimeInterval,
+                              _ handler: (Layer, inout [float4x4]) -> (LayerNode))
     {
         // Perform an action before and after visiting the layer's sublayers.
         // State from the pre-visit is transferred to the post-visit handler.
@@ -121,18 +175,68 @@ internal class RenderOp {
         let buffer = device.makeBuffer(length: count * MemoryLayout<LayerNode>.size,
                                        options: .storageModeManaged)!
         let ptr = buffer.contents().bindMemory(to: LayerNode.self, capacity: count)
-        defer { buffer.didModifyRange(0..<buffer.length) }
+        let buffers = Buffers(buffer)
+        var transforms = [float4x4]()
+        defer {
+            buffer.didModifyRange(0..<buffer.length)
+            Trace.count(.bytesUploaded, buffer.length)
+            if transforms.count > 0 {
+                buffers.transforms = device.makeBuffer(bytes: transforms,
+                                                       length: transforms.count *
+                                                            MemoryLayout<float4x4>.stride,
+                                                       options: .storageModeManaged)!
+                Trace.count(.bytesUploaded, buffers.transforms!.length)
+            }
+        }
+        
+        // Clear the glyph atlas, if it filled up, before any text is drawn:
+        Render.GlyphAtlas.shared.prepareFrame()
+        
+        // The pixels per point at which the sublayers of each layer visited appear
+        // on screen, accumulated from the transforms of all of their ancestors:
+        var scales = [scale]
         
         // Visit all layers in this tree and transform them into render ops:
         var ops = [RenderOp]()
         ops.append(PushTextureOp(size))
-        ops.append(AttachBufferOp(buffer))
-        visit(layer, preVisit: { l -> (Int, Bool) in
+        ops.append(AttachBufferOp(buffers))
+        visit(layer, preVisit: { l -> (Int, Bool, Bool, Bool) in
             
             // Bind the buffer memory to the layer node:
             let id = vendor.next()!
-            ptr.advanced(by: id).pointee = handler(l)
-            let offscreen = l.needsOffscreenRendering
+            ptr.advanced(by: id).pointee = handler(l, &transforms)
+            let offscreen = l.needsOffscreenRendering || l._isMask
+            Trace.count(.layersVisited)
+            
+            // The layer appears scaled by its own transform, and its sublayers
+            // by its sublayer transform too:
+            let presented = l.presentedLayer(at: time)
+            let layerScale = scales.last! * RenderOp.scale(of: presented.transform)
+            scales.append(layerScale * RenderOp.scale(of: presented.sublayerTransform))
+            
+            // Shapes and text are drawn as presented at the frame time, from cached
+            // meshes between the contents and the sublayers of the layer.
+            // They are tessellated and rasterized at the scale they appear on screen.
+            let rasterScale = RenderOp.rasterScale(layerScale)
+            let shape = presented as? ShapeLayer
+            let text = presented as? TextLayer
+            let shapeFill = shape.flatMap { Render.ShapeLayer.fill(of: $0, scale: rasterScale) }
+            let shapeStroke = shape.flatMap { Render.ShapeLayer.stroke(of: $0, scale: rasterScale) }
+            let glyphs = text.flatMap { Render.TextLayer.glyphs(of: $0, scale: rasterScale) }
+            let hasMeshes = shapeFill != nil || shapeStroke != nil || glyphs != nil
+            
+            // Gradients are drawn atop the contents as presented at the frame time,
+            // from the cached ramp of their stops:
+            let gradient = (l as? GradientLayer).map { $0.layer(at: time) }
+            let ramp = gradient.flatMap { Render.GradientLayer.ramp(of: $0) }
+            
+            // Clipping sublayers (and meshes) to the rounded bounds is done with
+            // the stencil, and the border is drawn with the rest of the layer
+            // unless it must be drawn atop any sublayers, meshes, or mask.
+            let clipped = l.masksToBounds && (l.sublayers.count > 0 || hasMeshes)
+            let hasBorder = l.borderWidth > 0.0 && l.borderColor.alpha > 0.0
+            let deferBorder = hasBorder && (l.sublayers.count > 0 || l.mask != nil ||
+                                            hasMeshes || ramp != nil)
             
             // Queue all the pre-sublayer-visit operations:
             let bf = l.backgroundFilters?.compactMap { $0 as? CIFilter } ?? []
@@ -142,65 +246,96 @@ internal class RenderOp {
                 //
                 // TODO: bg_filter is also affected by mask!
                 //
-                ops.append(AttachBufferOp(buffer))
+                ops.append(AttachBufferOp(buffers))
             }
             if offscreen {
                 ops.append(PushTextureOp(size))
-                ops.append(AttachBufferOp(buffer))
+                ops.append(AttachBufferOp(buffers))
+                Trace.count(.offscreenPasses)
             }
             ops.append(AttachLayerOp(id))
+            var flags: DrawOp.Flags = []
             if l.backgroundColor.alpha > 0.0 {
-                ops.append(BackgroundOp())
+                flags.insert(.background)
             }
-            if let c = l.contents?.texture(device) {
-                ops.append(ContentsOp(c, (l.minificationFilter,
-                                          l.magnificationFilter)))
+            let contents = l.contents?.texture(device, at: l.convert(time, from: nil),
+                                               frameTime: time,
+                                               contentsRect: l.contentsRect,
+                                               mipmapped: l.minificationFilter == .trilinear)
+            if contents != nil {
+                flags.insert(l.masksToBounds ? [.contents, .clipContents] : .contents)
+            }
+            if hasBorder && !deferBorder {
+                flags.insert(.border)
+            }
+            if !flags.isEmpty {
+                ops.append(DrawOp(flags, contents, (l.minificationFilter,
+                                                    l.magnificationFilter)))
+            }
+            if let g = gradient, let r = ramp {
+                ops.append(GradientOp(r, Render.GradientLayer.node(of: g)))
+            }
+            if clipped {
+                ops.append(ClipOp(push: true))
+            }
+            if let s = shape, let m = shapeFill {
+                ops.append(ShapeOp(m, s, s.fillColor!, Render.ShapeLayer.untrimmed))
+            }
+            if let s = shape, let m = shapeStroke {
+                ops.append(ShapeOp(m.0, s, s.strokeColor!, m.1))
+            }
+            if let t = text, let g = glyphs {
+                ops.append(TextOp(g.0, g.1, t))
             }
             
-            return (id, offscreen)
-        }, postVisit: { l, _x in let (id, offscreen) = _x
+            return (id, offscreen, clipped, deferBorder)
+        }, postVisit: { l, _x in let (id, offscreen, clipped, deferBorder) = _x
+            scales.removeLast()
             
             // Queue all the post-sublayer-visit operations:
             ops.append(AttachLayerOp(id))
-            if l.borderWidth > 0.0 && l.borderColor.alpha > 0.0 {
-                ops.append(BorderOp())
+            if clipped {
+                ops.append(ClipOp(push: false))
+            }
+            if deferBorder {
+                ops.append(DrawOp(.border, nil, (.linear, .linear)))
             }
             if offscreen {
                 let lf = l.filters?.compactMap { $0 as? CIFilter } ?? []
                 if lf.count > 0 {
                     ops.append(FilterOp(lf, reattach: false))
                 }
-                ops.append(PopTextureOp())
-                if let cf = l.compositingFilter as? CIFilter {
+                if l._isMask {
+                    
+                    // Leave the mask as the last popped texture for its owner:
+                    ops.append(PopTextureOp())
+                } else if l.mask != nil {
+                    //
+                    // TODO: compositingFilter and shadow are ignored when masked!
+                    //
+                    ops.append(MaskOp())
+                } else if let cf = l.compositingFilter as? CIFilter {
+                    ops.append(PopTextureOp())
                     ops.append(FlattenOp())
                     ops.append(CompositeFilterOp(cf))
                 } else if l.shadowOpacity > 0.0 {
                     //
                     // TODO: shadow must match layer transform!
                     //
+                    ops.append(PopTextureOp())
                     ops.append(ShadowOp(sigma: Float(l.shadowRadius)))
-                    ops.append(AttachBufferOp(buffer))
+                    ops.append(AttachBufferOp(buffers))
                     ops.append(AttachLayerOp(id))
                     ops.append(CompositeShadowOp())
                 } else {
+                    ops.append(PopTextureOp())
                     ops.append(CompositeOp())
                 }
-                if l.masksToBounds || l.mask != nil {
-                    // TODO: compositeop should support mask (multiple!) inputs
-                    //
-                    // TODO: if masking needed + c_filter, filter in-place
-                    // without composite, run separate compositeop
-                    //
-                    // order: draw mask layer -> tex, then draw bounds -> tex
-                    // NOTE: mask cannot have another mask on it
-                    //
-                    
-                    //ops.append(MaskOp())
-                }
-                ops.append(AttachBufferOp(buffer))
+                ops.append(AttachBufferOp(buffers))
             }
         })
         ops.append(PopTextureOp(attach: false))
+        Trace.count(.opsEmitted, ops.count)
         
         self.init()
         self.ops = ops
@@ -227,73 +362,202 @@ internal class RenderOp {
 ///
 /// - **state modified:** `encoder.buffer`
 fileprivate class AttachBufferOp: RenderOp {
-    fileprivate let buffer: MTLBuffer
-    fileprivate init(_ buffer: MTLBuffer) {
-        self.buffer = buffer
+    fileprivate let buffers: Buffers
+    fileprivate init(_ buffers: Buffers) {
+        self.buffers = buffers
     }
     fileprivate override func perform(_ state: RenderOp.State) {
-        state.encoder!.setVertexBuffer(state.viewport!, offset: 0, at: .globalNode)
-        state.encoder!.setVertexBuffer(self.buffer, offset: 0, at: .layerNode)
-        state.encoder!.setFragmentBuffer(self.buffer, offset: 0, at: .layerNode)
+        if let global = state.globalBuffer {
+            state.encoder!.setVertexBuffer(global, offset: 0, at: .globalNode)
+        } else {
+            state.encoder!.setVertexBytes(&state.global, length: MemoryLayout<GlobalNode>.size,
+                                          at: .globalNode)
+        }
+        state.encoder!.setVertexBuffer(self.buffers.layers, offset: 0, at: .layerNode)
+        // Nothing is read from the transform buffer unless a node is 3D, but
+        // a buffer must always be bound:
+        state.encoder!.setVertexBuffer(self.buffers.transforms ?? self.buffers.layers,
+                                       offset: 0, at: .transforms)
+        state.encoder!.setFragmentBuffer(self.buffers.layers, offset: 0, at: .layerNode)
     }
 }
 
 /// Sets the layer node to be rendered in the pipeline. Must be performed after
-/// any sublayer traversal.
+/// any sublayer traversal. Nodes are selected by instance index, not by buffer
+/// offset, so that they need not be padded to the constant buffer alignment.
 ///
-/// - **state modified:** `encoder.bufferOffset`
+/// - **state modified:** `node`
 fileprivate class AttachLayerOp: RenderOp {
     fileprivate let node: Int
     fileprivate init(_ node: Int) {
         self.node = node
     }
     fileprivate override func perform(_ state: RenderOp.State) {
-        let _len = MemoryLayout<LayerNode>.size
-        state.encoder!.setVertexBufferOffset(self.node * _len, at: .layerNode)
-        state.encoder!.setFragmentBufferOffset(self.node * _len, at: .layerNode)
+        state.node = self.node
     }
 }
 
-/// Draws the layer background.
+/// Draws the layer background, contents, and border in a single pass, as
+/// selected by `flags`.
 ///
 /// - **state modified:** `encoder`
-fileprivate class BackgroundOp: RenderOp {
+fileprivate class DrawOp: RenderOp {
+    fileprivate typealias SamplerType = (Layer.ContentsFilter, Layer.ContentsFilter)
+    
+    /// Mirrors the `DrawFlag` values passed to the `layer_draw` shader.
+    fileprivate struct Flags: OptionSet {
+        fileprivate let rawValue: UInt32
+        fileprivate init(rawValue: UInt32) {
+            self.rawValue = rawValue
+        }
+        fileprivate init(_ flag: DrawFlag) {
+            self.rawValue = UInt32(flag.rawValue)
+        }
+        
+        fileprivate static let background = Flags(.background)
+        fileprivate static let contents = Flags(.contents)
+        fileprivate static let border = Flags(.border)
+        fileprivate static let clipContents = Flags(.clipContents)
+    }
+    
+    fileprivate let flags: Flags
+    fileprivate let texture: () -> MTLTexture?
+    fileprivate let type: SamplerType
+    fileprivate init(_ flags: Flags,
+                     _ texture: @autoclosure @escaping () -> MTLTexture?,
+                     _ type: SamplerType)
+    {
+        self.flags = flags
+        self.texture = texture
+        self.type = type
+    }
+    
     fileprivate override func perform(_ state: RenderOp.State) {
-        state.encoder!.setRenderPipelineState(state.pipeline!.background)
-        state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6)
+        var flags = self.flags.rawValue
+        state.encoder!.setRenderPipelineState(state.pipeline!.draw)
+        state.encoder!.setFragmentBytes(&flags, length: MemoryLayout<UInt32>.size,
+                                        at: .drawFlags)
+        if self.flags.contains(.contents) {
+            state.encoder!.setFragmentTexture(self.texture(), at: .contents)
+            state.encoder!.setFragmentSamplerState(state.sampler(self.type),
+                                                   at: .contents)
+        }
+        state.drawLayer()
     }
 }
 
-/// Draws the layer border.
+/// Draws a tessellated `ShapeLayer` fill or stroke mesh in the layer's color,
+/// mapping the mesh from path coordinates into the layer as its contents are,
+/// and trimming it to the range of arc lengths `trim`.
 ///
 /// - **state modified:** `encoder`
-fileprivate class BorderOp: RenderOp {
+fileprivate class ShapeOp: RenderOp {
+    fileprivate let mesh: Render.ShapeLayer.Mesh
+    fileprivate var node = ShapeNode()
+    fileprivate init(_ mesh: Render.ShapeLayer.Mesh, _ layer: ShapeLayer, _ color: CGColor,
+                     _ trim: SIMD2<Float>)
+    {
+        self.mesh = mesh
+        self.node.transform = RenderOp.quadTransform(layer.bounds,
+                                                     flipped: layer.contentsAreFlipped)
+        self.node.color = UInt32(premultiplied: SIMD4<Float>(color))
+        self.node.trim = trim
+    }
     fileprivate override func perform(_ state: RenderOp.State) {
-        state.encoder!.setRenderPipelineState(state.pipeline!.border)
-        state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6)
+        guard let buffer = self.mesh.buffer(state.command!.device) else { return }
+        state.encoder!.setRenderPipelineState(state.pipeline!.shape)
+        state.encoder!.setVertexBuffer(buffer, offset: 0, at: .shapeVertices)
+        state.encoder!.setVertexBytes(&self.node, length: MemoryLayout<ShapeNode>.size,
+                                      at: .shapeNode)
+        state.encoder!.setFragmentBytes(&self.node, length: MemoryLayout<ShapeNode>.size,
+                                        at: .shapeNode)
+        Trace.count(.drawCalls)
+        state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0,
+                                      vertexCount: self.mesh.elements.count,
+                                      instanceCount: 1, baseInstance: state.node)
     }
 }
 
-/// Draws the layer contents.
+/// Draws a `GradientLayer` gradient over the layer quad, evaluated per fragment
+/// and colored from the cached ramp of its stops.
 ///
 /// - **state modified:** `encoder`
-fileprivate class ContentsOp: RenderOp {
-    fileprivate typealias SamplerType = (Layer.ContentsFilter, Layer.ContentsFilter)
-    fileprivate let texture: () -> MTLTexture?
-    fileprivate let type: SamplerType
-    fileprivate init(_ texture: @autoclosure @escaping () -> MTLTexture?,
-                     _ type: SamplerType)
-    {
-        self.texture = texture
-        self.type = type
+fileprivate class GradientOp: RenderOp {
+    fileprivate let ramp: Render.GradientLayer.Ramp
+    fileprivate var node: GradientNode
+    fileprivate init(_ ramp: Render.GradientLayer.Ramp, _ node: GradientNode) {
+        self.ramp = ramp
+        self.node = node
     }
-    
     fileprivate override func perform(_ state: RenderOp.State) {
-        state.encoder!.setRenderPipelineState(state.pipeline!.contents)
-        state.encoder!.setFragmentTexture(self.texture(), at: .contents)
-        state.encoder!.setFragmentSamplerState(state.sampler(self.type),
-                                               at: .contents)
-        state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6)
+        state.encoder!.setRenderPipelineState(state.pipeline!.gradient)
+        state.encoder!.setFragmentBytes(&self.node, length: MemoryLayout<GradientNode>.size,
+                                        at: .gradientNode)
+        state.encoder!.setFragmentTexture(self.ramp.texture(state.command!.device),
+                                          at: .gradientRamp)
+        state.drawLayer()
+    }
+}
+
+/// Draws the glyph quads of a `TextLayer` from the shared glyph atlas, in a
+/// single instanced draw. Nothing is drawn if the atlas was cleared since the
+/// quads were built.
+///
+/// - **state modified:** `encoder`
+fileprivate class TextOp: RenderOp {
+    fileprivate let glyphs: Render.TextLayer.Quads
+    fileprivate let generation: Int
+    fileprivate var node = TextNode()
+    fileprivate init(_ glyphs: Render.TextLayer.Quads, _ generation: Int, _ layer: TextLayer) {
+        self.glyphs = glyphs
+        self.generation = generation
+        self.node.transform = RenderOp.quadTransform(CGRect(origin: .zero,
+                                                            size: layer.bounds.size),
+                                                     flipped: false)
+    }
+    fileprivate override func perform(_ state: RenderOp.State) {
+        let device = state.command!.device
+        guard let buffer = self.glyphs.buffer(device),
+            let atlas = Render.GlyphAtlas.shared.texture(device, generation: self.generation) else {
+            return
+        }
+        self.node.node = UInt32(state.node)
+        state.encoder!.setRenderPipelineState(state.pipeline!.text)
+        state.encoder!.setVertexBuffer(buffer, offset: 0, at: .glyphs)
+        state.encoder!.setVertexBytes(&self.node, length: MemoryLayout<TextNode>.size,
+                                      at: .textNode)
+        state.encoder!.setFragmentTexture(atlas, at: .glyphAtlas)
+        Trace.count(.drawCalls)
+        state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6,
+                                      instanceCount: self.glyphs.elements.count)
+    }
+}
+
+/// Pushes or pops the layer's rounded bounds onto the stencil clip of the
+/// topmost texture; while pushed, all drawing into that texture is clipped.
+/// This avoids an offscreen pass for `masksToBounds` alone.
+///
+/// - **state modified:** `encoder`, `clips`
+fileprivate class ClipOp: RenderOp {
+    fileprivate let push: Bool
+    fileprivate init(push: Bool) {
+        self.push = push
+    }
+    fileprivate override func perform(_ state: RenderOp.State) {
+        let key = ObjectIdentifier(state.textureStack.last!)
+        var clip = state.clips[key]!
+        
+        // Only pixels within all enclosing clips are incremented or decremented:
+        state.encoder!.setRenderPipelineState(state.pipeline!.clip)
+        state.encoder!.setDepthStencilState(self.push ? state.pipeline!.clipPushState :
+                                                        state.pipeline!.clipPopState)
+        state.encoder!.setStencilReferenceValue(UInt32(clip.depth))
+        state.drawLayer()
+        
+        clip.depth += self.push ? 1 : -1
+        state.clips[key] = clip
+        state.encoder!.setDepthStencilState(state.pipeline!.clipTestState)
+        state.encoder!.setStencilReferenceValue(UInt32(clip.depth))
     }
 }
 
@@ -358,22 +622,31 @@ fileprivate class CompositeShadowOp: RenderOp {
         state.encoder!.setRenderPipelineState(state.pipeline!.shadow)
         state.encoder!.setFragmentTexture(source, at: .composite)
         state.encoder!.setFragmentTexture(shadow, at: .shadow)
-        state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6)
+        state.drawLayer()
     }
 }
 
 /// Masks the current texture with the last popped texture's alpha channel, while
-/// drawing into the texture directly below. If `targetSelf` is `true`, the last
-/// popped texture is masked using the selected layer's shape.
+/// drawing into the texture directly below. The current texture is popped.
 ///
-/// - **state modified:**
+/// - **state modified:** `encoder`, `textureStack`, `lastTexture`
 fileprivate class MaskOp: RenderOp {
-    fileprivate let targetSelf: Bool
-    fileprivate init(self targetSelf: Bool = true) {
-        self.targetSelf = targetSelf
-    }
     fileprivate override func perform(_ state: RenderOp.State) {
+        let mask = state.lastTexture!
+        
+        // End any existing encoder session:
+        state.encoder?.endEncoding()
+        state.encoder = nil
         
+        // Composite the masked source into the destination:
+        let source = state.textureStack.popLast()!
+        state.newRenderPass(for: state.textureStack.last!)
+        state.encoder!.setRenderPipelineState(state.pipeline!.mask)
+        state.encoder!.setFragmentTexture(source, at: .composite)
+        state.encoder!.setFragmentTexture(mask, at: .mask)
+        Trace.count(.drawCalls)
+        state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6)
+        state.lastTexture = nil
     }
 }
 
@@ -412,6 +685,7 @@ fileprivate class FilterOp: RenderOp {
         // Create the backing texture and swap the topmost one out:
         let texture = state.newTexture(tex.width, tex.height)
         state.textureStack[state.textureStack.count - 1] = texture
+        state.transferClip(from: tex, to: texture)
         
         // Render to the texture:
         let sz = CGRect(x: 0, y: 0, width: tex.width, height: tex.height)
@@ -480,6 +754,7 @@ fileprivate class CompositeFilterOp: RenderOp {
                                 bounds: sz, colorSpace: CGColorSpaceCreateDeviceRGB())
         if self.replace {
             state.textureStack[state.textureStack.count - 1] = texture
+            state.transferClip(from: tex1, to: texture)
         } else {
             state.lastTexture = texture
         }
@@ -568,6 +843,7 @@ fileprivate class CompositeOp: RenderOp {
     fileprivate override func perform(_ state: RenderOp.State) {
         state.encoder!.setRenderPipelineState(state.pipeline!.composite)
         state.encoder!.setFragmentTexture(state.lastTexture!, at: .composite)
+        Trace.count(.drawCalls)
         state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6)
         state.lastTexture = nil
     }
@@ -588,13 +864,18 @@ fileprivate class FlattenOp: RenderOp {
         let idx = state.boundaries.last ?? 0
         state.newRenderPass(for: state.textureStack[idx])
         state.encoder!.setRenderPipelineState(state.pipeline!.composite)
+        state.encoder!.setDepthStencilState(state.pipeline!.clipNoneState)
         
         // Run the composite shader for each texture going up the stack:
         for x in state.textureStack.dropFirst(idx + 1) {
             state.encoder!.setFragmentTexture(x, at: .composite)
+            Trace.count(.drawCalls)
             state.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6)
         }
         state.textureStack.removeSubrange((idx + 1)...)
+        
+        // Later draws into the flattened texture remain within its clip:
+        state.encoder!.setDepthStencilState(state.pipeline!.clipTestState)
     }
 }
 
@@ -602,13 +883,45 @@ fileprivate class FlattenOp: RenderOp {
 //
 //
 
+extension RenderOp {
+    
+    /// Returns the transform from the coordinates of `rect` to the [-1, 1] layer
+    /// quad, flipped vertically if the layer contents are flipped.
+    fileprivate static func quadTransform(_ rect: CGRect, flipped: Bool) -> simd_float3x2 {
+        var t = CGAffineTransform(translationX: -1.0, y: -1.0)
+        t = t.scaledBy(x: 2.0 / max(rect.width, 1e-5), y: 2.0 / max(rect.height, 1e-5))
+        if flipped {
+            t = t.translatedBy(x: 0.0, y: rect.height).scaledBy(x: 1.0, y: -1.0)
+        }
+        t = t.translatedBy(x: -rect.minX, y: -rect.minY)
+        return simd_float3x2(SIMD2<Float>(Float(t.a), Float(t.b)),
+                             SIMD2<Float>(Float(t.c), Float(t.d)),
+                             SIMD2<Float>(Float(t.tx), Float(t.ty)))
+    }
+    
+    /// Returns the factor by which `transform` scales areas, as a length,
+    /// ignoring any perspective.
+    fileprivate static func scale(of transform: Transform3D?) -> CGFloat {
+        let m = (transform ?? .identity).m
+        let area = abs(m.columns.0.x * m.columns.1.y - m.columns.0.y * m.columns.1.x)
+        return CGFloat(area.squareRoot())
+    }
+    
+    /// Returns the pixels per point at which to rasterize contents that appear
+    /// at `scale` pixels per point on screen. It is rounded up to a quarter
+    /// step, so that a gradual zoom does not rasterize the layer anew at every
+    /// frame.
+    fileprivate static func rasterScale(_ scale: CGFloat) -> CGFloat {
+        return max((scale * 4.0).rounded(.up) / 4.0, 0.25)
+    }
+}
+
 extension Layer {
     
     /// Return whether the receiver requires offscreen rendering for complex effects.
-    fileprivate var needsOffscreenRendering: Bool {
+    internal var needsOffscreenRendering: Bool {
         return (self.filters?.count ?? 0 > 0) ||
             self.compositingFilter != nil ||
-            self.masksToBounds ||
             self.mask != nil ||
             self.shadowOpacity > 0.0
     }
@@ -616,10 +929,23 @@ extension Layer {
 
 extension Drawable {
     
-    ///
-    func texture(_ device: MTLDevice) -> MTLTexture? {
+    /// The texture of the receiver on `device`, or `nil` if it is not ready to
+    /// be drawn yet. Images are loaded through `Render.Image.Cache`, which
+    /// uploads only their `contentsRect` and generates their mipmaps when
+    /// `mipmapped` is requested, and image queues are sampled at the layer
+    /// `time`, for the frame at the media `frameTime`.
+    func texture(_ device: MTLDevice, at time: TimeInterval = 0,
+                 frameTime: TimeInterval = 0,
+                 contentsRect: CGRect = CGRect(x: 0, y: 0, width: 1, height: 1),
+                 mipmapped: Bool = false) -> MTLTexture?
+    {
         var tex: MTLTexture? = nil
-        if let x = (self as? RenderConvertible)?.renderValue as? RenderDrawable {
+        if let x = self as? RenderCachedImage {
+            tex = Render.Image.Cache.shared.texture(for: x, device, contentsRect: contentsRect,
+                                                    mipmapped: mipmapped)
+        } else if let x = (self as? RenderConvertible)?.renderValue as? Render.ImageQueue {
+            tex = x.texture(device, at: time, frameTime: frameTime)
+        } else if let x = (self as? RenderConvertible)?.renderValue as? RenderDrawable {
             tex = x.texture(device)
         } else if let x = self as? RenderDrawable {
             tex = x.texture(device)
@@ -636,6 +962,7 @@ fileprivate extension RenderOp.State {
                                                             width: width, height: height,
                                                             mipmapped: false)
         desc.usage = [.renderTarget, .shaderRead, .shaderWrite]
+        Trace.count(.textureAllocations)
         return self.command!.device.makeTexture(descriptor: desc)!
     }
     
@@ -647,6 +974,7 @@ fileprivate extension RenderOp.State {
         t.storageMode = .private
         t.usage = [.renderTarget, .shaderRead]
         let x = MTLRenderPassDepthAttachmentDescriptor()
+        Trace.count(.textureAllocations)
         x.texture = self.command!.device.makeTexture(descriptor: t)!
         x.loadAction = .clear
         x.storeAction = .dontCare
@@ -654,20 +982,59 @@ fileprivate extension RenderOp.State {
         return x
     }
     
+    /// Convenience function to create a new stencil store.
+	func newStencil(_ width: Int, _ height: Int) -> MTLTexture {
+        let t = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .stencil8,
+                                                         width: width, height: height,
+                                                         mipmapped: false)
+        t.storageMode = .private
+        t.usage = [.renderTarget]
+        Trace.count(.textureAllocations)
+        return self.command!.device.makeTexture(descriptor: t)!
+    }
+    
     /// Convenience function to create a new render pass encoder in the state.
+    /// The texture's stencil clip is created on first use, and restored after.
 	func newRenderPass(for texture: MTLTexture, clear: Bool = false) {
+        let key = ObjectIdentifier(texture)
+        let existing = self.clips[key]
+        let clip = existing ?? Clip(texture: texture,
+                                    stencil: self.newStencil(texture.width, texture.height),
+                                    depth: 0)
+        self.clips[key] = clip
+        
         let pass = MTLRenderPassDescriptor()
         pass.colorAttachments[0].loadAction = clear ? .clear : .dontCare
         pass.colorAttachments[0].storeAction = .store
         pass.colorAttachments[0].clearColor = MTLClearColorMake(0, 0, 0, 0)
         pass.colorAttachments[0].texture = texture
+        pass.stencilAttachment.loadAction = existing == nil ? .clear : .load
+        pass.stencilAttachment.storeAction = .store
+        pass.stencilAttachment.clearStencil = 0
+        pass.stencilAttachment.texture = clip.stencil
         //pass.depthAttachment = self.newDepth(texture.width, texture.height)
 		self.encoder = self.command!.makeRenderCommandEncoder(descriptor: pass)!
-        //self.encoder?.setDepthStencilState(self.pipeline!.depthState)
+        self.encoder!.setDepthStencilState(self.pipeline!.clipTestState)
+        self.encoder!.setStencilReferenceValue(UInt32(clip.depth))
+    }
+    
+    /// Draws the quad of the currently attached layer node.
+    func drawLayer() {
+        Trace.count(.drawCalls)
+        self.encoder!.drawPrimitives(type: .triangle, vertexStart: 0, vertexCount: 6,
+                                     instanceCount: 1, baseInstance: self.node)
+    }
+    
+    /// Moves the stencil clip of `texture` to its replacement in the `textureStack`.
+    func transferClip(from texture: MTLTexture, to replacement: MTLTexture) {
+        guard let clip = self.clips.removeValue(forKey: ObjectIdentifier(texture)) else { return }
+        self.clips[ObjectIdentifier(replacement)] = Clip(texture: replacement,
+                                                          stencil: clip.stencil,
+                                                          depth: clip.depth)
     }
     
     /// Convenience function to create the corresponding sampler state for a layer.
-	func sampler(_ params: ContentsOp.SamplerType) -> MTLSamplerState {
+	func sampler(_ params: DrawOp.SamplerType) -> MTLSamplerState {
         switch params {
         case (.linear, .linear): return self.pipeline!.linear_linearSampler
         case (.linear, .nearest): return self.pipeline!.linear_nearestSampler
@@ -692,6 +1059,7 @@ internal extension RenderOp.State.Pipeline {
         let pipeDesc = MTLRenderPipelineDescriptor()
         //pipeDesc.depthAttachmentPixelFormat = .depth16Unorm
         pipeDesc.colorAttachments[0].pixelFormat = .bgra8Unorm
+        pipeDesc.stencilAttachmentPixelFormat = .stencil8
         pipeDesc.colorAttachments[0].isBlendingEnabled = true
         pipeDesc.colorAttachments[0].rgbBlendOperation = .add
         pipeDesc.colorAttachments[0].alphaBlendOperation = .add
@@ -708,13 +1076,25 @@ internal extension RenderOp.State.Pipeline {
             pipeline.composite = try device.makeRenderPipelineState(descriptor: pipeDesc)
             pipeDesc.fragmentFunction = lib.makeFunction(name: "scene_shadow")
             pipeline.shadow = try device.makeRenderPipelineState(descriptor: pipeDesc)
+            pipeDesc.fragmentFunction = lib.makeFunction(name: "scene_mask_layer_only")
+            pipeline.mask = try device.makeRenderPipelineState(descriptor: pipeDesc)
             pipeDesc.vertexFunction = lib.makeFunction(name: "layer_emit_quad")
-            pipeDesc.fragmentFunction = lib.makeFunction(name: "layer_background")
-            pipeline.background = try device.makeRenderPipelineState(descriptor: pipeDesc)
-            pipeDesc.fragmentFunction = lib.makeFunction(name: "layer_contents")
-            pipeline.contents = try device.makeRenderPipelineState(descriptor: pipeDesc)
-            pipeDesc.fragmentFunction = lib.makeFunction(name: "layer_border")
-            pipeline.border = try device.makeRenderPipelineState(descriptor: pipeDesc)
+            pipeDesc.fragmentFunction = lib.makeFunction(name: "layer_draw")
+            pipeline.draw = try device.makeRenderPipelineState(descriptor: pipeDesc)
+            pipeDesc.vertexFunction = lib.makeFunction(name: "shape_emit_mesh")
+            pipeDesc.fragmentFunction = lib.makeFunction(name: "shape_fill")
+            pipeline.shape = try device.makeRenderPipelineState(descriptor: pipeDesc)
+            pipeDesc.vertexFunction = lib.makeFunction(name: "text_emit_glyph")
+            pipeDesc.fragmentFunction = lib.makeFunction(name: "text_draw")
+            pipeline.text = try device.makeRenderPipelineState(descriptor: pipeDesc)
+            pipeDesc.vertexFunction = lib.makeFunction(name: "layer_emit_quad")
+            pipeDesc.fragmentFunction = lib.makeFunction(name: "gradient_draw")
+            pipeline.gradient = try device.makeRenderPipelineState(descriptor: pipeDesc)
+            
+            // The clip pipeline only writes to the stencil:
+            pipeDesc.fragmentFunction = lib.makeFunction(name: "layer_clip")
+            pipeDesc.colorAttachments[0].writeMask = []
+            pipeline.clip = try device.makeRenderPipelineState(descriptor: pipeDesc)
         } catch {
             fatalError("Could not create layer rendering pipelines: \(error)")
         }
@@ -770,6 +1150,24 @@ internal extension RenderOp.State.Pipeline {
             desc.depthCompareFunction = .always
             pipeline.depthState = device.makeDepthStencilState(descriptor: desc)!
         }
+        
+        // Create stencil clip states:
+        func clipState(_ compare: MTLCompareFunction,
+                       _ pass: MTLStencilOperation) -> MTLDepthStencilState {
+            let stencil = MTLStencilDescriptor()
+            stencil.stencilCompareFunction = compare
+            stencil.stencilFailureOperation = .keep
+            stencil.depthFailureOperation = .keep
+            stencil.depthStencilPassOperation = pass
+            let desc = MTLDepthStencilDescriptor()
+            desc.frontFaceStencil = stencil
+            desc.backFaceStencil = stencil
+            return device.makeDepthStencilState(descriptor: desc)!
+        }
+        pipeline.clipTestState = clipState(.equal, .keep)
+        pipeline.clipPushState = clipState(.equal, .incrementClamp)
+        pipeline.clipPopState = clipState(.equal, .decrementClamp)
+        pipeline.clipNoneState = clipState(.always, .keep)
         return pipeline
     }
 }
@@ -788,6 +1186,10 @@ internal extension MTLRenderCommandEncoder {
 	func setVertexBufferOffset(_ offset: Int, at index: BufferIndex) {
         self.setVertexBufferOffset(offset, index: Int(index.rawValue))
     }
+    @inline(__always)
+	func setFragmentBytes(_ bytes: UnsafeRawPointer, length: Int, at index: BufferIndex) {
+        self.setFragmentBytes(bytes, length: length, index: Int(index.rawValue))
+    }
     @inline(__always)
 	func setFragmentBuffer(_ buffer: MTLBuffer?, offset: Int, at index: BufferIndex) {
         self.setFragmentBuffer(buffer, offset: offset, index: Int(index.rawValue))
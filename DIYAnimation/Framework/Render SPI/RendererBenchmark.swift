@@ -0,0 +1,378 @@
+import Foundation
+import Metal
+import CoreImage
+
+extension Renderer {
+    
+    /// Renders synthetic layer trees offscreen and times each stage of building
+    /// and drawing a frame separately, so that regressions in frame-build cost
+    /// can be attributed to the stage that caused them.
+    ///
+    /// Every tree is generated from a fixed seed and every frame is sampled at
+    /// a fixed offset from the time its animations were added, so two runs on
+    /// the same machine render identical frames.
+    /// The `Report` is encoded with sorted keys and fixed precision, so that
+    /// reports from successive changes can be compared line by line.
+    public struct Benchmark {
+        
+        /// The shapes of layer tree that may be benchmarked.
+        public enum Scenario: String, Codable, CaseIterable {
+            
+            /// A single chain of nested layers, `count` deep.
+            case deep
+            
+            /// A grid of `count` sibling layers.
+            case wide
+            
+            /// A grid of `count` sibling layers, alternately shadowed and masked,
+            /// each requiring an offscreen pass.
+            case offscreen
+            
+            /// A grid of `count` sibling layers, each with position and opacity
+            /// animations.
+            case animated
+            
+            /// A grid of `count` sibling layers, each with a chain of CoreImage
+            /// filters.
+            case filters
+        }
+        
+        /// The stages of a frame that are timed individually.
+        public enum Stage: String, Codable, CaseIterable {
+            
+            /// Mutating the layer tree and committing the `Transaction`.
+            case commit
+            
+            /// Applying each layer's animations to a presentation copy.
+            case sampling
+            
+            /// Converting each presentation layer into a `LayerNode`.
+            case conversion
+            
+            /// Building the `RenderOp` chain, excluding sampling and conversion.
+            case construction
+            
+            /// Encoding the `RenderOp` chain into a command buffer.
+            case encoding
+            
+            /// Executing the command buffer on the GPU.
+            case compositing
+            
+            /// The sum of all the above stages.
+            case total
+        }
+        
+        /// The parameters of a benchmark run.
+        public struct Parameters: Codable {
+            
+            /// The number of layers generated for each scenario.
+            public var count: Int = 256
+            
+            /// The number of frames timed for each scenario.
+            public var frames: Int = 120
+            
+            /// The number of frames rendered, but not timed, before timing begins.
+            public var warmup: Int = 10
+            
+            /// The fraction of layers mutated in each frame's transaction.
+            public var mutation: Double = 0.25
+            
+            /// The width of the render target, in pixels.
+            public var width: Int = 1024
+            
+            /// The height of the render target, in pixels.
+            public var height: Int = 768
+            
+            /// The seed from which all layer trees are generated.
+            public var seed: UInt64 = 0x5EED
+            
+            ///
+            public init() {}
+        }
+        
+        /// Summary statistics of one stage over all timed frames, in milliseconds.
+        public struct Statistics: Codable {
+            public let mean: Double
+            public let median: Double
+            public let p95: Double
+            public let min: Double
+            public let max: Double
+            
+            /// Summarizes the `samples`, given in seconds.
+            fileprivate init(_ samples: [TimeInterval]) {
+                let s = samples.sorted()
+                let ms = { (t: TimeInterval) in Statistics.round(t * 1000.0) }
+                self.mean = ms(s.reduce(0.0, +) / Double(Swift.max(s.count, 1)))
+                self.median = ms(s.isEmpty ? 0.0 : s[s.count / 2])
+                self.p95 = ms(s.isEmpty ? 0.0 : s[Swift.min(s.count - 1, s.count * 95 / 100)])
+                self.min = ms(s.first ?? 0.0)
+                self.max = ms(s.last ?? 0.0)
+            }
+            
+            /// Rounds to whole microseconds, below which timing is only noise.
+            private static func round(_ x: Double) -> Double {
+                return (x * 1000.0).rounded() / 1000.0
+            }
+        }
+        
+        /// The timings of a single scenario.
+        public struct Result: Codable {
+            
+            ///
+            public let scenario: Scenario
+            
+            /// The number of layers in the tree, including the root and masks.
+            public let layers: Int
+            
+            /// The number of layers rendered in an offscreen pass.
+            public let offscreen: Int
+            
+            /// The statistics of each `Stage`, keyed by its raw value.
+            public let stages: [String: Statistics]
+        }
+        
+        /// The output of a benchmark run.
+        public struct Report: Codable {
+            
+            /// The version of the report format; incremented whenever its keys
+            /// or their meaning change.
+            public var version: Int = 1
+            
+            /// The name of the `MTLDevice` rendered with.
+            public let device: String
+            
+            ///
+            public let parameters: Parameters
+            
+            ///
+            public let results: [Result]
+            
+            /// The report as JSON, with sorted keys.
+            public func encoded() throws -> Data {
+                let encoder = JSONEncoder()
+                encoder.outputFormatting = [.prettyPrinted, .sortedKeys]
+                return try encoder.encode(self)
+            }
+        }
+        
+        ///
+        public let device: MTLDevice
+        
+        ///
+        public let parameters: Parameters
+        
+        ///
+        private let queue: MTLCommandQueue
+        
+        ///
+        private let ciContext: CIContext
+        
+        ///
+        private let pipeline: RenderOp.State.Pipeline
+        
+        /// Create a new `Benchmark` rendering with the given `device`.
+        public init(_ device: MTLDevice, parameters: Parameters = Parameters()) {
+            self.device = device
+            self.parameters = parameters
+            self.queue = device.makeCommandQueue()!
+            self.ciContext = CIContext(mtlDevice: device)
+            self.pipeline = RenderOp.State.Pipeline.create(device)
+        }
+        
+        /// Runs each of the `scenarios` in turn.
+        public func run(_ scenarios: [Scenario] = Scenario.allCases) -> Report {
+            return Report(device: self.device.name, parameters: self.parameters,
+                          results: scenarios.map { self.measure($0) })
+        }
+        
+        /// Builds the tree for `scenario` and times the rendering of each frame.
+        private func measure(_ scenario: Scenario) -> Result {
+            let p = self.parameters
+            let size = MTLSize(width: p.width, height: p.height, depth: 1)
+            let mvp = Transform3D.orthographic(left: 0, right: Float(p.width),
+                                               bottom: 0, top: Float(p.height),
+                                               zNear: -1.0, zFar: 1.0).m
+            let globalNode = RenderOp.State.globalNode(self.device, mvp, size)
+            let (root, layers) = Benchmark.tree(scenario, p)
+            let origin = CurrentMediaTime()
+            
+            var samples = [Stage: [TimeInterval]]()
+            for frame in 0..<(p.warmup + p.frames) {
+                var times = [Stage: TimeInterval]()
+                let frameTime = origin + TimeInterval(frame) / 60.0
+                
+                // Mutate a fixed, rotating subset of the tree:
+                var t0 = CurrentMediaTime()
+                Transaction.begin()
+                Transaction.disableActions = true
+                let stride = Swift.max(Int((1.0 / Swift.max(p.mutation, 1e-6)).rounded()), 1)
+                for (i, l) in layers.enumerated() where (i + frame) % stride == 0 {
+                    l.opacity = frame % 2 == 0 ? 1.0 : 0.9
+                }
+                Transaction.commit()
+                times[.commit] = CurrentMediaTime() - t0
+                
+                // Sampling and conversion are timed within the visit, and
+                // subtracted from the construction of the op chain:
+                var sampling = 0.0, conversion = 0.0
+                t0 = CurrentMediaTime()
+                let op = RenderOp(for: root, with: self.device, size: size, scale: 1.0,
+                                  at: frameTime) { l, transforms in
+                    l.displayIfNeeded()
+                    var t = CurrentMediaTime()
+                    let presented = l.layer(at: frameTime)
+                    sampling += CurrentMediaTime() - t
+                    t = CurrentMediaTime()
+                    let node = LayerNode(presenting: presented, transforms: &transforms)
+                    conversion += CurrentMediaTime() - t
+                    return node
+                }
+                times[.sampling] = sampling
+                times[.conversion] = conversion
+                times[.construction] = CurrentMediaTime() - t0 - sampling - conversion
+                
+                // Encode the frame exactly as `Renderer.render(_:)` would, minus
+                // the blit into the render target:
+                t0 = CurrentMediaTime()
+                let commandBuffer = self.queue.makeCommandBuffer()!
+                op.perform(RenderOp.State(commandBuffer, self.ciContext, self.pipeline,
+                                          mvp, size, globalBuffer: globalNode))
+                times[.encoding] = CurrentMediaTime() - t0
+                
+                // Prefer the GPU's own timestamps, which exclude scheduling:
+                t0 = CurrentMediaTime()
+                commandBuffer.commit()
+                commandBuffer.waitUntilCompleted()
+                times[.compositing] = CurrentMediaTime() - t0
+                if #available(macOS 10.15, *), commandBuffer.gpuEndTime > 0.0 {
+                    times[.compositing] = commandBuffer.gpuEndTime - commandBuffer.gpuStartTime
+                }
+                times[.total] = times.values.reduce(0.0, +)
+                
+                guard frame >= p.warmup else { continue }
+                for (stage, t) in times {
+                    samples[stage, default: []].append(t)
+                }
+            }
+            
+            return Result(scenario: scenario, layers: root.sublayerCount() + 1,
+                          offscreen: ([root] + layers).reduce(0) {
+                              $0 + ($1.needsOffscreenRendering ? 1 : 0) + ($1.mask != nil ? 1 : 0)
+                          },
+                          stages: Dictionary(uniqueKeysWithValues: samples.map {
+                              ($0.key.rawValue, Statistics($0.value))
+                          }))
+        }
+        
+        /// Generates the layer tree for `scenario`, returning its root and all
+        /// of its layers other than the root (in creation order).
+        private static func tree(_ scenario: Scenario, _ p: Parameters) -> (Layer, [Layer]) {
+            var rng = SplitMix64(seed: p.seed)
+            let width = CGFloat(p.width), height = CGFloat(p.height)
+            func color() -> CGColor {
+                return CGColor(red: CGFloat.random(in: 0...1, using: &rng),
+                               green: CGFloat.random(in: 0...1, using: &rng),
+                               blue: CGFloat.random(in: 0...1, using: &rng),
+                               alpha: 1.0)
+            }
+            
+            Transaction.begin()
+            Transaction.disableActions = true
+            Transaction.animationDuration = 1.0
+            defer { Transaction.commit() }
+            
+            let root = Layer()
+            root.frame = CGRect(x: 0, y: 0, width: width, height: height)
+            root.backgroundColor = .white
+            var layers = [Layer]()
+            
+            // Each nested layer is inset from its parent by a fraction of its size:
+            if scenario == .deep {
+                var parent = root
+                for _ in 0..<p.count {
+                    let l = Layer()
+                    let inset = CGFloat.random(in: 0.0...2.0, using: &rng)
+                    l.frame = parent.bounds.insetBy(dx: inset, dy: inset)
+                    l.backgroundColor = color()
+                    l.cornerRadius = CGFloat.random(in: 0.0...8.0, using: &rng)
+                    parent.addSublayer(l)
+                    layers.append(l)
+                    parent = l
+                }
+                return (root, layers)
+            }
+            
+            // Otherwise, lay out a square grid covering the root:
+            let columns = Int(Double(p.count).squareRoot().rounded(.up))
+            let rows = (p.count + columns - 1) / columns
+            let cell = CGSize(width: width / CGFloat(columns), height: height / CGFloat(rows))
+            for i in 0..<p.count {
+                let l = Layer()
+                l.frame = CGRect(x: CGFloat(i % columns) * cell.width,
+                                 y: CGFloat(i / columns) * cell.height,
+                                 width: cell.width, height: cell.height).insetBy(dx: 2.0, dy: 2.0)
+                l.backgroundColor = color()
+                l.cornerRadius = CGFloat.random(in: 0.0...8.0, using: &rng)
+                
+                switch scenario {
+                case .offscreen where i % 2 == 0:
+                    l.shadowOpacity = 0.5
+                    l.shadowRadius = CGFloat.random(in: 1.0...8.0, using: &rng)
+                case .offscreen:
+                    let mask = Layer()
+                    mask.frame = l.bounds.insetBy(dx: l.bounds.width / 4.0, dy: 0.0)
+                    mask.backgroundColor = .black
+                    mask.cornerRadius = mask.bounds.width / 2.0
+                    l.mask = mask
+                case .animated:
+                    // Both animations run for the whole benchmark:
+                    let move = BasicAnimation(keyPath: "position")
+                    move.fromValue = l.position
+                    move.toValue = CGPoint(x: CGFloat.random(in: 0...width, using: &rng),
+                                           y: CGFloat.random(in: 0...height, using: &rng))
+                    move.repeatCount = .max
+                    move.autoreverses = true
+                    l.addAnimation(move, forKey: "position")
+                    let fade = BasicAnimation(keyPath: "opacity")
+                    fade.fromValue = Float(1.0)
+                    fade.toValue = Float(0.25)
+                    fade.repeatCount = .max
+                    fade.autoreverses = true
+                    l.addAnimation(fade, forKey: "opacity")
+                case .filters:
+                    l.filters = [CIFilter(name: "CIGaussianBlur",
+                                          parameters: [kCIInputRadiusKey: 4.0])!,
+                                 CIFilter(name: "CIColorControls",
+                                          parameters: [kCIInputSaturationKey: 0.5])!]
+                default: break
+                }
+                
+                root.addSublayer(l)
+                layers.append(l)
+            }
+            return (root, layers)
+        }
+    }
+}
+
+/// A small, fast, seedable generator, so that benchmark trees are identical
+/// across runs (unlike `SystemRandomNumberGenerator`).
+fileprivate struct SplitMix64: RandomNumberGenerator {
+    
+    ///
+    private var state: UInt64
+    
+    ///
+    init(seed: UInt64) {
+        self.state = seed
+    }
+    
+    ///
+    mutating func next() -> UInt64 {
+        self.state &+= 0x9E3779B97F4A7C15
+        var z = self.state
+        z = (z ^ (z >> 30)) &* 0xBF58476D1CE4E5B9
+        z = (z ^ (z >> 27)) &* 0x94D049BB133111EB
+        return z ^ (z >> 31)
+    }
+}
@@ -0,0 +1,149 @@
+import Foundation
+
+extension Renderer {
+    
+    /// Drives a `Renderer` from the display's refresh, drawing a frame only when
+    /// its layer tree will actually change.
+    ///
+    /// On each refresh the scheduler asks the renderer for its `nextFrameTime()`.
+    /// If nothing changes by the next refresh, the display link is paused until
+    /// a commit to the renderer's context, until an image loads or is inserted
+    /// into an asynchronous image queue, or until shortly before a pending
+    /// animation begins; an idle tree therefore uses no CPU at all. Otherwise a frame is drawn on every `refreshDivisor(forPeriod:)`-th
+    /// refresh, and its encoding is delayed until just before the refresh it is
+    /// presented at, so that it reflects the latest commits.
+    public final class Scheduler {
+        
+        /// The renderer driven by the receiver.
+        public let renderer: Renderer
+        
+        /// The time reserved before each deadline in addition to the renderer's
+        /// recent maximum CPU and GPU frame times, to absorb timer latency.
+        public var margin: TimeInterval = 0.002
+        
+        /// Performs a frame pass of the renderer for the given presentation time;
+        /// typically sets its `renderTarget` and calls `beginFrame(atTime:)`,
+        /// `render(_:)` and `endFrame()`.
+        private let frame: (Renderer, TimeInterval) -> ()
+        
+        ///
+        private var displayLink: DisplayLink! = nil
+        
+        /// The number of refreshes since the last frame was drawn.
+        private var refreshes = 0
+        
+        /// Whether a frame is waiting for its time to begin encoding.
+        private var isPending = false
+        
+        /// Whether the receiver has been started and not since stopped.
+        private var isRunning = false
+        
+        /// The observers of `Render.Image.Cache.didLoadNotification` and
+        /// `Render.ImageQueue.didChangeNotification`.
+        private var imageObservers: [NSObjectProtocol] = []
+        
+        /// Create a new `Scheduler` performing the `frame` pass of `renderer`.
+        public init(_ renderer: Renderer, _ frame: @escaping (Renderer, TimeInterval) -> ()) {
+            self.renderer = renderer
+            self.frame = frame
+            self.displayLink = DisplayLink { [weak self] in
+                self?.refresh()
+            }
+        }
+        
+        deinit {
+            self.stop()
+        }
+        
+        /// Begins scheduling frames on the main run loop.
+        public func start() {
+            self.displayLink.add(to: .main, forMode: .common)
+            self.isRunning = true
+            self.observeCommits()
+            self.observeImages()
+        }
+        
+        /// Stops scheduling frames.
+        public func stop() {
+            self.renderer.context?.commitHandler = nil
+            for observer in self.imageObservers {
+                Render.notificationCenter.removeObserver(observer)
+            }
+            self.imageObservers = []
+            self.displayLink.remove(from: .main, forMode: .common)
+            self.isRunning = false
+        }
+        
+        /// Resumes the display link, if paused, so that the next refresh may
+        /// schedule a frame. May be called from any thread.
+        public func setNeedsFrame() {
+            DispatchQueue.main.async {
+                guard self.isRunning else { return }
+                self.displayLink.isPaused = false
+            }
+        }
+        
+        /// Wakes the receiver whenever the renderer's layer tree is committed.
+        private func observeCommits() {
+            self.renderer.context?.commitHandler = { [weak self] in
+                self?.setNeedsFrame()
+            }
+        }
+        
+        /// Wakes the receiver whenever an image finishes loading, or is inserted
+        /// into an asynchronous image queue.
+        private func observeImages() {
+            let names = [Render.Image.Cache.didLoadNotification,
+                         Render.ImageQueue.didChangeNotification]
+            self.imageObservers = names.map {
+                Render.notificationCenter.addObserver(forName: $0, object: nil, queue: nil) { [weak self] _ in
+                    self?.setNeedsFrame()
+                }
+            }
+        }
+        
+        /// Decides, on each display refresh, whether and when to draw a frame.
+        private func refresh() {
+            guard !self.isPending else { return }
+            self.observeCommits() // the context may have been replaced
+            let link = self.displayLink!
+            let deadline = link.targetTimestamp
+            
+            // Sleep if nothing changes by the next refresh, waking one refresh
+            // before any animation that begins later:
+            let next = self.renderer.nextFrameTime()
+            guard next <= deadline else {
+                link.isPaused = true
+                self.refreshes = 0
+                if next.isFinite {
+                    Callback(at: next - link.duration) { [weak self] in
+                        self?.setNeedsFrame()
+                    }
+                }
+                return
+            }
+            
+            // Skip refreshes that the running animations don't need drawn:
+            self.refreshes += 1
+            guard self.refreshes >= self.renderer.refreshDivisor(forPeriod: link.duration) else {
+                return
+            }
+            self.refreshes = 0
+            
+            // Encode as late as possible while still meeting the deadline:
+            let stats = self.renderer.statistics
+            let lead = min(stats.maxEncodeTime + stats.maxGPUTime + self.margin, link.duration)
+            let draw = { [weak self] in
+                guard let self = self else { return }
+                self.isPending = false
+                self.frame(self.renderer, deadline)
+            }
+            self.isPending = true
+            if deadline - lead > CurrentMediaTime() {
+                Callback(at: deadline - lead, draw)
+            } else {
+                draw()
+            }
+        }
+    }
+}
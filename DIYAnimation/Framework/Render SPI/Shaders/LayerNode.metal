@@ -3,8 +3,6 @@
 #include "RoundedRect.metal"
 using namespace metal;
 
-// TODO: switch to half values instead of float!
-
 /// Quad vertices lookup table. XY = position, ZW = texCoords.
 /// This reduces the need to buffer the static quad vertices over from the CPU.
 constant float4 quad_vertices[] = {
@@ -24,65 +22,237 @@ struct Varyings {
     
     /// The unit space coordinate of the fragment's texture.
     float2 texCoord [[user(texturecoord)]];
+    
+    /// The size of one screen pixel in layer points, for edge anti-aliasing.
+    float aa [[user(antialias)]];
+    
+    /// The index of the `LayerNode` being drawn.
+    uint node [[flat]];
 };
 
+/// Returns the model transform of the `layer`, expanding its 2D affine transform
+/// unless it indexes a 3D transform.
+inline float4x4 layer_transform(const device LayerNode& layer,
+                                const device float4x4* transforms)
+{
+    if (layer.flags & LayerNodeFlagTransform3D) {
+        return transforms[layer.transform3D];
+    }
+    auto t = layer.transform;
+    return float4x4(float4(t[0], 0, 0),
+                    float4(t[1], 0, 0),
+                    float4(0, 0, 1, 0),
+                    float4(t[2], 0, 1));
+}
+
+/// Returns the size of one screen pixel in layer points, for a vertex of the
+/// `layer` at clip-space depth `w`.
+inline float layer_aa(constant GlobalNode& global, const device LayerNode& layer,
+                      float4x4 mvp, float w)
+{
+    // The quad spans 2 units across the layer bounds and NDC spans 2 units
+    // across the viewport, so the axes of `mvp` give the screen pixels covered
+    // by each layer point (after the perspective divide):
+    auto sx = length(mvp[0].xy * global.viewport.zw) / max(layer.size.x, 1e-5);
+    auto sy = length(mvp[1].xy * global.viewport.zw) / max(layer.size.y, 1e-5);
+    return abs(w) / max(sqrt(sx * sy), 1e-5);
+}
+
 /// Emits a layer quad with texture mapping suitable for the below fragments.
+/// The layer is selected by the instance index (see `baseInstance`).
 vertex Varyings layer_emit_quad(constant GlobalNode& global [[buffer(BufferIndexGlobalNode)]],
-                                constant LayerNode& layer [[buffer(BufferIndexLayerNode)]],
-                                uint vid [[vertex_id]])
+                                const device LayerNode* layers [[buffer(BufferIndexLayerNode)]],
+                                const device float4x4* transforms [[buffer(BufferIndexTransforms)]],
+                                uint vid [[vertex_id]],
+                                uint iid [[instance_id]])
 {
     // Apply model-view-projection transform to the current vertex:
-    auto p = global.transform * layer.transform * float4(quad_vertices[vid].xy, 0, 1);
+    const device LayerNode& layer = layers[iid];
+    auto mvp = global.transform * layer_transform(layer, transforms);
+    auto p = mvp * float4(quad_vertices[vid].xy, 0, 1);
     
     // Submit vertex after adjusting `p` for the Metal NDC:
     Varyings output;
 	output.position = p - float4(1, 1, 0, 0);
     output.texCoord = quad_vertices[vid].zw;
+    output.aa = layer_aa(global, layer, mvp, p.w);
+    output.node = iid;
 	return output;
 }
 
-/// Draws the layer background color with (optional) corner radius.
-fragment float4 layer_background(Varyings input [[stage_in]],
-                                 constant LayerNode& layer [[buffer(BufferIndexLayerNode)]])
+/// Draws the layer background, contents, and border in a single pass, as
+/// selected by `flags`. The background and border are clipped to the layer's
+/// rounded bounds, as are the contents if `DrawFlagClipContents` is set.
+fragment half4 layer_draw(Varyings input [[stage_in]],
+                          const device LayerNode* layers [[buffer(BufferIndexLayerNode)]],
+                          constant uint& flags [[buffer(BufferIndexDrawFlags)]],
+                          texture2d<half> tex [[texture(TextureIndexContents)]],
+                          sampler texSampler [[sampler(SamplerIndexContents)]])
 {
-    if (layer.cornerRadius > 0) {
-        auto plane = float4(float2(0), layer.bounds.zw);
-        auto exterior = RoundedRect(plane, layer.cornerRadius);
-        auto ext_mix = exterior.contains(input.texCoord * plane.zw);
-        return mix(layer.backgroundColor, float4(0), 1 - ext_mix);
-    } else {
-        return layer.backgroundColor;
+    const device LayerNode& layer = layers[input.node];
+    auto p = input.texCoord * layer.size;
+    auto shape = RoundedRect(float4(float2(0), layer.size), layer.cornerRadius);
+    auto outer = half(shape.contains(p, input.aa));
+    
+    auto color = half4(0);
+    if (flags & DrawFlagBackground) {
+        color = unpack_unorm4x8_to_half(layer.backgroundColor) * outer;
+    }
+    if (flags & DrawFlagContents) {
+        auto c = tex.sample(texSampler, input.texCoord, bias(layer.mipBias));
+        c *= (flags & DrawFlagClipContents) ? outer : 1.0h;
+        color = c + color * (1.0h - c.a);
+    }
+    if (flags & DrawFlagBorder) {
+        auto inner = half(shape.inset(layer.borderWidth).contains(p, input.aa));
+        auto b = unpack_unorm4x8_to_half(layer.borderColor) * saturate(outer - inner);
+        color = b + color * (1.0h - b.a);
     }
+    return color;
+}
+
+/// Rasterizes the layer's rounded bounds for stencil clipping; no color is
+/// written and fragments less than half covered are discarded.
+fragment half4 layer_clip(Varyings input [[stage_in]],
+                          const device LayerNode* layers [[buffer(BufferIndexLayerNode)]])
+{
+    const device LayerNode& layer = layers[input.node];
+    auto p = input.texCoord * layer.size;
+    auto shape = RoundedRect(float4(float2(0), layer.size), layer.cornerRadius);
+    if (shape.contains(p, input.aa) < 0.5) {
+        discard_fragment();
+    }
+    return half4(0);
+}
+
+/// The interpolated data passed from the shape vertex shader to `shape_fill`.
+struct ShapeVaryings {
+    
+    /// The pixel screen coordinate of the current fragment.
+    float4 position [[position]];
+    
+    /// The fraction of the fragment covered by the shape.
+    float coverage [[user(coverage)]];
+    
+    /// The arc length of the fragment along the path of a stroke.
+    float length [[user(length)]];
+};
+
+/// Emits a vertex of a tessellated shape mesh, mapping it from path coordinates
+/// into the layer quad. Fringe vertices are extruded by one screen pixel.
+vertex ShapeVaryings shape_emit_mesh(constant GlobalNode& global [[buffer(BufferIndexGlobalNode)]],
+                                     const device LayerNode* layers [[buffer(BufferIndexLayerNode)]],
+                                     const device float4x4* transforms [[buffer(BufferIndexTransforms)]],
+                                     const device ShapeVertex* vertices [[buffer(BufferIndexShapeVertices)]],
+                                     constant ShapeNode& shape [[buffer(BufferIndexShapeNode)]],
+                                     uint vid [[vertex_id]],
+                                     uint iid [[instance_id]])
+{
+    const device LayerNode& layer = layers[iid];
+    const device ShapeVertex& v = vertices[vid];
+    auto mvp = global.transform * layer_transform(layer, transforms);
+    
+    // Extrude by the pixel size at the unextruded vertex:
+    auto w = (mvp * float4(shape.transform * float3(v.position, 1), 0, 1)).w;
+    auto p = v.position + v.extrude * layer_aa(global, layer, mvp, w);
+    
+    ShapeVaryings output;
+    output.position = mvp * float4(shape.transform * float3(p, 1), 0, 1) - float4(1, 1, 0, 0);
+    output.coverage = v.coverage;
+    output.length = v.length;
+    return output;
 }
 
-/// Draws the layer background color with (optional) corner radius.
-/// Draws the layer contents texture; note that the origin quad may be larger
-/// than the layer bounds and may require shape extrusion.
-fragment float4 layer_contents(Varyings input [[stage_in]],
-                               constant LayerNode& layer [[buffer(BufferIndexLayerNode)]],
-                               texture2d<half> tex [[texture(TextureIndexContents)]],
-                               sampler texSampler [[sampler(SamplerIndexContents)]])
+/// Fills a shape mesh with the premultiplied color of the `shape`, fading out
+/// over one pixel any fragment beyond its `trim`.
+fragment half4 shape_fill(ShapeVaryings input [[stage_in]],
+                          constant ShapeNode& shape [[buffer(BufferIndexShapeNode)]])
 {
-    return float4(tex.sample(texSampler, input.texCoord, bias(layer.mipBias)));
+    auto aa = max(fwidth(input.length), 1e-5);
+    auto trim = saturate((input.length - shape.trim.x) / aa + 0.5) *
+                saturate((shape.trim.y - input.length) / aa + 0.5);
+    return unpack_unorm4x8_to_half(shape.color) * half(saturate(input.coverage) * trim);
 }
 
-/// Draws the layer border color with (optional) corner radius and set border width.
-fragment float4 layer_border(Varyings input [[stage_in]],
-                             constant LayerNode& layer [[buffer(BufferIndexLayerNode)]])
+/// The interpolated data passed from the glyph vertex shader to `text_draw`.
+struct GlyphVaryings {
+    
+    /// The pixel screen coordinate of the current fragment.
+    float4 position [[position]];
+    
+    /// The texel coordinate of the fragment in the glyph atlas.
+    float2 texCoord [[user(texturecoord)]];
+    
+    /// The premultiplied color of the glyph.
+    uint color [[flat]];
+};
+
+/// Emits one corner of the glyph quad selected by the instance index. All of a
+/// layer's glyphs are drawn by one instanced draw, from one shared atlas.
+vertex GlyphVaryings text_emit_glyph(constant GlobalNode& global [[buffer(BufferIndexGlobalNode)]],
+                                     const device LayerNode* layers [[buffer(BufferIndexLayerNode)]],
+                                     const device float4x4* transforms [[buffer(BufferIndexTransforms)]],
+                                     const device GlyphInstance* glyphs [[buffer(BufferIndexGlyphs)]],
+                                     constant TextNode& text [[buffer(BufferIndexTextNode)]],
+                                     uint vid [[vertex_id]],
+                                     uint iid [[instance_id]])
 {
-    if (layer.cornerRadius > 0) {
-        auto plane = float4(float2(0), layer.bounds.zw);
-        auto exterior = RoundedRect(plane, layer.cornerRadius);
-        auto interior = exterior.inset(float4(layer.borderWidth));
-        auto ext_mix = exterior.contains(input.texCoord * plane.zw);
-        auto int_mix = interior.contains(input.texCoord * plane.zw);
-        return mix(layer.borderColor, float4(0), 1.0 - clamp(ext_mix - int_mix, 0.0, 1.0));
-    } else {
-        auto plane = float4(float2(0), layer.bounds.zw);
-        auto exterior = Rect(plane);
-        auto interior = exterior.inset(float4(layer.borderWidth));
-        auto ext_mix = exterior.contains(input.texCoord * plane.zw);
-        auto int_mix = interior.contains(input.texCoord * plane.zw);
-        return mix(layer.borderColor, float4(0), 1.0 - clamp(ext_mix - int_mix, 0.0, 1.0));
+    const device LayerNode& layer = layers[text.node];
+    const device GlyphInstance& glyph = glyphs[iid];
+    auto mvp = global.transform * layer_transform(layer, transforms);
+    
+    // The quad texture coordinates run from the top-left, as do atlas rows:
+    auto c = quad_vertices[vid].zw;
+    auto p = glyph.rect.xy + float2(c.x, 1.0 - c.y) * glyph.rect.zw;
+    
+    GlyphVaryings output;
+    output.position = mvp * float4(text.transform * float3(p, 1), 0, 1) - float4(1, 1, 0, 0);
+    output.texCoord = glyph.texRect.xy + c * glyph.texRect.zw;
+    output.color = glyph.color;
+    return output;
+}
+
+/// Draws a glyph from the coverage in the atlas.
+fragment half4 text_draw(GlyphVaryings input [[stage_in]],
+                         texture2d<half> atlas [[texture(TextureIndexGlyphAtlas)]])
+{
+    constexpr sampler s(coord::pixel, filter::linear);
+    return unpack_unorm4x8_to_half(input.color) * atlas.sample(s, input.texCoord).r;
+}
+
+/// Returns the position of `p` along the `gradient`, which is 0 at its start
+/// and 1 at its end (before clamping). Mirrored by `Render.GradientLayer.position`.
+inline float gradient_position(constant GradientNode& gradient, float2 p)
+{
+    auto d = p - gradient.start, e = gradient.end - gradient.start;
+    switch (gradient.type) {
+    case GradientNodeTypeRadial:
+        return length(d / max(abs(e), 1e-5));
+    case GradientNodeTypeConic:
+        return fract((atan2(d.y, d.x) - atan2(e.y, e.x)) / (2.0 * M_PI_F));
+    default:
+        return dot(d, e) / max(dot(e, e), 1e-10);
     }
 }
+
+/// Draws a gradient over the layer, clipped to its rounded bounds. The color at
+/// each position is sampled from the center of the ramp's texels, so that the
+/// end colors are not blended with the texture's edge.
+fragment half4 gradient_draw(Varyings input [[stage_in]],
+                             const device LayerNode* layers [[buffer(BufferIndexLayerNode)]],
+                             constant GradientNode& gradient [[buffer(BufferIndexGradientNode)]],
+                             texture2d<half> ramp [[texture(TextureIndexGradientRamp)]])
+{
+    constexpr sampler s(coord::normalized, filter::linear, address::clamp_to_edge);
+    const device LayerNode& layer = layers[input.node];
+    
+    // The texture coordinates run from the top-left, and gradients from the
+    // bottom-left:
+    auto p = float2(input.texCoord.x, 1.0 - input.texCoord.y) * layer.size;
+    auto shape = RoundedRect(float4(float2(0), layer.size), layer.cornerRadius);
+    
+    auto w = float(ramp.get_width());
+    auto t = saturate(gradient_position(gradient, p));
+    auto c = ramp.sample(s, float2((t * (w - 1.0) + 0.5) / w, 0.5));
+    return c * half(shape.contains(p, input.aa));
+}
@@ -17,6 +17,51 @@ typedef SWIFT_ENUM(int, BufferIndex) {
     
     /// The `LayerNode` buffer index.
     BufferIndexLayerNode = 1,
+    
+    /// The `DrawFlag` bytes index.
+    BufferIndexDrawFlags = 2,
+    
+    /// The 3D transform buffer index, referenced by `LayerNode.transform3D`.
+    BufferIndexTransforms = 3,
+    
+    /// The `ShapeVertex` buffer index.
+    BufferIndexShapeVertices = 4,
+    
+    /// The `ShapeNode` bytes index.
+    BufferIndexShapeNode = 5,
+    
+    /// The `GlyphInstance` buffer index.
+    BufferIndexGlyphs = 6,
+    
+    /// The `TextNode` bytes index.
+    BufferIndexTextNode = 7,
+    
+    /// The `GradientNode` bytes index.
+    BufferIndexGradientNode = 8,
+};
+
+/// Describes the contents of a `LayerNode`.
+typedef SWIFT_ENUM(int, LayerNodeFlag) {
+    
+    /// The node is positioned by the 4x4 matrix at `transform3D` in the
+    /// transform buffer, rather than by its 2D affine `transform`.
+    LayerNodeFlagTransform3D = 1 << 0,
+};
+
+/// Selects which components of a layer are drawn by a single `layer_draw` pass.
+typedef SWIFT_ENUM(int, DrawFlag) {
+    
+    /// Draws the background color, clipped to the rounded bounds.
+    DrawFlagBackground = 1 << 0,
+    
+    /// Draws the contents texture atop the background.
+    DrawFlagContents = 1 << 1,
+    
+    /// Draws the border atop the background and contents.
+    DrawFlagBorder = 1 << 2,
+    
+    /// Clips the contents texture to the rounded bounds (`masksToBounds`).
+    DrawFlagClipContents = 1 << 3,
 };
 
 /// The fragment shader texture input buffer indices.
@@ -33,6 +78,12 @@ typedef SWIFT_ENUM(int, TextureIndex) {
     
     /// The mask texture index. This is pre-rendered.
     TextureIndexMask = 3,
+    
+    /// The glyph atlas texture index.
+    TextureIndexGlyphAtlas = 4,
+    
+    /// The gradient color ramp texture index.
+    TextureIndexGradientRamp = 5,
 };
 
 /// The fragment shader sampler input buffer indices.
@@ -43,36 +94,84 @@ typedef SWIFT_ENUM(int, SamplerIndex) {
 };
 
 /// The layer node to be rendered.
+///
+/// Nodes are tightly packed (80 bytes) and indexed by instance rather than by
+/// buffer offset, so no per-node padding is needed. Colors are premultiplied
+/// unorm8 RGBA, unpacked with `unpack_unorm4x8_to_float()`. Layers with a 3D
+/// transform set `LayerNodeFlagTransform3D` and index a separate matrix buffer.
 struct LayerNode {
-    matrix_float4x4 transform;
-    matrix_float4x4 contentsTransform;
-    vector_float2 position;
-    vector_float2 anchorPoint;
-    vector_float4 bounds;
-    vector_float4 backgroundColor;
-    vector_float4 borderColor;
+    matrix_float3x2 transform;
+    vector_float2 size;
+    vector_float2 shadowOffset;
+    uint32_t backgroundColor;
+    uint32_t borderColor;
+    uint32_t shadowColor;
     float borderWidth;
     float cornerRadius;
     float mipBias;
-    vector_float4 shadowColor;
-    vector_float2 shadowOffset;
     float shadowRadius;
     float shadowOpacity;
-    
-    // 256 byte padding follows:
-    //float pad000;
-    vector_float4 pad01;
+    uint32_t flags;
+    uint32_t transform3D;
 };
 
-/// The global node encompassing the rendering scene.
+/// The global node encompassing the rendering scene. It is created once per
+/// viewport and shared by every pass that renders into a texture of that size.
 struct GlobalNode {
     matrix_float4x4 transform;
-    vector_float4 viewport;
-    
-    // 256 byte padding follows:
-    vector_float4 pad01;
-    vector_float4 pad02;
-    vector_float4 pad03;
-    matrix_float4x4 pad1;
-    matrix_float4x4 pad2;
+    vector_float4 viewport; // origin and size, in pixels
+};
+
+/// A vertex of a tessellated `ShapeLayer` fill or stroke, in path coordinates.
+/// Fringe vertices are pushed one pixel along `extrude` by the shader, and
+/// their `coverage` falls to zero for anti-aliasing.
+struct ShapeVertex {
+    vector_float2 position;
+    vector_float2 extrude;
+    float coverage;
+    float length; // the arc length along the path of a trimmable stroke
+};
+
+/// The parameters of a single `ShapeLayer` mesh draw.
+struct ShapeNode {
+    matrix_float3x2 transform; // path coordinates to the unit layer quad
+    uint32_t color;
+    vector_float2 trim; // the range of vertex arc lengths drawn
+};
+
+/// A single glyph quad of a `TextLayer`, drawn as one instance.
+struct GlyphInstance {
+    vector_float4 rect;    // origin and size, in layer points
+    vector_float4 texRect; // origin and size in the glyph atlas, in texels
+    uint32_t color;
+};
+
+/// The parameters of a single `TextLayer` glyph batch draw.
+struct TextNode {
+    matrix_float3x2 transform; // layer points to the unit layer quad
+    uint32_t node;
+};
+
+/// The shape of a `GradientNode`; mirrors `GradientLayer.GradientType`.
+typedef SWIFT_ENUM(int, GradientNodeType) {
+    
+    /// The gradient varies along the line from `start` to `end`.
+    GradientNodeTypeAxial = 0,
+    
+    /// The gradient varies from `start` to the edge of the ellipse centered at
+    /// `start` whose radii are the offset of `end`.
+    GradientNodeTypeRadial = 1,
+    
+    /// The gradient varies with the angle around `start`, from the direction
+    /// of `end`.
+    GradientNodeTypeConic = 2,
+};
+
+/// The parameters of a single `GradientLayer` draw. The position along the
+/// gradient is evaluated per fragment, and its color looked up in a ramp
+/// texture of premultiplied colors, so no bitmap of the layer is ever drawn.
+struct GradientNode {
+    vector_float2 start; // in layer points, from the bottom-left
+    vector_float2 end;   // in layer points, from the bottom-left
+    uint32_t type;       // a `GradientNodeType`
 };
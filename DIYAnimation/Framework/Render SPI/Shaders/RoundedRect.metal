@@ -1,8 +1,9 @@
 #include <metal_stdlib>
 using namespace metal;
 
-/// If `1`, `RoundRect` uses `smoothstep()` to anti-alias corner edges.
-#define SMOOTH_CORNERS 0
+/// If `1`, coverage is eased with `smoothstep()` across the anti-aliased edge;
+/// otherwise the edge ramps linearly.
+#define SMOOTH_CORNERS 1
 
 #if SMOOTH_CORNERS
 #define AASTEP(x) smoothstep(0.0, 1.0, x)
@@ -10,6 +11,12 @@ using namespace metal;
 #define AASTEP(x) (x)/*step(0.5, x)*/
 #endif
 
+/// Converts a signed distance `d` (negative inside) into an edge coverage value,
+/// where `aa` is the size of one pixel in the same units as `d`.
+inline float sdf_coverage(float d, float aa) {
+    return AASTEP(clamp(0.5 - d / max(aa, 1e-5), 0.0, 1.0));
+}
+
 /// Describes a rectangle shape.
 struct Rect {
 public:
@@ -18,11 +25,18 @@ public:
     /// Create a new `Rect` with shape `bounds`.
     Rect(float4 bounds): bounds(bounds) {}
     
-    /// Returns a smoothed boolean determining whether the given point is within
-    /// the receiver's bounds.
-    float contains(float2 p) {
-        float2 s = step(this->bounds.xy, p) - step(this->bounds.zw, p);
-        return s.x * s.y;
+    /// Returns the signed distance from the given point to the receiver's edge;
+    /// the distance is negative within the receiver's bounds.
+    float distance(float2 p) {
+        float2 half_size = (this->bounds.zw - this->bounds.xy) * 0.5;
+        float2 q = abs(p - (this->bounds.xy + half_size)) - half_size;
+        return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0);
+    }
+    
+    /// Returns the anti-aliased coverage of the given point within the receiver's
+    /// bounds, where `aa` is the size of one pixel.
+    float contains(float2 p, float aa) {
+        return sdf_coverage(this->distance(p), aa);
     }
     
     /// Returns a copy of the receiver shrunk by the provided `inset` value.
@@ -48,21 +62,19 @@ public:
     /// Converts the `Rect` into a `RoundedRect` with given corner `radius`.
     RoundedRect(Rect rect, float radius): bounds(rect.bounds), radius(radius) {}
     
-    /// Returns a smoothed boolean determining whether the given point is within
-    /// the receiver's *corner-clipped* bounds.
-    float contains(float2 p) {
-        float2 size = this->bounds.zw - this->bounds.xy;
-        float2 pos = p - this->bounds.xy - (size * 0.5);
-        
-        float r = max(min(min(abs(this->radius * 2.0), abs(size.x)), abs(size.y)), 1e-5);
-        float2 uv = abs((pos) * 2.0 - 1.0) - size + r;
-        float d = length(max(float2(0.0), uv)) / r;
-        return clamp(((1.0 - d) / fwidth(d)), 0.0, 1.0);
-        
-        /* // simple rect:
-        float2 d = abs(p * 2 - 1) - size;
-        return clamp(min(1 - d / fwidth(d)), 0, 1);
-        */
+    /// Returns the signed distance from the given point to the receiver's
+    /// *corner-clipped* edge; the distance is negative within the receiver.
+    float distance(float2 p) {
+        float2 half_size = (this->bounds.zw - this->bounds.xy) * 0.5;
+        float r = clamp(this->radius, 0.0, min(half_size.x, half_size.y));
+        float2 q = abs(p - (this->bounds.xy + half_size)) - half_size + r;
+        return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - r;
+    }
+    
+    /// Returns the anti-aliased coverage of the given point within the receiver's
+    /// *corner-clipped* bounds, where `aa` is the size of one pixel.
+    float contains(float2 p, float aa) {
+        return sdf_coverage(this->distance(p), aa);
     }
     
     /// Returns a copy of the receiver shrunk by the provided `inset` value.
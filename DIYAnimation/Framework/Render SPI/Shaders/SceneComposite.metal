@@ -25,15 +25,20 @@ struct Varyings {
     
     /// The unit space coordinate of the fragment's texture.
     float2 texCoord [[user(texturecoord)]];
+    
+    /// The index of the `LayerNode` being composited, if any.
+    uint node [[flat]];
 };
 
 /// Emits a full-scene texture mapping.
-vertex Varyings scene_emit_quad(uint vid [[vertex_id]])
+vertex Varyings scene_emit_quad(uint vid [[vertex_id]],
+                                uint iid [[instance_id]])
 {
     // Submit vertex without adjustment:
     Varyings output;
     output.position = float4(quad_vertices[vid].xy, 0, 1);
     output.texCoord = quad_vertices[vid].zw;
+    output.node = iid;
     return output;
 }
 
@@ -47,17 +52,19 @@ fragment float4 scene_composite(Varyings input [[stage_in]],
 
 /// Composite an existing scene saved as a texture with its pre-rendered shadow.
 fragment float4 scene_shadow(Varyings input [[stage_in]],
-                             constant LayerNode& layer [[buffer(BufferIndexLayerNode)]],
+                             const device LayerNode* layers [[buffer(BufferIndexLayerNode)]],
                              texture2d<float> texture [[texture(TextureIndexComposite)]],
                              texture2d<float> shadow [[texture(TextureIndexShadow)]])
 {
     constexpr sampler texSampler(filter::linear, address::clamp_to_edge);
+    const device LayerNode& layer = layers[input.node];
+    auto shadowColor = unpack_unorm4x8_to_float(layer.shadowColor);
     auto s = shadow.sample(texSampler, input.texCoord - layer.shadowOffset);
     auto c = texture.sample(texSampler, input.texCoord);
     
     // Source-over composite the two textures, applying the shadow parameters:
     auto color = float4(0);
-    color.rgb = c.rgb + (float3(layer.shadowColor) * (1.0 - c.a));
+    color.rgb = c.rgb + (shadowColor.rgb * (1.0 - c.a));
     color.a = c.a + (s.a * layer.shadowOpacity * (1.0 - c.a));
     return color;
 }
@@ -73,14 +80,15 @@ fragment float4 scene_mask_bounds_only(Varyings input [[stage_in]],
 }
 
 /// Composite an existing scene against a layer's mask, pre-rendered as a texture.
+/// Both textures are premultiplied, so the blend state performs the source-over.
 fragment float4 scene_mask_layer_only(Varyings input [[stage_in]],
                                       texture2d<float> tex [[texture(TextureIndexComposite)]],
-                                      texture2d<float> mask [[texture(TextureIndexShadow)]])
+                                      texture2d<float> mask [[texture(TextureIndexMask)]])
 {
     constexpr sampler texSampler(filter::linear, address::clamp_to_edge);
     auto c = tex.sample(texSampler, input.texCoord);
     auto m = mask.sample(texSampler, input.texCoord);
-    return c * m.a; // TODO: source-over
+    return c * m.a;
 }
 
 /// Composite an existing scene against a layer's mask, pre-rendered as a texture,
@@ -0,0 +1,362 @@
+import Foundation
+
+/// A fixed number of timestamped image slots in memory shared between exactly
+/// one producer, which inserts images, and one consumer, which samples the
+/// image to display at each refresh; neither side ever takes a lock.
+///
+/// Every word of the ring is written by only one side. The producer publishes
+/// a slot by a release store of `head`, after writing the slot, and the
+/// consumer retires slots by a release store of `tail`, after writing their
+/// display counts; each side acquires the other's index before reading the
+/// slots it covers. The two sides' words live on separate cache lines.
+///
+/// The memory holds `SlotRing.size(capacity:)` bytes, as 64-bit words:
+///
+/// - bytes 0..<64, written by the producer: `head`, `flushed`, `capacity`,
+///   `options`.
+/// - bytes 64..<192, written by the consumer: `tail`, `displayed`,
+///   `displayTime`, `dropped`, `late`, `sampleTime`, `period`,
+///   `sampleFrameTime`, `framePeriod`.
+/// - 64 bytes per slot: its `time`, `kind`, `id`, and `flags`, written by the
+///   producer, then its display count and first display frame and layer time,
+///   written by the consumer, then its sequence number, written by the producer.
+///
+/// Slots are addressed by sequence number, the count of images inserted before
+/// them, modulo the capacity. The consumer keeps the displayed slot until a
+/// later one replaces it, so that its image is never reused while on screen.
+///
+/// Once flushed, a slot may be reused before the consumer has retired it, so
+/// that a flush always makes room. The consumer therefore validates each slot
+/// it reads against its sequence number (as a seqlock), and the display count
+/// is tagged with the sequence number it counts, so that a count written to a
+/// slot since reused is ignored.
+internal struct SlotRing {
+    
+    /// An image inserted by the producer.
+    internal struct Slot {
+        
+        /// The layer time at which the image should first be displayed.
+        var time: TimeInterval
+        
+        /// The kind of the image's identifier, defined by the producer.
+        var kind: UInt64
+        
+        ///
+        var id: UInt64
+        
+        ///
+        var flags: UInt64
+    }
+    
+    /// How an image was displayed, once it is retired.
+    internal struct Display {
+        
+        /// The number of samples at which the image was displayed.
+        var count: UInt64
+        
+        /// The media time of the frame at which it was first displayed.
+        var frameTime: TimeInterval
+        
+        /// The layer time of the sample at which it was first displayed.
+        var time: TimeInterval
+    }
+    
+    ///
+    private enum Word: Int {
+        case head = 0, flushed, capacity, options
+        case tail = 8, displayed, displayTime, dropped, late, sampleTime, period,
+             sampleFrameTime, framePeriod
+    }
+    
+    ///
+    private enum SlotWord: Int {
+        case time, kind, id, flags, displayCount, displayFrameTime, displayTime, sequence
+    }
+    
+    ///
+    private static let headerSize = 192
+    
+    /// One cache line per slot, so that neighbouring slots never share one.
+    private static let slotSize = 64
+    
+    /// The number of bytes of memory used by a ring of `capacity` slots.
+    internal static func size(capacity: Int) -> Int {
+        return SlotRing.headerSize + capacity * SlotRing.slotSize
+    }
+    
+    ///
+    private let words: UnsafeMutablePointer<UInt64>
+    
+    /// The number of slots in the ring.
+    internal let capacity: Int
+    
+    /// Creates an empty ring of `capacity` slots in `memory`, which must hold
+    /// `SlotRing.size(capacity:)` bytes aligned to 8 bytes. Called by the
+    /// producer before the memory is shared.
+    internal init(initializing memory: UnsafeMutableRawPointer, capacity: Int) {
+        precondition(capacity > 1, "A ring requires at least two slots!")
+        memset(memory, 0, SlotRing.size(capacity: capacity))
+        self.words = memory.bindMemory(to: UInt64.self, capacity: SlotRing.size(capacity: capacity) / 8)
+        self.capacity = capacity
+        self.words[Word.capacity.rawValue] = UInt64(capacity)
+        self.words[Word.sampleTime.rawValue] = (-Double.infinity).bitPattern
+        self.words[Word.sampleFrameTime.rawValue] = (-Double.infinity).bitPattern
+    }
+    
+    /// Attaches to a ring previously created in `memory` by `init(initializing:capacity:)`.
+    internal init(attaching memory: UnsafeMutableRawPointer) {
+        let capacity = Int(memory.load(fromByteOffset: Word.capacity.rawValue * 8, as: UInt64.self))
+        self.words = memory.bindMemory(to: UInt64.self, capacity: SlotRing.size(capacity: capacity) / 8)
+        self.capacity = capacity
+    }
+    
+    ///
+    private func word(_ w: Word) -> UnsafeMutablePointer<UInt64> {
+        return self.words + w.rawValue
+    }
+    
+    ///
+    private func word(_ w: SlotWord, _ seq: UInt64) -> UnsafeMutablePointer<UInt64> {
+        let slot = Int(seq % UInt64(self.capacity))
+        return self.words + (SlotRing.headerSize + slot * SlotRing.slotSize) / 8 + w.rawValue
+    }
+    
+    /// The number of images ever inserted.
+    internal var head: UInt64 {
+        return __load_acquire(self.word(.head))
+    }
+    
+    /// The sequence number of the oldest slot not yet retired by the consumer.
+    internal var tail: UInt64 {
+        return __load_acquire(self.word(.tail))
+    }
+    
+    /// One past the sequence number of the displayed slot, or 0 if none.
+    internal var displayed: UInt64 {
+        return __load_relaxed(self.word(.displayed))
+    }
+    
+    /// The layer time of the most recent sample at which a slot was displayed.
+    internal var displayTime: TimeInterval {
+        return Double(bitPattern: __load_relaxed(self.word(.displayTime)))
+    }
+    
+    /// The number of images retired without ever being displayed, as a later
+    /// image was due first.
+    internal var dropped: UInt64 {
+        return __load_relaxed(self.word(.dropped))
+    }
+    
+    /// The number of images first displayed after the sample they were due at,
+    /// as they were inserted too late for it.
+    internal var late: UInt64 {
+        return __load_relaxed(self.word(.late))
+    }
+    
+    /// The layer time of the most recent sample, or `-infinity` if none.
+    internal var sampleTime: TimeInterval {
+        return Double(bitPattern: __load_relaxed(self.word(.sampleTime)))
+    }
+    
+    /// The layer time interval between the two most recent samples, or 0 if
+    /// unknown.
+    internal var period: TimeInterval {
+        return Double(bitPattern: __load_relaxed(self.word(.period)))
+    }
+    
+    /// The media time of the frame of the most recent sample, or `-infinity`
+    /// if none.
+    internal var sampleFrameTime: TimeInterval {
+        return Double(bitPattern: __load_relaxed(self.word(.sampleFrameTime)))
+    }
+    
+    /// The media time interval between the frames of the two most recent
+    /// samples, or 0 if unknown.
+    internal var framePeriod: TimeInterval {
+        return Double(bitPattern: __load_relaxed(self.word(.framePeriod)))
+    }
+    
+    /// The slot with sequence number `seq`; valid for the producer while it is
+    /// not collected.
+    internal func slot(_ seq: UInt64) -> Slot {
+        return Slot(time: Double(bitPattern: self.word(.time, seq).pointee),
+                    kind: self.word(.kind, seq).pointee,
+                    id: self.word(.id, seq).pointee,
+                    flags: self.word(.flags, seq).pointee)
+    }
+    
+    /// How the slot with sequence number `seq` was displayed; final once the
+    /// producer has seen it retired.
+    internal func display(_ seq: UInt64) -> Display {
+        let count = self.displayCount(seq)
+        guard count > 0 else { return Display(count: 0, frameTime: .nan, time: .nan) }
+        return Display(count: count,
+                       frameTime: Double(bitPattern: __load_relaxed(self.word(.displayFrameTime, seq))),
+                       time: Double(bitPattern: __load_relaxed(self.word(.displayTime, seq))))
+    }
+    
+    /// The tag of the display count of the slot `seq`.
+    private static func tag(_ seq: UInt64) -> UInt64 {
+        return ((seq + 1) & 0xFFFF_FFFF) << 32
+    }
+    
+    /// The number of samples at which the slot `seq` was displayed, or 0 if its
+    /// count belongs to another image.
+    private func displayCount(_ seq: UInt64) -> UInt64 {
+        let w = __load_relaxed(self.word(.displayCount, seq))
+        return w & ~0xFFFF_FFFF == SlotRing.tag(seq) ? w & 0xFFFF_FFFF : 0
+    }
+    
+    //
+    // Producer:
+    //
+    
+    /// Inserts `slot` as the newest image, returning `false` if the ring is full.
+    ///
+    /// Only slots before `reclaimed`, which the producer has read back since
+    /// they were retired, are reused; until then a retired slot still holds how
+    /// its image was displayed.
+    internal func push(_ slot: Slot, reclaimed: UInt64) -> Bool {
+        let head = __load_relaxed(self.word(.head))
+        guard head - min(self.reclaimable, reclaimed) < UInt64(self.capacity) else { return false }
+        
+        // A flushed slot may still be read by the consumer, so it is marked
+        // invalid before it is overwritten:
+        let sequence = self.word(.sequence, head)
+        __store_relaxed(sequence, 0)
+        __fence_release()
+        __store_relaxed(self.word(.time, head), slot.time.bitPattern)
+        __store_relaxed(self.word(.kind, head), slot.kind)
+        __store_relaxed(self.word(.id, head), slot.id)
+        __store_relaxed(self.word(.flags, head), slot.flags)
+        __store_relaxed(self.word(.displayCount, head), 0)
+        __store_relaxed(self.word(.displayFrameTime, head), Double.nan.bitPattern)
+        __store_relaxed(self.word(.displayTime, head), Double.nan.bitPattern)
+        __store_release(sequence, head + 1)
+        __store_release(self.word(.head), head + 1)
+        return true
+    }
+    
+    /// Marks every inserted image as flushed; the consumer retires them without
+    /// displaying them, including the displayed image, on its next sample.
+    internal func flush() {
+        __store_release(self.word(.flushed), __load_relaxed(self.word(.head)))
+    }
+    
+    /// The sequence number before which every image was flushed.
+    internal var flushed: UInt64 {
+        return __load_acquire(self.word(.flushed))
+    }
+    
+    /// The sequence number before which every slot may be reused once the
+    /// producer has collected it, as it was either retired or flushed.
+    internal var reclaimable: UInt64 {
+        return max(self.tail, self.flushed)
+    }
+    
+    /// Options for the consumer, defined by the producer.
+    internal var options: UInt64 {
+        get { return __load_relaxed(self.word(.options)) }
+        nonmutating set { __store_relaxed(self.word(.options), newValue) }
+    }
+    
+    //
+    // Consumer:
+    //
+    
+    /// Reads the slot `seq` on behalf of the consumer, or returns `nil` if the
+    /// producer has reused it since, which it only does once `seq` is flushed.
+    private func read(_ seq: UInt64) -> Slot? {
+        let sequence = self.word(.sequence, seq)
+        guard __load_acquire(sequence) == seq + 1 else { return nil }
+        let slot = Slot(time: Double(bitPattern: __load_relaxed(self.word(.time, seq))),
+                        kind: __load_relaxed(self.word(.kind, seq)),
+                        id: __load_relaxed(self.word(.id, seq)),
+                        flags: __load_relaxed(self.word(.flags, seq)))
+        __fence_acquire()
+        return __load_relaxed(sequence) == seq + 1 ? slot : nil
+    }
+    
+    /// Selects the image to display at the layer `time`, retiring every older
+    /// image, and returns its slot, or `nil` if there is none. The consumer
+    /// provides the media time of the frame being drawn, `frameTime`, as the
+    /// layer time may be offset or scaled relative to it.
+    ///
+    /// The latest image due at or before `time` is displayed. If none is due
+    /// yet, the displayed image is kept; if there is none, the oldest image is
+    /// displayed early when `fill` is set.
+    internal func sample(at time: TimeInterval, frameTime: TimeInterval, fill: Bool) -> Slot? {
+        var tail = __load_relaxed(self.word(.tail))
+        var displayed = __load_relaxed(self.word(.displayed))
+        var chosen: (seq: UInt64, slot: Slot)? = nil
+        var stale = false
+        repeat {
+            // A slot is only reused once it is flushed, so a stale read starts
+            // over from the latest flush:
+            let flushed = self.flushed
+            let head = self.head
+            if flushed > tail {
+                tail = flushed
+            }
+            if displayed > 0 && displayed - 1 < tail {
+                displayed = 0
+            }
+            
+            chosen = nil
+            stale = false
+            for seq in (tail..<head).reversed() {
+                guard let slot = self.read(seq) else {
+                    stale = true
+                    break
+                }
+                if slot.time <= time {
+                    chosen = (seq, slot)
+                    break
+                }
+            }
+            if !stale && chosen == nil,
+                let seq = displayed > 0 ? displayed - 1 : (fill && tail < head ? tail : nil)
+            {
+                if let slot = self.read(seq) {
+                    chosen = (seq, slot)
+                } else {
+                    stale = true
+                }
+            }
+        } while stale
+        
+        let previous = self.sampleTime, previousFrame = self.sampleFrameTime
+        if let c = chosen?.seq, let slot = chosen?.slot {
+            var dropped: UInt64 = 0
+            for seq in tail..<c where self.displayCount(seq) == 0 {
+                dropped += 1
+            }
+            if dropped > 0 {
+                __store_relaxed(self.word(.dropped), self.dropped + dropped)
+            }
+            if c + 1 != displayed {
+                if slot.time <= previous {
+                    __store_relaxed(self.word(.late), self.late + 1)
+                }
+                __store_relaxed(self.word(.displayFrameTime, c), frameTime.bitPattern)
+                __store_relaxed(self.word(.displayTime, c), time.bitPattern)
+            }
+            __store_relaxed(self.word(.displayCount, c), SlotRing.tag(c) | (self.displayCount(c) + 1))
+            tail = c
+            displayed = c + 1
+            __store_relaxed(self.word(.displayTime), time.bitPattern)
+        }
+        
+        if previous.isFinite && time > previous && time - previous < 1.0 {
+            __store_relaxed(self.word(.period), (time - previous).bitPattern)
+        }
+        if previousFrame.isFinite && frameTime > previousFrame && frameTime - previousFrame < 1.0 {
+            __store_relaxed(self.word(.framePeriod), (frameTime - previousFrame).bitPattern)
+        }
+        __store_relaxed(self.word(.sampleTime), time.bitPattern)
+        __store_relaxed(self.word(.sampleFrameTime), frameTime.bitPattern)
+        __store_relaxed(self.word(.displayed), displayed)
+        __store_release(self.word(.tail), tail)
+        return chosen?.slot
+    }
+}
@@ -1,15 +1,23 @@
 
+/// A thread's value, whose destructor is invoked as the thread exits.
+fileprivate protocol ThreadLocalValue: AnyObject {
+    func destruct()
+}
+
 ///
 internal final class ThreadLocal<Element> {
     
     ///
-    private final class Wrapper {
+    private final class Wrapper: ThreadLocalValue {
         var value: Element?
         weak var parent: ThreadLocal<Element>?
         init(_ value: Element?, _ parent: ThreadLocal<Element>) {
             self.value = value
             self.parent = parent
         }
+        func destruct() {
+            self.parent?.destructor?(self.value)
+        }
     }
     
     ///
@@ -20,10 +28,10 @@ internal final class ThreadLocal<Element> {
     
     ///
     internal init(_ destructor: @escaping (Element?) -> ()) {
+        self.destructor = destructor
         pthread_key_create(&self.key, {
             let unmanaged = Unmanaged<AnyObject>.fromOpaque($0)
-            //let wrapper = unmanaged.takeUnretainedValue()
-            //wrapper.parent?.destructor?(wrapper.value)
+            (unmanaged.takeUnretainedValue() as? ThreadLocalValue)?.destruct()
             unmanaged.release()
         })
     }
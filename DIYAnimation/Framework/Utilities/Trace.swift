@@ -0,0 +1,316 @@
+import Foundation
+import Dispatch
+
+/// A low-overhead tracer for the render pipeline.
+///
+/// Each thread records into a fixed-size ring of events that only it writes
+/// to, publishing each event with a release store of the ring's head, so that
+/// recording never takes a lock and a reader on another thread only sees
+/// complete events. Once a ring is full its oldest events are overwritten, and
+/// it is released once its thread exits.
+///
+/// Scopes (`begin(_:)`, `end(_:)`, and `scope(_:_:)`) are only compiled when
+/// the `TRACE` compilation condition is set, and otherwise inline to nothing.
+/// Counters are always kept, as `Renderer.statistics` is derived from them;
+/// with `TRACE`, every change to a counter is also recorded as an event, and
+/// without it no ring is allocated at all.
+internal enum Trace {
+    
+    /// The quantities counted over each frame.
+    internal enum Counter: Int, CaseIterable {
+        
+        /// Layers converted into nodes while building a `RenderOp` chain.
+        case layersVisited
+        
+        /// `RenderOp`s queued while building a `RenderOp` chain.
+        case opsEmitted
+        
+        /// Layers rendered into an intermediate texture before compositing.
+        case offscreenPasses
+        
+        /// Textures created on the GPU, including stencils.
+        case textureAllocations
+        
+        /// Bytes copied from the CPU into GPU textures and buffers.
+        case bytesUploaded
+        
+        /// Draw calls encoded.
+        case drawCalls
+        
+        /// The name of the counter in exported traces.
+        fileprivate var name: StaticString {
+            switch self {
+            case .layersVisited: return "layersVisited"
+            case .opsEmitted: return "opsEmitted"
+            case .offscreenPasses: return "offscreenPasses"
+            case .textureAllocations: return "textureAllocations"
+            case .bytesUploaded: return "bytesUploaded"
+            case .drawCalls: return "drawCalls"
+            }
+        }
+    }
+    
+    /// The value of every `Counter` at some point in time.
+    internal struct Counters {
+        
+        ///
+        fileprivate var values = [UInt64](repeating: 0, count: Counter.allCases.count)
+        
+        ///
+        internal subscript(_ counter: Counter) -> UInt64 {
+            return self.values[counter.rawValue]
+        }
+        
+        /// The change in each counter from `rhs` to `lhs`.
+        internal static func -(_ lhs: Counters, _ rhs: Counters) -> Counters {
+            var c = Counters()
+            for i in c.values.indices {
+                c.values[i] = lhs.values[i] &- rhs.values[i]
+            }
+            return c
+        }
+        
+        /// The sum of each counter of `lhs` and `rhs`.
+        internal static func +(_ lhs: Counters, _ rhs: Counters) -> Counters {
+            var c = Counters()
+            for i in c.values.indices {
+                c.values[i] = lhs.values[i] &+ rhs.values[i]
+            }
+            return c
+        }
+    }
+    
+    /// A single recorded event.
+    fileprivate struct Event {
+        
+        ///
+        enum Phase: UInt8 {
+            case begin, end, counter
+        }
+        
+        ///
+        var name: StaticString
+        
+        ///
+        var phase: Phase
+        
+        /// The `mach_absolute_time()` at which the event was recorded.
+        var time: UInt64
+        
+        /// The value of a counter event.
+        var value: UInt64
+    }
+    
+    /// The events and counters recorded by a single thread.
+    fileprivate final class Buffer {
+        
+        /// The number of events retained by each thread; a power of two.
+        static let capacity = 1 << 14
+        
+        /// The system-wide identifier of the owning thread.
+        let thread: UInt64
+        
+        /// The name of the owning thread, or its dispatch queue.
+        let name: String
+        
+        /// The ring of events, only allocated with the `TRACE` condition.
+        let events: UnsafeMutablePointer<Event>?
+        
+        /// The number of events ever recorded; only stored to by the owner.
+        let head = UnsafeMutablePointer<UInt64>.allocate(capacity: 1)
+        
+        /// The totals of each `Counter`; only stored to by the owner.
+        let counters = UnsafeMutablePointer<UInt64>.allocate(capacity: Counter.allCases.count)
+        
+        ///
+        init() {
+            var tid: UInt64 = 0
+            pthread_threadid_np(nil, &tid)
+            self.thread = tid
+            
+            let label = String(cString: __dispatch_queue_get_label(nil))
+            self.name = Thread.isMainThread ? "main" : (label.isEmpty ? "thread \(tid)" : label)
+            #if TRACE
+            self.events = .allocate(capacity: Buffer.capacity)
+            #else
+            self.events = nil
+            #endif
+            self.head.initialize(to: 0)
+            self.counters.initialize(repeating: 0, count: Counter.allCases.count)
+        }
+        
+        ///
+        deinit {
+            self.events?.deallocate()
+            self.head.deallocate()
+            self.counters.deallocate()
+        }
+        
+        /// Appends the event to the ring. Must be called on the owning thread.
+        @inline(__always)
+        func record(_ event: Event) {
+            let h = self.head.pointee
+            self.events![Int(h) & (Buffer.capacity - 1)] = event
+            __store_release(self.head, h + 1)
+        }
+        
+        /// Adds `n` to the `counter`. Must be called on the owning thread.
+        @inline(__always)
+        func add(_ counter: Counter, _ n: UInt64) -> UInt64 {
+            let p = self.counters + counter.rawValue
+            let value = p.pointee &+ n
+            __store_relaxed(p, value)
+            return value
+        }
+        
+        /// The current counter totals; may be called from any thread.
+        func totals() -> Counters {
+            var c = Counters()
+            for i in c.values.indices {
+                c.values[i] = __load_relaxed(self.counters + i)
+            }
+            return c
+        }
+        
+        /// Copies the events in the ring, oldest first; may be called from any
+        /// thread. Events overwritten during the copy are discarded.
+        func snapshot() -> [Event] {
+            guard let ring = self.events else { return [] }
+            let end = __load_acquire(self.head)
+            let start = end > UInt64(Buffer.capacity) ? end - UInt64(Buffer.capacity) : 0
+            var events = (start..<end).map { ring[Int($0) & (Buffer.capacity - 1)] }
+            
+            // The owner may since have lapped the start of the copy, and may be
+            // writing the slot after its head:
+            let after = __load_acquire(self.head) + 1
+            let valid = after > UInt64(Buffer.capacity) ? after - UInt64(Buffer.capacity) : 0
+            if valid > start {
+                events.removeFirst(min(Int(valid - start), events.count))
+            }
+            return events
+        }
+    }
+    
+    /// The buffers of all live threads; threads register once, on their first
+    /// event, and unregister as they exit.
+    private static var buffers: [Buffer] = []
+    
+    /// The counter totals of all threads that have exited.
+    private static var exited = Counters()
+    
+    ///
+    private static let lock = Lock()
+    
+    /// Unregisters the buffer of an exiting thread, releasing it (and its ring)
+    /// once no export is reading it; its counters are kept in `exited`.
+    private static let local = ThreadLocal<Buffer> { b in
+        guard let b = b else { return }
+        Trace.lock.whileLocked {
+            Trace.exited = Trace.exited + b.totals()
+            Trace.buffers.removeAll { $0 === b }
+        }
+    }
+    
+    /// The current thread's buffer, registered on first use.
+    private static var buffer: Buffer {
+        if let b = Trace.local.value {
+            return b
+        }
+        let b = Buffer()
+        Trace.lock.whileLocked {
+            Trace.buffers.append(b)
+        }
+        Trace.local.value = b
+        return b
+    }
+    
+    /// Marks the beginning of the scope `name` on the current thread.
+    @inline(__always)
+    internal static func begin(_ name: StaticString) {
+        #if TRACE
+        Trace.buffer.record(Event(name: name, phase: .begin, time: mach_absolute_time(), value: 0))
+        #endif
+    }
+    
+    /// Marks the end of the innermost scope `name` on the current thread.
+    @inline(__always)
+    internal static func end(_ name: StaticString) {
+        #if TRACE
+        Trace.buffer.record(Event(name: name, phase: .end, time: mach_absolute_time(), value: 0))
+        #endif
+    }
+    
+    /// Performs `work` within the scope `name`.
+    @inline(__always)
+    internal static func scope<Result>(_ name: StaticString,
+                                       _ work: () throws -> Result) rethrows -> Result
+    {
+        Trace.begin(name)
+        defer { Trace.end(name) }
+        return try work()
+    }
+    
+    /// Adds `n` to the `counter` of the current thread.
+    @inline(__always)
+    internal static func count(_ counter: Counter, _ n: Int = 1) {
+        let b = Trace.buffer
+        let value = b.add(counter, UInt64(n))
+        #if TRACE
+        b.record(Event(name: counter.name, phase: .counter, time: mach_absolute_time(), value: value))
+        #else
+        _ = value
+        #endif
+    }
+    
+    /// The counter totals of every thread, including those that have exited.
+    /// The difference between two totals counts all work done between them on
+    /// any thread, including any done in the background.
+    internal static var counters: Counters {
+        return Trace.lock.whileLocked {
+            Trace.buffers.reduce(Trace.exited) { $0 + $1.totals() }
+        }
+    }
+    
+    /// All events retained by every thread, in the Chrome trace event format,
+    /// which may be opened by `chrome://tracing` or the Perfetto UI.
+    internal static func export() throws -> Data {
+        var timebase = mach_timebase_info_data_t()
+        mach_timebase_info(&timebase)
+        let micros = { (t: UInt64) -> Double in
+            return Double(t) * Double(timebase.numer) / Double(timebase.denom) / 1000.0
+        }
+        
+        let pid = Int(getpid())
+        let buffers = Trace.lock.whileLocked { Trace.buffers }
+        var events = [[String: Any]]()
+        for b in buffers {
+            events.append(["name": "thread_name", "ph": "M", "pid": pid, "tid": b.thread,
+                           "args": ["name": b.name]])
+            
+            // A ring that has wrapped may hold the end of a scope whose beginning
+            // was overwritten; these are dropped so that scopes stay balanced.
+            var depth = 0
+            for e in b.snapshot() {
+                let name = e.name.description
+                var event: [String: Any] = ["name": name, "cat": "render", "pid": pid,
+                                            "tid": b.thread, "ts": micros(e.time)]
+                switch e.phase {
+                case .begin:
+                    depth += 1
+                    event["ph"] = "B"
+                case .end:
+                    guard depth > 0 else { continue }
+                    depth -= 1
+                    event["ph"] = "E"
+                case .counter:
+                    event["ph"] = "C"
+                    event["args"] = [name: e.value]
+                }
+                events.append(event)
+            }
+        }
+        return try JSONSerialization.data(withJSONObject: ["traceEvents": events,
+                                                           "displayTimeUnit": "ms"],
+                                          options: [])
+    }
+}
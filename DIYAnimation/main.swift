@@ -1,4 +1,33 @@
 import Cocoa
+import Metal
+
+// Run the render benchmark without any UI if requested, writing its report to
+// the path following the argument, or standard output if none was given:
+if let i = CommandLine.arguments.firstIndex(of: "--benchmark") {
+    let report = Renderer.Benchmark(MTLCreateSystemDefaultDevice()!).run()
+    let data = try! report.encoded()
+    if i + 1 < CommandLine.arguments.count {
+        try! data.write(to: URL(fileURLWithPath: CommandLine.arguments[i + 1]))
+    } else {
+        FileHandle.standardOutput.write(data)
+    }
+    exit(0)
+}
+
+// Compile the markup file following the argument into a package at the path
+// following it, without any UI:
+if let i = CommandLine.arguments.firstIndex(of: "--compile-markup"), i + 2 < CommandLine.arguments.count {
+    let input = URL(fileURLWithPath: CommandLine.arguments[i + 1])
+    do {
+        let package = try Markup.Package.compile(contentsOf: input)
+        try package.write(to: URL(fileURLWithPath: CommandLine.arguments[i + 2]))
+    } catch {
+        FileHandle.standardError.write("\(input.path): \(error)\n".data(using: .utf8)!)
+        exit(1)
+    }
+    exit(0)
+}
+
 autoreleasepool {
     var delegate: NSApplicationDelegate? = AppDelegate()
     withExtendedLifetime(delegate) {